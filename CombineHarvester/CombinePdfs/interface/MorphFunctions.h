@@ -1,6 +1,8 @@
 #ifndef ICHiggsTauTau_CombineTools_MorphFunctions_h
 #define ICHiggsTauTau_CombineTools_MorphFunctions_h
 #include <algorithm>
+#include <map>
+#include <string>
 #include <vector>
 #include "RooWorkspace.h"
 #include "RooHistPdf.h"
@@ -41,6 +43,17 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
                       std::string const& mass_max, std::string norm_postfix,
                       bool allow_morph, bool verbose, TFile * file = nullptr);
 
+// Builds the morphing for every (bin, process) pair in cb whose process is a
+// key in mass_vars, using the mapped mass variable. The histogram inputs are
+// extracted using up to n_threads threads (0 = one per core), while the RooFit
+// objects are created and imported serially.
+void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
+                      std::map<std::string, RooAbsReal *> const& mass_vars,
+                      std::string const& mass_min,
+                      std::string const& mass_max, std::string norm_postfix,
+                      bool allow_morph, bool verbose, TFile * file = nullptr,
+                      unsigned n_threads = 1);
+
 TGraph GraphFromSpline(RooSpline1D const* spline);
 }
 #endif
@@ -1,46 +1,86 @@
 #include "CombinePdfs/interface/MorphFunctions.h"
 #include <iostream>
+#include <map>
 #include <set>
+#include <utility>
 #include <vector>
 #include <string>
 #include "boost/lexical_cast.hpp"
 #include "boost/format.hpp"
 #include "boost/multi_array.hpp"
+#include "RVersion.h"
+#include "TROOT.h"
 #include "RooFitResult.h"
 #include "RooRealVar.h"
 #include "RooDataHist.h"
 #include "RooProduct.h"
 #include "RooConstVar.h"
 #include "CombineTools/interface/Logging.h"
+#include "CombineTools/interface/Selection.h"
+#include "CombineTools/interface/Threading.h"
 
 namespace ch {
 
-void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
-                      std::string const& bin, std::string const& process,
-                      RooAbsReal& mass_var, std::string const& mass_min,
-                      std::string const& mass_max, std::string norm_postfix,
-                      bool allow_morph, bool verbose, TFile * file) {
+namespace {
+// Everything needed to build the morphing for one (bin, process) pair that
+// can be extracted without creating any RooFit objects
+struct MorphInputs {
+  std::string bin;
+  std::string process;
+  std::vector<ch::Process *> procs;
+  std::vector<ch::Systematic *> systs;
+
+  // m = mass points, ss = shape systematics, lms = lnN morphing systematics
+  std::vector<std::string> m_str_vec;
+  std::vector<double> m_vec;
+  std::vector<std::string> ss_vec;
+  std::vector<std::string> lms_vec;
+  std::set<std::string> lms_set;
+  boost::multi_array<ch::Process *, 1> pr_arr;
+  boost::multi_array<ch::Systematic *, 2> ss_arr;
+  boost::multi_array<double, 1> ss_scale_arr;
+  boost::multi_array<bool, 1> ss_must_scale_arr;
+  boost::multi_array<TH1F, 2> hist_arr;
+  boost::multi_array<double, 1> rate_arr;
+  boost::multi_array<double, 2> ss_k_hi_arr;
+  boost::multi_array<double, 2> ss_k_lo_arr;
+  boost::multi_array<double, 2> lms_k_hi_arr;
+  boost::multi_array<double, 2> lms_k_lo_arr;
+  TH1F proc_hist;
+};
+
+// Fills the MorphInputs from the procs and systs of the pair. The objects are
+// indexed by mass and systematic name in a single pass, then the histograms
+// and normalisations at each mass point are copied out. Only objects that
+// belong to this pair are touched, so pairs can be processed concurrently.
+void CollectMorphInputs(MorphInputs & in, std::string const& mass_min,
+                        std::string const& mass_max) {
   using std::set;
   using std::vector;
   using std::string;
   using boost::lexical_cast;
-  using boost::multi_array;
   using boost::extents;
 
-  RooFit::MsgLevel backup_msg_level =
-      RooMsgService::instance().globalKillBelow();
-  if (!verbose) RooMsgService::instance().setGlobalKillBelow(RooFit::WARNING);
-
-  if (verbose)
-    std::cout << ">> Bin: " << bin << "  Process: " << process << "\n";
-  TString key = bin + "_" + process;
-
-  CombineHarvester cb_bp =
-      std::move(cb.cp().bin({bin}).process({process}));
-
-  vector<string> masses_all = Set2Vec(cb_bp.SetFromProcs(
-      std::mem_fn(&ch::Process::mass)));
+  std::map<string, ch::Process *> pr_map;
+  for (auto p : in.procs) pr_map[p->mass()] = p;
+
+  typedef std::pair<string, string> MassSyst;
+  std::map<MassSyst, ch::Systematic *> ss_map;
+  std::map<MassSyst, ch::Systematic *> ls_map;
+  set<string> ss_names;
+  set<string> ls_names;
+  for (auto n : in.systs) {
+    if (n->type() == "shape") {
+      ss_map[MassSyst(n->mass(), n->name())] = n;
+      ss_names.insert(n->name());
+    } else if (n->type() == "lnN") {
+      ls_map[MassSyst(n->mass(), n->name())] = n;
+      ls_names.insert(n->name());
+    }
+  }
 
+  vector<string> masses_all;
+  for (auto const& it : pr_map) masses_all.push_back(it.first);
   std::sort(masses_all.begin(), masses_all.end(),
     [](string const& s1, string const& s2) {
       return lexical_cast<double>(s1) < lexical_cast<double>(s2);
@@ -51,101 +91,62 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
 
   if (m_it_lo == masses_all.end() || m_it_hi == masses_all.end()) {
     throw std::runtime_error(
-        FNERROR("Bin " + bin + ", process " + process +
+        FNERROR("Bin " + in.bin + ", process " + in.process +
                 " does not have entries for the min/max mass points"));
   }
 
-  // Define mass points = n
-  //  -- masses_str[n]
-  //  -- masses[n]
-  vector<string> m_str_vec(m_it_lo, ++m_it_hi);
-  vector<double> m_vec;
-  for (auto const& s : m_str_vec) {
-    // if (verbose) std::cout << ">>>> Mass point: " << s << "\n";
-    m_vec.push_back(lexical_cast<double>(s));
+  in.m_str_vec = vector<string>(m_it_lo, ++m_it_hi);
+  for (auto const& s : in.m_str_vec) {
+    in.m_vec.push_back(lexical_cast<double>(s));
   }
-  unsigned m = m_vec.size();
+  unsigned m = in.m_vec.size();
 
-  // ss = "shape systematic"
-  vector<string> ss_vec =
-      Set2Vec(cb_bp.cp().syst_type({"shape"}).syst_name_set());
-  unsigned ss = ss_vec.size();
-
-  // ls = "lnN systematic"
-  vector<string> ls_vec =
-      Set2Vec(cb_bp.cp().syst_type({"lnN"}).syst_name_set());
+  in.ss_vec = Set2Vec(ss_names);
+  unsigned ss = in.ss_vec.size();
+  vector<string> ls_vec = Set2Vec(ls_names);
   unsigned ls = ls_vec.size();
 
-  multi_array<ch::Process *,  1> pr_arr(extents[m]);
-  multi_array<ch::Systematic *, 2> ss_arr(extents[ss][m]);
-  multi_array<double, 1> ss_scale_arr(extents[ss]);
-  multi_array<bool, 1> ss_must_scale_arr(extents[ss]);
-  multi_array<ch::Systematic *, 2> ls_arr(extents[ls][m]);
-
-  multi_array<std::shared_ptr<RooRealVar>, 1> ss_scale_var_arr(extents[ss]);
-  multi_array<std::shared_ptr<RooConstVar>, 1> ss_scale_fac_arr(extents[ss]);
-  multi_array<std::shared_ptr<RooProduct>, 1> ss_scale_prod_arr(extents[ss]);
-
+  // Look up a systematic for a given mass point, which must exist
+  auto find_syst = [&](std::map<MassSyst, ch::Systematic *> const& map,
+                       string const& mass, string const& name) {
+    auto it = map.find(MassSyst(mass, name));
+    if (it == map.end()) {
+      throw std::runtime_error(FNERROR(
+          "Bin " + in.bin + ", process " + in.process + ", mass " + mass +
+          " does not have an entry for systematic " + name));
+    }
+    return it->second;
+  };
 
+  in.pr_arr.resize(extents[m]);
+  in.ss_arr.resize(extents[ss][m]);
+  boost::multi_array<ch::Systematic *, 2> ls_arr(extents[ls][m]);
   for (unsigned mi = 0; mi < m; ++mi) {
-    cb_bp.cp().mass({m_str_vec[mi]}).ForEachProc([&](ch::Process *p) {
-      pr_arr[mi] = p;
-    });
+    in.pr_arr[mi] = pr_map[in.m_str_vec[mi]];
     for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      cb_bp.cp().mass({m_str_vec[mi]}).syst_name({ss_vec[ssi]})
-        .ForEachSyst([&](ch::Systematic *n) {
-            ss_arr[ssi][mi] = n;
-        });
+      in.ss_arr[ssi][mi] = find_syst(ss_map, in.m_str_vec[mi], in.ss_vec[ssi]);
     }
     for (unsigned lsi = 0; lsi < ls; ++lsi) {
-      cb_bp.cp().mass({m_str_vec[mi]}).syst_name({ls_vec[lsi]})
-        .ForEachSyst([&](ch::Systematic *n) {
-            ls_arr[lsi][mi] = n;
-        });
+      ls_arr[lsi][mi] = find_syst(ls_map, in.m_str_vec[mi], ls_vec[lsi]);
     }
   }
 
-  RooArgList ss_list;
+  in.ss_scale_arr.resize(extents[ss]);
+  in.ss_must_scale_arr.resize(extents[ss]);
   for (unsigned ssi = 0; ssi < ss; ++ssi) {
-    ss_scale_var_arr[ssi] =
-        std::make_shared<RooRealVar>(ss_vec[ssi].c_str(), "", 0);
     set<double> scales;
     for (unsigned mi = 0; mi < m; ++mi) {
-      scales.insert(ss_arr[ssi][mi]->scale());
+      scales.insert(in.ss_arr[ssi][mi]->scale());
     }
     if (scales.size() > 1) {
-      std::runtime_error(FNERROR(
+      throw std::runtime_error(FNERROR(
           "Shape morphing parameters that vary with mass are not allowed"));
     } else {
-      ss_scale_arr[ssi] = *(scales.begin());
-      if (std::fabs(ss_scale_arr[ssi] - 1.0) > 1E-6) {
-        ss_must_scale_arr[ssi] = true;
-        ss_scale_fac_arr[ssi] = std::make_shared<RooConstVar>(
-            TString::Format("%g", ss_scale_arr[ssi]), "",
-            ss_scale_arr[ssi]);
-        ss_scale_prod_arr[ssi] = std::make_shared<RooProduct>(
-            ss_vec[ssi] + "_scaled_" + key, "",
-            RooArgList(*(ss_scale_var_arr[ssi]), *(ss_scale_fac_arr[ssi])));
-        ss_list.add(*(ss_scale_prod_arr[ssi]));
-      } else {
-        ss_list.add(*(ss_scale_var_arr[ssi]));
-      }
+      in.ss_scale_arr[ssi] = *(scales.begin());
+      in.ss_must_scale_arr[ssi] = std::fabs(in.ss_scale_arr[ssi] - 1.0) > 1E-6;
     }
   }
-  // ss_list.Print();
 
-  if (verbose) {
-    std::cout << ">> Shape systematics: " << ss << "\n";
-    for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      std::cout << boost::format("%-50s %-5i %-8.3g\n")
-        % ss_vec[ssi] % ss_must_scale_arr[ssi] % ss_scale_arr[ssi];
-    }
-  }
-
-
-  // lms = "lnN morphing systematic"
-  vector<string> lms_vec;
-  set<string> lms_set;
   vector<unsigned > lms_vec_idx;
   for (unsigned lsi = 0; lsi < ls; ++lsi) {
     set<double> k_hi;
@@ -158,25 +159,103 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
       }
     }
     if (k_hi.size() > 1 || k_lo.size() > 1) {
-      lms_vec.push_back(ls_vec[lsi]);
-      lms_set.insert(ls_vec[lsi]);
+      in.lms_vec.push_back(ls_vec[lsi]);
+      in.lms_set.insert(ls_vec[lsi]);
       lms_vec_idx.push_back(lsi);
     }
   }
-  unsigned lms = lms_vec.size();
-  multi_array<ch::Systematic *, 2> lms_arr(extents[lms][m]);
-  multi_array<std::shared_ptr<RooRealVar>, 1> lms_var_arr(extents[lms]);
+  unsigned lms = in.lms_vec.size();
 
-  for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
-    lms_var_arr[lmsi] =
-        std::make_shared<RooRealVar>(lms_vec[lmsi].c_str(), "", 0);
+  in.hist_arr.resize(extents[m][1+ss*2]);
+  in.rate_arr.resize(extents[m]);
+  in.ss_k_hi_arr.resize(extents[ss][m]);
+  in.ss_k_lo_arr.resize(extents[ss][m]);
+  in.lms_k_hi_arr.resize(extents[lms][m]);
+  in.lms_k_lo_arr.resize(extents[lms][m]);
+
+  for (unsigned mi = 0; mi < m; ++mi) {
+    in.hist_arr[mi][0] = RebinHist(AsTH1F(in.pr_arr[mi]->shape()));
+    in.rate_arr[mi] = in.pr_arr[mi]->rate();
+    for (unsigned ssi = 0; ssi < ss; ++ssi) {
+      Systematic *n = in.ss_arr[ssi][mi];
+      in.hist_arr[mi][1 + 2 * ssi] = RebinHist(AsTH1F(n->shape_u().get()));
+      in.hist_arr[mi][2 + 2 * ssi] = RebinHist(AsTH1F(n->shape_d().get()));
+      in.ss_k_hi_arr[ssi][mi] = n->value_u();
+      in.ss_k_lo_arr[ssi][mi] = n->value_d();
+    }
+    for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
+      Systematic *n = ls_arr[lms_vec_idx[lmsi]][mi];
+      in.lms_k_hi_arr[lmsi][mi] = n->value_u();
+      if (n->asymm()) {
+        in.lms_k_lo_arr[lmsi][mi] = n->value_d();
+      } else {
+        in.lms_k_lo_arr[lmsi][mi] = 1. / n->value_u();
+      }
+    }
   }
+  // Only the binning is needed from this
+  in.proc_hist = AsTH1F(in.pr_arr[0]->shape());
+}
 
-  for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
-    for (unsigned mi = 0; mi < m; ++mi) {
-      lms_arr[lmsi][mi] = ls_arr[lms_vec_idx[lmsi]][mi];
+// Creates the RooFit objects for one pair and imports them into the
+// workspace. RooFit is not thread-safe, so this always runs serially.
+void BuildMorphFromInputs(RooWorkspace& ws, MorphInputs & in,
+                          TH1F const& data_hist, RooAbsReal& mass_var,
+                          std::string const& norm_postfix, bool allow_morph,
+                          bool verbose, TFile * file) {
+  using boost::multi_array;
+  using boost::extents;
+
+  RooFit::MsgLevel backup_msg_level =
+      RooMsgService::instance().globalKillBelow();
+  if (!verbose) RooMsgService::instance().setGlobalKillBelow(RooFit::WARNING);
+
+  if (verbose)
+    std::cout << ">> Bin: " << in.bin << "  Process: " << in.process << "\n";
+  TString key = in.bin + "_" + in.process;
+
+  unsigned m = in.m_vec.size();
+  unsigned ss = in.ss_vec.size();
+  unsigned lms = in.lms_vec.size();
+  auto const& m_str_vec = in.m_str_vec;
+  auto const& ss_vec = in.ss_vec;
+  auto const& lms_vec = in.lms_vec;
+
+  multi_array<std::shared_ptr<RooRealVar>, 1> ss_scale_var_arr(extents[ss]);
+  multi_array<std::shared_ptr<RooConstVar>, 1> ss_scale_fac_arr(extents[ss]);
+  multi_array<std::shared_ptr<RooProduct>, 1> ss_scale_prod_arr(extents[ss]);
+
+  RooArgList ss_list;
+  for (unsigned ssi = 0; ssi < ss; ++ssi) {
+    ss_scale_var_arr[ssi] =
+        std::make_shared<RooRealVar>(ss_vec[ssi].c_str(), "", 0);
+    if (in.ss_must_scale_arr[ssi]) {
+      ss_scale_fac_arr[ssi] = std::make_shared<RooConstVar>(
+          TString::Format("%g", in.ss_scale_arr[ssi]), "",
+          in.ss_scale_arr[ssi]);
+      ss_scale_prod_arr[ssi] = std::make_shared<RooProduct>(
+          ss_vec[ssi] + "_scaled_" + key, "",
+          RooArgList(*(ss_scale_var_arr[ssi]), *(ss_scale_fac_arr[ssi])));
+      ss_list.add(*(ss_scale_prod_arr[ssi]));
+    } else {
+      ss_list.add(*(ss_scale_var_arr[ssi]));
+    }
+  }
+  // ss_list.Print();
+
+  if (verbose) {
+    std::cout << ">> Shape systematics: " << ss << "\n";
+    for (unsigned ssi = 0; ssi < ss; ++ssi) {
+      std::cout << boost::format("%-50s %-5i %-8.3g\n")
+        % ss_vec[ssi] % in.ss_must_scale_arr[ssi] % in.ss_scale_arr[ssi];
     }
   }
+
+  multi_array<std::shared_ptr<RooRealVar>, 1> lms_var_arr(extents[lms]);
+  for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
+    lms_var_arr[lmsi] =
+        std::make_shared<RooRealVar>(lms_vec[lmsi].c_str(), "", 0);
+  }
   if (verbose) {
     std::cout << ">> lnN morphing systematics: " << lms << "\n";
     for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
@@ -184,56 +263,30 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
     }
   }
 
-  multi_array<std::shared_ptr<TH1F>, 2> hist_arr(extents[m][1+ss*2]);
-  multi_array<double, 1> rate_arr(extents[m]);
   multi_array<std::shared_ptr<TList>, 1> list_arr(extents[m]);
-  multi_array<double, 2> ss_k_hi_arr(extents[ss][m]);
-  multi_array<double, 2> ss_k_lo_arr(extents[ss][m]);
   multi_array<std::shared_ptr<RooSpline1D>, 1> ss_spl_hi_arr(extents[ss]);
   multi_array<std::shared_ptr<RooSpline1D>, 1> ss_spl_lo_arr(extents[ss]);
   multi_array<std::shared_ptr<AsymPow>, 1> ss_asy_arr(extents[ss]);
+  multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_hi_arr(extents[lms]);
+  multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_lo_arr(extents[lms]);
+  multi_array<std::shared_ptr<AsymPow>, 1> lms_asy_arr(extents[lms]);
 
-  multi_array<double, 2> lms_k_hi_arr(extents[ss][m]);
-  multi_array<double, 2> lms_k_lo_arr(extents[ss][m]);
-  multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_hi_arr(extents[ss]);
-  multi_array<std::shared_ptr<RooSpline1D>, 1> lms_spl_lo_arr(extents[ss]);
-  multi_array<std::shared_ptr<AsymPow>, 1> lms_asy_arr(extents[ss]);
-
-  for (unsigned mi = 0; mi < m; ++mi) {
-    hist_arr[mi][0] =
-        std::make_shared<TH1F>(RebinHist(AsTH1F(pr_arr[mi]->shape())));
-    if (file) {
-      file->WriteTObject(pr_arr[mi]->shape(), key + "_" + m_str_vec[mi]);
-    }
-    rate_arr[mi] = pr_arr[mi]->rate();
-    for (unsigned ssi = 0; ssi < ss; ++ssi) {
-      hist_arr[mi][1 + 2 * ssi] =
-          std::make_shared<TH1F>(RebinHist(AsTH1F(ss_arr[ssi][mi]->shape_u())));
-      hist_arr[mi][2 + 2 * ssi] =
-          std::make_shared<TH1F>(RebinHist(AsTH1F(ss_arr[ssi][mi]->shape_d())));
-      if (file) {
-        file->WriteTObject(ss_arr[ssi][mi]->shape_u(),
+  if (file) {
+    for (unsigned mi = 0; mi < m; ++mi) {
+      file->WriteTObject(in.pr_arr[mi]->shape(), key + "_" + m_str_vec[mi]);
+      for (unsigned ssi = 0; ssi < ss; ++ssi) {
+        file->WriteTObject(in.ss_arr[ssi][mi]->shape_u().get(),
                            key + "_" + m_str_vec[mi] + "_" + ss_vec[ssi] + "Up");
-        file->WriteTObject(ss_arr[ssi][mi]->shape_d(),
+        file->WriteTObject(in.ss_arr[ssi][mi]->shape_d().get(),
                            key + "_" + m_str_vec[mi] + "_" + ss_vec[ssi] + "Down");
       }
-      ss_k_hi_arr[ssi][mi] = ss_arr[ssi][mi]->value_u();
-      ss_k_lo_arr[ssi][mi] = ss_arr[ssi][mi]->value_d();
-    }
-    for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
-      lms_k_hi_arr[lmsi][mi] = lms_arr[lmsi][mi]->value_u();
-      if (lms_arr[lmsi][mi]->asymm()) {
-        lms_k_lo_arr[lmsi][mi] = lms_arr[lmsi][mi]->value_d();
-      } else {
-        lms_k_lo_arr[lmsi][mi] = 1. / lms_arr[lmsi][mi]->value_u();
-      }
     }
   }
 
   for (unsigned mi = 0; mi < m; ++mi) {
     list_arr[mi] = std::make_shared<TList>();
     for (unsigned xi = 0; xi < (1 + ss * 2); ++xi) {
-      list_arr[mi]->Add(hist_arr[mi][xi].get());
+      list_arr[mi]->Add(&(in.hist_arr[mi][xi]));
     }
   }
 
@@ -243,40 +296,40 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
     }
     std::cout << "\n";
     for (unsigned mi = 0; mi < m; ++mi) {
-      std::cout << boost::format("%-10.5g") % rate_arr[mi];
+      std::cout << boost::format("%-10.5g") % in.rate_arr[mi];
     }
     std::cout << "\n";
     for (unsigned ssi = 0; ssi < ss; ++ssi) {
       for (unsigned mi = 0; mi < m; ++mi) {
-        std::cout << boost::format("%-10.5g") % ss_k_hi_arr[ssi][mi];
+        std::cout << boost::format("%-10.5g") % in.ss_k_hi_arr[ssi][mi];
       }
       std::cout << "\n";
       for (unsigned mi = 0; mi < m; ++mi) {
-        std::cout << boost::format("%-10.5g") % ss_k_lo_arr[ssi][mi];
+        std::cout << boost::format("%-10.5g") % in.ss_k_lo_arr[ssi][mi];
       }
       std::cout << "\n";
     }
   }
 
   TString interp = "LINEAR";
-  RooSpline1D rate_spline("interp_rate_"+key, "", mass_var, m, m_vec.data(),
-                          rate_arr.data(), interp);
+  RooSpline1D rate_spline("interp_rate_"+key, "", mass_var, m, in.m_vec.data(),
+                          in.rate_arr.data(), interp);
   if (file) {
-    TGraph tmp(m, m_vec.data(), rate_arr.data());
+    TGraph tmp(m, in.m_vec.data(), in.rate_arr.data());
     gDirectory->WriteTObject(&tmp, "interp_rate_"+key);
   }
   RooArgList rate_prod(rate_spline);
   for (unsigned ssi = 0; ssi < ss; ++ssi) {
     ss_spl_hi_arr[ssi] = std::make_shared<RooSpline1D>("spline_hi_" +
-        key + "_" + ss_vec[ssi], "", mass_var, m, m_vec.data(),
-        ss_k_hi_arr[ssi].origin(), interp);
+        key + "_" + ss_vec[ssi], "", mass_var, m, in.m_vec.data(),
+        in.ss_k_hi_arr[ssi].origin(), interp);
     ss_spl_lo_arr[ssi] = std::make_shared<RooSpline1D>("spline_lo_" +
-        key + "_" + ss_vec[ssi], "", mass_var, m, m_vec.data(),
-        ss_k_lo_arr[ssi].origin(), interp);
+        key + "_" + ss_vec[ssi], "", mass_var, m, in.m_vec.data(),
+        in.ss_k_lo_arr[ssi].origin(), interp);
     if (file) {
-      TGraph tmp_hi(m, m_vec.data(), ss_k_hi_arr[ssi].origin());
+      TGraph tmp_hi(m, in.m_vec.data(), in.ss_k_hi_arr[ssi].origin());
       gDirectory->WriteTObject(&tmp_hi, "spline_hi_" + key + "_" + ss_vec[ssi]);
-      TGraph tmp_lo(m, m_vec.data(), ss_k_lo_arr[ssi].origin());
+      TGraph tmp_lo(m, in.m_vec.data(), in.ss_k_lo_arr[ssi].origin());
       gDirectory->WriteTObject(&tmp_lo, "spline_lo_" + key + "_" + ss_vec[ssi]);
     }
     ss_asy_arr[ssi] = std::make_shared<AsymPow>("systeff_" +
@@ -287,24 +340,23 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   }
   for (unsigned lmsi = 0; lmsi < lms; ++lmsi) {
     lms_spl_hi_arr[lmsi] = std::make_shared<RooSpline1D>("spline_hi_" +
-        key + "_" + lms_vec[lmsi], "", mass_var, m, m_vec.data(),
-        lms_k_hi_arr[lmsi].origin(), interp);
+        key + "_" + lms_vec[lmsi], "", mass_var, m, in.m_vec.data(),
+        in.lms_k_hi_arr[lmsi].origin(), interp);
     lms_spl_lo_arr[lmsi] = std::make_shared<RooSpline1D>("spline_lo_" +
-        key + "_" + lms_vec[lmsi], "", mass_var, m, m_vec.data(),
-        lms_k_lo_arr[lmsi].origin(), interp);
+        key + "_" + lms_vec[lmsi], "", mass_var, m, in.m_vec.data(),
+        in.lms_k_lo_arr[lmsi].origin(), interp);
     lms_asy_arr[lmsi] = std::make_shared<AsymPow>("systeff_" +
         key + "_" + lms_vec[lmsi], "", *(lms_spl_lo_arr[lmsi]),
         *(lms_spl_hi_arr[lmsi]), *(lms_var_arr[lmsi]));
     rate_prod.add(*(lms_asy_arr[lmsi]));
   }
 
-  TH1F data_hist = cb_bp.GetObservedShape();
-  TH1F proc_hist = cb_bp.GetShape();
+  TH1F const& proc_hist = in.proc_hist;
   RooRealVar xvar("CMS_th1x", "CMS_th1x", 0,
                  static_cast<float>(data_hist.GetNbinsX()));
   xvar.setBins(data_hist.GetNbinsX());
 
-  RooRealVar morph_xvar(("CMS_th1x_"+bin).c_str(), "", 0,
+  RooRealVar morph_xvar(("CMS_th1x_"+in.bin).c_str(), "", 0,
                  static_cast<float>(proc_hist.GetNbinsX()));
   morph_xvar.setConstant();
   morph_xvar.setBins(proc_hist.GetNbinsX());
@@ -326,7 +378,7 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   }
   TString morph_name = key + "_morph";
   RooMorphingPdf morph_pdf(morph_name, "", xvar, mass_var, vpdf_list,
-                           m_vec, allow_morph, *(data_hist.GetXaxis()),
+                           in.m_vec, allow_morph, *(data_hist.GetXaxis()),
                            *(proc_hist.GetXaxis()));
   RooProduct morph_rate(morph_name + "_" + TString(norm_postfix), "",
                         rate_prod);
@@ -335,30 +387,132 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
   ws.import(morph_rate, RooFit::RecycleConflictNodes());
 
   if (!verbose) RooMsgService::instance().setGlobalKillBelow(backup_msg_level);
+}
 
-  // Now we can cleanup the CB instance a bit
+// Now we can cleanup the CB instance a bit: for each morphed pair only the
+// objects at mass_min are kept (minus the shape and lnN morphing
+// systematics), and these are then valid for any mass
+void CleanupMorphed(CombineHarvester& cb,
+                    std::vector<MorphInputs> const& inputs,
+                    std::string const& mass_min) {
+  typedef std::pair<std::string, std::string> BinProc;
+  std::map<BinProc, MorphInputs const*> done;
+  for (auto const& in : inputs) done[BinProc(in.bin, in.process)] = &in;
+  auto lookup = [&](ch::Object const* obj) -> MorphInputs const* {
+    auto it = done.find(BinProc(obj->bin(), obj->process()));
+    return it == done.end() ? nullptr : it->second;
+  };
   cb.FilterProcs([&](ch::Process const* p) {
-    return p->bin() == bin && p->process() == process && p->mass() != mass_min;
+    return lookup(p) && p->mass() != mass_min;
   });
   cb.FilterSysts([&](ch::Systematic const* n) {
-    return (n->bin() == bin && n->process() == process) &&
-           ((n->mass() != mass_min) || (n->type() == "shape") ||
-            (lms_set.count(n->name())));
+    MorphInputs const* in = lookup(n);
+    return in && ((n->mass() != mass_min) || (n->type() == "shape") ||
+                  (in->lms_set.count(n->name())));
   });
   cb.ForEachProc([&](ch::Process * p) {
-    if (p->bin() == bin && p->process() == process) {
+    if (lookup(p)) {
       p->set_mass("*");
       p->set_shape(nullptr, false);
       p->set_rate(1.0);
     }
   });
   cb.ForEachSyst([&](ch::Systematic * n) {
-    if (n->bin() == bin && n->process() == process) {
-      n->set_mass("*");
-    }
+    if (lookup(n)) n->set_mass("*");
+  });
+}
+}
+
+void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
+                      std::string const& bin, std::string const& process,
+                      RooAbsReal& mass_var, std::string const& mass_min,
+                      std::string const& mass_max, std::string norm_postfix,
+                      bool allow_morph, bool verbose, TFile * file) {
+  std::vector<MorphInputs> inputs(1);
+  MorphInputs & in = inputs[0];
+  in.bin = bin;
+  in.process = process;
+  CombineHarvester cb_bp =
+      std::move(cb.cp().bin({bin}).process({process}));
+  cb_bp.ForEachProc([&](ch::Process *p) { in.procs.push_back(p); });
+  cb_bp.ForEachSyst([&](ch::Systematic *n) { in.systs.push_back(n); });
+
+  CollectMorphInputs(in, mass_min, mass_max);
+  TH1F data_hist = cb_bp.GetObservedShape();
+  BuildMorphFromInputs(ws, in, data_hist, mass_var, norm_postfix, allow_morph,
+                       verbose, file);
+  CleanupMorphed(cb, inputs, mass_min);
+}
+
+void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb,
+                      std::map<std::string, RooAbsReal *> const& mass_vars,
+                      std::string const& mass_min,
+                      std::string const& mass_max, std::string norm_postfix,
+                      bool allow_morph, bool verbose, TFile * file,
+                      unsigned n_threads) {
+  typedef std::pair<std::string, std::string> BinProc;
+
+  // Group the objects of every (bin, process) pair to be morphed in a single
+  // pass, instead of filtering a copy of cb for each pair
+  std::map<BinProc, unsigned> idx;
+  cb.ForEachProc([&](ch::Process *p) {
+    if (mass_vars.count(p->process())) idx[BinProc(p->bin(), p->process())];
+  });
+  std::vector<MorphInputs> inputs(idx.size());
+  unsigned i = 0;
+  for (auto & it : idx) {
+    it.second = i;
+    inputs[i].bin = it.first.first;
+    inputs[i].process = it.first.second;
+    ++i;
+  }
+  cb.ForEachProc([&](ch::Process *p) {
+    auto it = idx.find(BinProc(p->bin(), p->process()));
+    if (it != idx.end()) inputs[it->second].procs.push_back(p);
   });
+  cb.ForEachSyst([&](ch::Systematic *n) {
+    auto it = idx.find(BinProc(n->bin(), n->process()));
+    if (it != idx.end()) inputs[it->second].systs.push_back(n);
+  });
+
+  // Copying histograms concurrently needs ROOT's thread-safety mode, and
+  // shapes that are loaded on demand share the open input files
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,6,0)
+  n_threads = 1;
+#endif
+  if (cb.GetFlag("lazy-shape-loading")) n_threads = 1;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  if (n_threads != 1) ROOT::EnableThreadSafety();
+#endif
+  bool add_dir = TH1::AddDirectoryStatus();
+  TH1::AddDirectory(false);
+  try {
+    RunThreads(inputs.size(), n_threads, [&](unsigned j) {
+      CollectMorphInputs(inputs[j], mass_min, mass_max);
+    });
+  } catch (...) {
+    TH1::AddDirectory(add_dir);
+    throw;
+  }
+  TH1::AddDirectory(add_dir);
+
+  std::map<std::string, TH1F> data_hists;
+  ch::Selection all(cb);
+  for (auto & in : inputs) {
+    if (!data_hists.count(in.bin)) {
+      data_hists[in.bin] = all.cp().bin({in.bin}).Materialize()
+                               .GetObservedShape();
+    }
+  }
+  for (auto & in : inputs) {
+    BuildMorphFromInputs(ws, in, data_hists[in.bin],
+                         *(mass_vars.at(in.process)), norm_postfix,
+                         allow_morph, verbose, file);
+  }
+  CleanupMorphed(cb, inputs, mass_min);
 }
 
+
 void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb, RooAbsReal& mh,
                       bool verbose, std::string norm_postfix) {
 
@@ -411,13 +565,14 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb, RooAbsReal& mh,
   }
 
   auto bins = cb.bin_set();
+  ch::Selection all(cb);
 
   for (auto const& b : bins) {
     auto sigs = cb.process_set();
     for (auto s : sigs) {
       if (verbose) std::cout << ">> bin: " << b << " process: " << s << "\n";
       ch::CombineHarvester tmp =
-          std::move(cb.cp().bin({b}).process({s}).syst_type({"shape"}));
+          all.cp().bin({b}).process({s}).syst_type({"shape"}).Materialize();
       TH1F data_hist = tmp.GetObservedShape();
       // tmp2.PrintAll();
       RooRealVar mtt("CMS_th1x", "CMS_th1x", 0,
@@ -451,15 +606,17 @@ void BuildRooMorphing(RooWorkspace& ws, CombineHarvester& cb, RooAbsReal& mh,
       RooArgList k_list;
 
       std::string key = b + "_" + s;
+      ch::Selection tmp_all(tmp);
       for (unsigned m = 0; m < n; ++m) {
-        ch::CombineHarvester tmp3 =
-            std::move(tmp.cp().mass({mass_str_vec[m]}));
+        ch::Selection tmp3_sel = tmp_all.cp().mass({mass_str_vec[m]});
+        ch::CombineHarvester tmp3 = tmp3_sel.Materialize();
         yield_vec[m] = tmp3.GetRate();
         h_vec[m].push_back(RebinHist(tmp3.GetShape()));
         for (unsigned s = 0; s < systs.size(); ++s) {
-          tmp3.cp().syst_name({systs[s]}).ForEachSyst([&](Systematic const* n) {
-            h_vec[m].push_back(RebinHist(*(TH1F*)(n->shape_u())));
-            h_vec[m].push_back(RebinHist(*(TH1F*)(n->shape_d())));
+          tmp3_sel.cp().syst_name({systs[s]}).ForEachSyst(
+              [&](Systematic const* n) {
+            h_vec[m].push_back(RebinHist(*(TH1F*)(n->shape_u().get())));
+            h_vec[m].push_back(RebinHist(*(TH1F*)(n->shape_d().get())));
             k_vals_hi[s][m] = n->value_u();
             k_vals_lo[s][m] = n->value_d();
             // if (std::fabs(n->scale() - 1.) >= 1E-6) {
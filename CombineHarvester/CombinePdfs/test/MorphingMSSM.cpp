@@ -282,13 +282,13 @@ int main() {
     {"bbh", &mh}, {"bbH", &mH}, {"bbA", &mA}
   };
   if (do_morphing) {
+    ch::BuildRooMorphing(ws, cb, mass_var, "90", "1000", "eff_acc", true,
+                         true, &demo, 0);
     auto bins = cb.bin_set();
     for (auto b : bins) {
       auto procs = cb.cp().bin({b}).signals().process_set();
       for (auto p : procs) {
         string pdf_name = b + "_" + p + "_morph";
-        ch::BuildRooMorphing(ws, cb, b, p, *(mass_var[p]), "90", "1000",
-                             "eff_acc", true, true, &demo);
             std::string prod_name = pdf_name + "_eff_acc";
             RooAbsReal *norm =  ws.function(prod_name.c_str());
             RooProduct full_norm((pdf_name + "_norm").c_str(), "",
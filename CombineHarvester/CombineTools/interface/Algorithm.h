@@ -6,6 +6,7 @@
 #include "boost/range/end.hpp"
 #include "boost/regex.hpp"
 #include "boost/range/algorithm_ext/erase.hpp"
+#include "CombineTools/interface/Object.h"
 
 namespace ch {
 template <typename Range, typename Predicate>
@@ -19,12 +20,12 @@ bool any_of(const Range &r, Predicate p) {
 }
 
 template<typename Range, typename T>
-bool contains(const Range &r, T p) {
+bool contains(const Range &r, T const& p) {
   return std::find(boost::begin(r), boost::end(r), p) != boost::end(r);
 }
 
 template <typename T>
-bool contains_rgx(const std::vector<boost::regex>& r, T p) {
+bool contains_rgx(const std::vector<boost::regex>& r, T const& p) {
   for (auto const& rgx : r)
     if (regex_match(p, rgx)) return true;
   return false;
@@ -38,6 +39,27 @@ void FilterContaining(Input& in, Filter const& filter, Converter fn,
   });
 }
 
+/**
+ * Filter on a string property of ch::Object by comparing the addresses of
+ * the interned strings instead of their values
+ *
+ * Filter values that have never been interned cannot match any object, so
+ * they are skipped rather than added to the table.
+ */
+template <typename Input, typename Converter>
+void FilterContainingInterned(Input& in, std::vector<std::string> const& filter,
+                              Converter fn, bool cond) {
+  std::vector<std::string const*> interned;
+  interned.reserve(filter.size());
+  for (auto const& str : filter) {
+    std::string const* ptr = FindInternedString(str);
+    if (ptr) interned.push_back(ptr);
+  }
+  boost::remove_erase_if(in, [&](typename Input::value_type const& p) {
+    return cond != ch::contains(interned, &fn(p));
+  });
+}
+
 template <typename Input, typename Filter, typename Converter>
 void FilterContainingRgx(Input& in, Filter const& filter, Converter fn,
                          bool cond) {
@@ -126,12 +126,24 @@ class BinByBinFactory {
     return *this;
   }
 
+  /**
+   * The number of threads used to scan the process templates in
+   * \ref AddBinByBin and to merge the errors of each category in
+   * \ref MergeBinErrors, or zero for one per core. The results do not
+   * depend on this.
+   */
+  inline BinByBinFactory& SetThreads(unsigned n_threads) {
+    n_threads_ = n_threads;
+    return *this;
+  }
+
  private:
   std::string pattern_;
   unsigned v_;
   double bbb_threshold_;
   double merge_threshold_;
   bool fix_norm_;
+  unsigned n_threads_;
 };
 }
 
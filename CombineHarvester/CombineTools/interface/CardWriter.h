@@ -4,6 +4,7 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <unordered_map>
 #include "CombineTools/interface/CombineHarvester.h"
 #include "CombineTools/interface/Object.h"
 
@@ -46,6 +47,23 @@ namespace ch {
  * files treats this object as matching any mass value. It is possible to
  * alter or remove this behaviour by supplying a new list of wildcard values
  * with the \ref SetWildcardMasses method.
+ *
+ * The objects are partitioned into the groups for each ROOT file and
+ * datacard before anything is written. Each ROOT file, together with the
+ * datacards that refer to it, is independent of the others, so with
+ * \ref SetThreads the files can be written concurrently. This requires ROOT
+ * 6.06 or later, where ROOT::EnableThreadSafety is called. Files are only
+ * written concurrently when the output is the same as for serial writing.
+ * Models containing RooFit objects or Systematic shapes that are loaded on
+ * demand are always written serially, as the underlying objects are shared
+ * between the files. So is everything written with \ref SetSharedShapes,
+ * where the datacard order decides which histograms go in the shared file.
+ *
+ * With \ref SetSharedShapes the histograms are deduplicated across all of
+ * the datacards: each distinct histogram is written once into the given
+ * ROOT file and the `shapes` lines refer to it, see ch::SharedShapes. This
+ * mostly helps when mass-independent processes are written into per-mass
+ * ROOT files.
  */
 class CardWriter {
  public:
@@ -59,21 +77,33 @@ class CardWriter {
   CardWriter& CreateDirectories(bool flag);
   /// Redefine the mass values that should be treated as wildcards
   CardWriter& SetWildcardMasses(std::vector<std::string> const& masses);
+  /// Number of ROOT files to write in parallel (0 for one per core)
+  CardWriter& SetThreads(unsigned n_threads);
+  /// Write histograms common to several datacards into one ROOT file, which
+  /// may contain the `$TAG` placeholder. An empty string switches this off.
+  CardWriter& SetSharedShapes(std::string const& root_file);
 
  private:
   typedef std::map<std::string, std::set<std::string>> PatternMap;
+  typedef std::unordered_map<Object const*, std::string> ObjectMap;
   std::string text_pattern_;
   std::string root_pattern_;
+  std::string shared_pattern_;
   mutable std::string tag_;
   std::vector<std::string> wildcard_masses_;
   unsigned v_;
   bool create_dirs_;
+  unsigned n_threads_;
 
   std::string Compile(std::string pattern, ch::Object const* obj,
                       bool skip_mass = false) const;
   PatternMap BuildMap(std::string const& pattern,
                       ch::CombineHarvester& cmb) const;
   void MakeDirs(PatternMap const& map) const;
+  std::vector<ch::CombineHarvester> Partition(PatternMap const& map,
+                                              ObjectMap const& obj_map,
+                                              ch::CombineHarvester& cmb) const;
+  bool CanWriteInParallel(ch::CombineHarvester& cmb) const;
 };
 }
 
@@ -19,6 +19,7 @@
 #include "CombineTools/interface/Observation.h"
 #include "CombineTools/interface/Utilities.h"
 #include "CombineTools/interface/HistMapping.h"
+#include "CombineTools/interface/SharedShapes.h"
 
 
 namespace ch {
@@ -26,6 +27,9 @@ namespace ch {
 // Define some useful CombineHarvester-specific typedefs
 typedef std::vector<std::pair<int, std::string>> Categories;
 
+class Selection;
+class CardWriter;
+
 class CombineHarvester {
  public:
   /**
@@ -34,9 +38,8 @@ class CombineHarvester {
    * \details Distinct shallow and deep copying methods are provided. A deep
    * copy creates a completely independent CombineHarvester instace: all
    * Observation, Process, Systematic and Parameter objects are cloned, as
-   * well as any histogram objects they may contain and any attached
-   * RooWorkspaces. In a shallow copy these objects are shared with the
-   * original CombineHarvester instance.
+   * well as any attached RooWorkspaces. In a shallow copy these objects are
+   * shared with the original CombineHarvester instance.
    */
   /**@{*/
   CombineHarvester();
@@ -70,10 +73,34 @@ class CombineHarvester {
    * Unlike the shallow copy, a deep copy will duplicate every internal
    * object, including any attached RooWorkspaces. This makes it completely
    * independent of the original instance.
+   *
+   * The TH1 shapes are not duplicated: they are never modified after being
+   * set, so the copies share them until a new shape is set on one side.
    */
   CombineHarvester deep();
   /**@}*/
 
+  /**
+   * \name Flags
+   *
+   * \brief Options controlling how datacards and shapes are loaded
+   *
+   * \details The available flags and their defaults are:
+   *  - `zero-negative-bins-on-import` (true): report histograms with
+   *    negative bins when loading shapes
+   *  - `allow-missing-shapes` (true): only warn, rather than throw, when the
+   *    RooDataHist shapes of a systematic cannot be found
+   *  - `lazy-shape-loading` (false): defer reading the TH1 shapes of
+   *    systematics until they are first used, see
+   *    Systematic::set_lazy_shapes. Objects that are filtered away before
+   *    being evaluated or written are then never read. The negative bin
+   *    check is skipped for these shapes.
+   */
+  /**@{*/
+  void SetFlag(std::string const& flag, bool const& value);
+  bool GetFlag(std::string const& flag) const;
+  /**@}*/
+
   /**
    * \name Logging and Printing
    */
@@ -106,8 +133,53 @@ class CombineHarvester {
   int ParseDatacard(std::string const& filename,
       std::string parse_rule = "");
 
+  /**
+   * Parse a list of datacards, extracting the metadata of each from its
+   * filename with `parse_rule`
+   *
+   * The cards are read and split into words on `n_threads` threads (one per
+   * core if zero), then the objects are built serially in the order the
+   * files are given, so the result is identical to calling
+   * ParseDatacard(std::string const&, std::string) for each file in turn.
+   *
+   * Each ROOT input file and workspace is opened once for all the cards in
+   * the list, and closed again when this method returns.
+   */
+  int ParseDatacards(std::vector<std::string> const& filenames,
+      std::string parse_rule = "", unsigned n_threads = 0);
+
   void WriteDatacard(std::string const& name, std::string const& root_file);
   void WriteDatacard(std::string const& name, TFile & root_file);
+
+  /**
+   * Write a datacard, storing histograms that are already in, or new to,
+   * `shared` in that file instead of `root_file`
+   *
+   * The decision is made per `shapes` line: if any histogram it covers
+   * differs from the one stored under the same path in `shared`, all of that
+   * line's histograms are written to `root_file`. See ch::SharedShapes.
+   */
+  void WriteDatacard(std::string const& name, TFile & root_file,
+                     SharedShapes & shared);
+  /**@}*/
+
+  /**
+   * \name Snapshots
+   *
+   * \brief Methods to save and restore the complete state of an instance
+   *
+   * \details The Observation, Process, Systematic and Parameter objects, the
+   * flags and the histogram contents are written to a versioned binary file.
+   * Any RooWorkspaces are written to a companion ROOT file, `filename` +
+   * ".ws.root", and the RooFit objects are stored as references by
+   * workspace and object name. LoadSnapshot replaces the contents of this
+   * instance and throws if the file is not a compatible snapshot. The
+   * format uses the native byte order, so snapshots should be treated as a
+   * cache rather than a portable output format.
+   */
+  /**@{*/
+  void SaveSnapshot(std::string const& filename);
+  void LoadSnapshot(std::string const& filename);
   /**@}*/
 
   /**
@@ -263,6 +335,16 @@ class CombineHarvester {
   void ForEachSyst(Function func);
 
   void VariableRebin(std::vector<double> bins);
+
+  /**
+   * Version of VariableRebin(std::vector<double>) that sums the bin contents
+   * of the histograms on `n_threads` threads (zero for one per core)
+   *
+   * The old to new bin mapping is found once for each distinct input
+   * binning and follows the same rules as TH1::Rebin. The results do not
+   * depend on `n_threads`.
+   */
+  void VariableRebin(std::vector<double> bins, unsigned n_threads);
   void SetPdfBins(unsigned nbins);
   /**@}*/
 
@@ -291,6 +373,24 @@ class CombineHarvester {
    */
   double GetUncertainty(RooFitResult const* fit, unsigned n_samples);
   double GetUncertainty(RooFitResult const& fit, unsigned n_samples);
+
+  /**
+   * Multithreaded version of GetUncertainty(RooFitResult const&, unsigned)
+   *
+   * Correlated parameter values are drawn from the Cholesky factor of the fit
+   * covariance matrix, which is computed once. The samples are split into
+   * `n_threads` contiguous blocks, each evaluated with its own parameter
+   * vector and a random number stream seeded from `seed` and the thread
+   * index. The result is therefore reproducible for a fixed `seed` and
+   * `n_threads`. Setting `n_threads` to zero uses one thread per core.
+   *
+   * \note Processes described by a RooAbsPdf or with a RooAbsReal
+   * normalisation term can only be evaluated through their RooFit objects,
+   * which cannot be shared between threads. If any are present this method
+   * falls back to the serial GetUncertainty(RooFitResult const&, unsigned).
+   */
+  double GetUncertainty(RooFitResult const& fit, unsigned n_samples,
+                        unsigned n_threads, unsigned seed);
   TH1F GetShape();
   TH1F GetShapeWithUncertainty();
 
@@ -305,7 +405,45 @@ class CombineHarvester {
    */
   TH1F GetShapeWithUncertainty(RooFitResult const* fit, unsigned n_samples);
   TH1F GetShapeWithUncertainty(RooFitResult const& fit, unsigned n_samples);
+
+  /**
+   * Multithreaded version of GetShapeWithUncertainty(RooFitResult const&,
+   * unsigned)
+   *
+   * \sa GetUncertainty(RooFitResult const&, unsigned, unsigned, unsigned) for
+   * details of the sampling and the conditions under which the serial
+   * version is used instead
+   */
+  TH1F GetShapeWithUncertainty(RooFitResult const& fit, unsigned n_samples,
+                               unsigned n_threads, unsigned seed);
+
+  /**
+   * Evaluate the shape of every process, and of the total background, total
+   * signal and total of all processes, from a single set of samples of the
+   * fit covariance matrix
+   *
+   * The returned map is keyed by process name, with the sums stored under
+   * "TotalBkg", "TotalSig" and "TotalProcs". Each entry is equivalent to
+   * calling GetShapeWithUncertainty(RooFitResult const&, unsigned, unsigned,
+   * unsigned) on the corresponding filtered copy, but every parameter sample
+   * is drawn and every process evaluated only once. The same fallback to the
+   * serial method applies when RooFit-based processes are present.
+   */
+  std::map<std::string, TH1F> GetShapesWithUncertainty(
+      RooFitResult const& fit, unsigned n_samples, unsigned n_threads,
+      unsigned seed);
   TH1F GetObservedShape();
+
+  typedef std::vector<std::vector<Systematic const*>> ProcSystMap;
+
+  /**
+   * Find the Systematic entries that act on each Process
+   *
+   * The outer vector follows the order of the Process entries, as visited by
+   * ForEachProc, and each inner vector lists the matching Systematic entries
+   * in the order they were added.
+   */
+  ProcSystMap GenerateProcSystMap();
   /**@}*/
 
   /**
@@ -363,6 +501,7 @@ class CombineHarvester {
   void InsertObservation(ch::Observation const& obs);
   void InsertProcess(ch::Process const& proc);
   void InsertSystematic(ch::Systematic const& sys);
+  void InsertSystematic(ch::Systematic && sys);
   void CreateParameterIfEmpty(std::string const& name);
 
   /**
@@ -394,6 +533,8 @@ class CombineHarvester {
 
  private:
   friend void swap(CombineHarvester& first, CombineHarvester& second);
+  friend class Selection;
+  friend class CardWriter;
 
   // ---------------------------------------------------------------
   // Main data members
@@ -450,6 +591,18 @@ class CombineHarvester {
   // ---------------------------------------------------------------
   // Private methods for the shape writing routines
   // ---------------------------------------------------------------
+  void WriteDatacardImpl(std::string const& name, TFile & root_file,
+                         SharedShapes * shared);
+
+  int ResolveHistPath(
+      std::vector<HistMapping> const& mappings,
+      std::string const& bin,
+      std::string const& process,
+      std::string const& mass,
+      std::string const& nuisance,
+      unsigned type,
+      std::string & path);
+
   void WriteHistToFile(
       TH1 const* hist,
       TFile * file,
@@ -466,14 +619,102 @@ void FillHistMappings(std::vector<HistMapping> & mappings);
   // Private methods for shape/yield evaluation
   // --> implementation in src/CombineHarvester_Evaluate.cc
   // ---------------------------------------------------------------
-  typedef std::vector<std::vector<Systematic const*>> ProcSystMap;
-  ProcSystMap GenerateProcSystMap();
+  int ParseDatacardWords(std::string const& filename,
+      std::vector<std::vector<std::string>> const& words,
+      std::string const& analysis,
+      std::string const& era,
+      std::string const& channel,
+      int bin_id,
+      std::string const& mass,
+      std::map<std::string, std::shared_ptr<TFile>> & file_store,
+      std::map<std::string, std::shared_ptr<RooWorkspace>> & ws_store);
 
-  double GetRateInternal(ProcSystMap const& lookup,
-    std::string const& single_sys = "");
+  /**
+   * A single Systematic term acting on a cached Process
+   *
+   * For shape-type terms the up and down templates are stored in the
+   * pre-combined form used by the vertical interpolation, such that the
+   * shift in bin b is simply `x * (half_diff[b] + half_sum[b] * f(x))`. For
+   * `shapeN2` terms these arrays are built from the log-ratios to the
+   * nominal template instead.
+   *
+   * Terms from Systematic::set_single_bin_shapes on the same nominal as the
+   * Process use `kSingleBin` and no arrays: their templates are the nominal
+   * scaled by one factor plus a change in a single bin, so the shift is
+   * `x * (norm_diff + norm_sum * f(x))` times the nominal, plus
+   * `x * (bin_diff + bin_sum * f(x))` in bin `bin`.
+   */
+  struct ShapeTerm {
+    enum Mode { kRateOnly, kLinear, kLog, kSingleBin };
+    Systematic const* sys;
+    unsigned param;
+    double scale;
+    double value_u;
+    double value_d;
+    bool asymm;
+    Mode mode;
+    std::vector<double> half_diff;
+    std::vector<double> half_sum;
+    unsigned bin;
+    double norm_diff;
+    double norm_sum;
+    double bin_diff;
+    double bin_sum;
+  };
+
+  /**
+   * The evaluation inputs for one Process: the normalised nominal template
+   * and its bin errors as contiguous arrays (TH1 and RooAbsData processes
+   * only), and the list of Systematic terms that act on it
+   */
+  struct ProcShape {
+    Process const* proc;
+    bool has_hist;
+    TH1F hist;
+    std::vector<double> nom;
+    std::vector<double> err;
+    std::vector<double> single_nom;
+    std::string var_name;
+    std::vector<ShapeTerm> terms;
+  };
+
+  /**
+   * Everything needed to evaluate the total shape, extracted once from the
+   * Process and Systematic objects so that repeated evaluations (e.g. when
+   * sampling parameter values) reduce to loops over plain arrays. The
+   * `params` vector gives the Parameter for each ShapeTerm::param index,
+   * and `param_procs` the indices of the processes with a term for it.
+   */
+  struct ShapeCache {
+    std::vector<Parameter const*> params;
+    std::vector<ProcShape> procs;
+    std::vector<std::vector<unsigned>> param_procs;
+  };
 
-  TH1F GetShapeInternal(ProcSystMap const& lookup,
-    std::string const& single_sys = "");
+  ShapeCache GenerateShapeCache(ProcSystMap const& lookup);
+
+  double GetProcRateInternal(unsigned i, ProcSystMap const& lookup);
+
+  double GetRateInternal(ProcSystMap const& lookup);
+
+  TH1F GetShapeInternal(ShapeCache const& cache);
+
+  double EvalProcShape(ProcShape const& proc, std::vector<double> const& vals,
+                       std::vector<double>& result) const;
+
+  TH1F EvalProcPdfShape(ProcShape const& proc,
+                         std::vector<double> const& vals) const;
+
+  double EvalProcRate(ProcShape const& proc,
+                      std::vector<double> const& vals) const;
+
+  void EvalTotalShape(ShapeCache const& cache, std::vector<double> const& vals,
+                      std::vector<double>& total,
+                      std::vector<double>& work) const;
+
+  bool CanSampleInParallel(ShapeCache const& cache) const;
+
+  double TermRateFactor(ShapeTerm const& term, double x) const;
 
   inline double smoothStepFunc(double x) const {
     if (std::fabs(x) >= 1.0/*_smoothRegion*/) return x > 0 ? +1 : -1;
@@ -483,11 +724,6 @@ void FillHistMappings(std::vector<HistMapping> & mappings);
   }
 
   double logKappaForX(double x, double k_low, double k_high) const;
-
-  void ShapeDiff(double x, TH1F* target, TH1 const* nom, TH1 const* low,
-                 TH1 const* high, bool linear);
-  void ShapeDiff(double x, TH1F* target, RooDataHist const* nom,
-                 RooDataHist const* low, RooDataHist const* high);
 };
 
 
@@ -556,23 +792,23 @@ CombineHarvester& CombineHarvester::FilterAll(Function func) {
 
 template<typename Function>
 CombineHarvester& CombineHarvester::FilterObs(Function func) {
-  boost::remove_erase_if(
-      obs_, [&](std::shared_ptr<Observation> ptr) { return func(ptr.get());
+  boost::remove_erase_if(obs_, [&](std::shared_ptr<Observation> const& ptr) {
+    return func(ptr.get());
   });
   return *this;
 }
 
 template<typename Function>
 CombineHarvester& CombineHarvester::FilterProcs(Function func) {
-  boost::remove_erase_if(
-      procs_, [&](std::shared_ptr<Process> ptr) { return func(ptr.get());
+  boost::remove_erase_if(procs_, [&](std::shared_ptr<Process> const& ptr) {
+    return func(ptr.get());
   });
   return *this;
 }
 template<typename Function>
 CombineHarvester& CombineHarvester::FilterSysts(Function func) {
-  boost::remove_erase_if(
-      systs_, [&](std::shared_ptr<Systematic> ptr) { return func(ptr.get());
+  boost::remove_erase_if(systs_, [&](std::shared_ptr<Systematic> const& ptr) {
+    return func(ptr.get());
   });
   return *this;
 }
@@ -0,0 +1,99 @@
+#ifndef CombineTools_HorizontalMorphing_h
+#define CombineTools_HorizontalMorphing_h
+#include <string>
+#include <vector>
+#include "CombineTools/interface/CombineHarvester.h"
+
+namespace ch {
+/**
+ * Creates templates at new mass points by horizontal interpolation between
+ * the templates at neighbouring mass points
+ *
+ * Typical usage:
+ *
+ *     auto hm = ch::HorizontalMorphingFactory()
+ *         .SetVerbosity(1)
+ *         .SetThreads(4);
+ *     hm.AddMassPoints(cb.cp().signals(), cb,
+ *                      ch::MassesFromRange("90-140:1"));
+ *
+ * See below for details on each class method.
+ */
+class HorizontalMorphingFactory {
+ public:
+  HorizontalMorphingFactory();
+
+  /**
+   * Create the processes and systematics of **src** at each mass in
+   * **masses**, and add these to **dest**
+   *
+   * The objects in **src** are grouped by all their properties except the
+   * mass, and within each group the existing mass points are used as the
+   * pivots. For each requested mass that is not already a pivot:
+   *
+   *   * The two neighbouring pivots are found. Masses outside the pivot range
+   *     are skipped, unless \ref SetExtrapolate is used, in which case the two
+   *     pivots at the nearest end are used.
+   *   * The nominal template is found by interpolating the inverse cumulative
+   *     distributions of the two pivot templates linearly in the mass, as in
+   *     the `th1fmorph` method. Negative bin contents are treated as zero.
+   *     The bin errors keep the linearly interpolated fractional error of each
+   *     bin.
+   *   * The process rate and the `value_u` and `value_d` of each systematic
+   *     are interpolated linearly.
+   *   * The up and down templates of each shape systematic are interpolated
+   *     in the same way as the nominal. Every systematic at the lower pivot
+   *     must also be present at the upper one.
+   *
+   * The inverse cumulative distributions for a pair of pivots are computed
+   * once and shared by all the masses between them. The pivot templates must
+   * have the same binning, and only TH1-based processes are supported.
+   */
+  void AddMassPoints(CombineHarvester &src, CombineHarvester &dest,
+                     std::vector<std::string> const& masses);
+
+  /**
+   * By default this class only produces output on the screen when an error
+   * occurs, set to a value greater than zero for more verbose output
+   */
+  inline HorizontalMorphingFactory& SetVerbosity(unsigned verbosity) {
+    v_ = verbosity;
+    return *this;
+  }
+
+  /**
+   * Whether masses outside the range of the existing mass points should be
+   * extrapolated from the two nearest ones, instead of being skipped
+   */
+  inline HorizontalMorphingFactory& SetExtrapolate(bool extrapolate) {
+    extrapolate_ = extrapolate;
+    return *this;
+  }
+
+  /**
+   * Use the templates of the nearest pivot, scaled to the interpolated
+   * rate, instead of interpolating the shapes
+   */
+  inline HorizontalMorphingFactory& SetTrivial(bool trivial) {
+    trivial_ = trivial;
+    return *this;
+  }
+
+  /**
+   * The number of threads used to evaluate the interpolated templates, or
+   * zero for one per core. The results do not depend on this.
+   */
+  inline HorizontalMorphingFactory& SetThreads(unsigned n_threads) {
+    n_threads_ = n_threads;
+    return *this;
+  }
+
+ private:
+  unsigned v_;
+  bool extrapolate_;
+  bool trivial_;
+  unsigned n_threads_;
+};
+}
+
+#endif
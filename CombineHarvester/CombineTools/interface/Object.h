@@ -4,6 +4,33 @@
 
 namespace ch {
 
+/**
+ * Returns a pointer to the unique, permanently stored copy of `str`
+ *
+ * Two strings are equal if and only if their interned pointers are equal.
+ * Interned strings are never released. This function is thread-safe.
+ */
+std::string const* InternString(std::string const& str);
+
+/**
+ * Returns the interned copy of `str` if there is one, otherwise nullptr
+ *
+ * Unlike InternString this never adds `str` to the table, so it can be used
+ * for lookups with arbitrary strings. This function is thread-safe.
+ */
+std::string const* FindInternedString(std::string const& str);
+
+/**
+ * Base class holding the properties shared by Observation, Process and
+ * Systematic
+ *
+ * The string properties are stored as interned strings (see InternString),
+ * so copying an Object only copies pointers. The accessors return a
+ * reference to the interned string. Two Objects have equal values for a
+ * property if and only if the addresses of the returned strings are the
+ * same, which allows properties to be compared without comparing
+ * characters.
+ */
 class Object {
  public:
   Object();
@@ -12,39 +39,45 @@ class Object {
   Object(Object&& other);
   Object& operator=(Object other);
 
-  virtual void set_bin(std::string const& bin) { bin_ = bin; }
-  virtual std::string const& bin() const { return bin_; }
+  void set_bin(std::string const& bin) { bin_ = InternString(bin); }
+  std::string const& bin() const { return *bin_; }
 
-  virtual void set_process(std::string const& process) { process_ = process; }
-  virtual std::string const& process() const { return process_; }
+  void set_process(std::string const& process) {
+    process_ = InternString(process);
+  }
+  std::string const& process() const { return *process_; }
 
   void set_signal(bool const& signal) { signal_ = signal; }
   bool signal() const { return signal_; }
 
-  virtual void set_analysis(std::string const& analysis) { analysis_ = analysis; }
-  virtual std::string const& analysis() const { return analysis_; }
+  void set_analysis(std::string const& analysis) {
+    analysis_ = InternString(analysis);
+  }
+  std::string const& analysis() const { return *analysis_; }
 
-  virtual void set_era(std::string const& era) { era_ = era; }
-  virtual std::string const& era() const { return era_; }
+  void set_era(std::string const& era) { era_ = InternString(era); }
+  std::string const& era() const { return *era_; }
 
-  virtual void set_channel(std::string const& channel) { channel_ = channel; }
-  virtual std::string const& channel() const { return channel_; }
+  void set_channel(std::string const& channel) {
+    channel_ = InternString(channel);
+  }
+  std::string const& channel() const { return *channel_; }
 
-  virtual void set_bin_id(int const& bin_id) { bin_id_ = bin_id; }
-  virtual int bin_id() const { return bin_id_; }
+  void set_bin_id(int const& bin_id) { bin_id_ = bin_id; }
+  int bin_id() const { return bin_id_; }
 
-  virtual void set_mass(std::string const& mass) { mass_ = mass; }
-  virtual std::string const& mass() const { return mass_; }
+  void set_mass(std::string const& mass) { mass_ = InternString(mass); }
+  std::string const& mass() const { return *mass_; }
 
  private:
-  std::string bin_;
-  std::string process_;
+  std::string const* bin_;
+  std::string const* process_;
   bool signal_;
-  std::string analysis_;
-  std::string era_;
-  std::string channel_;
+  std::string const* analysis_;
+  std::string const* era_;
+  std::string const* channel_;
   int bin_id_;
-  std::string mass_;
+  std::string const* mass_;
   friend void swap(Object& first, Object& second);
 };
 }
@@ -36,7 +36,7 @@ class Observation : public Object {
 
  private:
   double rate_;
-  std::unique_ptr<TH1> shape_;
+  std::shared_ptr<TH1 const> shape_;
   RooAbsData* data_;
 
   friend void swap(Observation& first, Observation& second);
@@ -57,7 +57,7 @@ class Process : public Object {
 
  private:
   double rate_;
-  std::unique_ptr<TH1> shape_;
+  std::shared_ptr<TH1 const> shape_;
   RooAbsPdf* pdf_;
   RooAbsData* data_;
   RooAbsReal* norm_;
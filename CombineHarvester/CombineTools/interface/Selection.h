@@ -0,0 +1,158 @@
+#ifndef CombineTools_Selection_h
+#define CombineTools_Selection_h
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CombineTools/interface/CombineHarvester.h"
+#include "CombineTools/interface/Observation.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+
+namespace ch {
+
+/**
+ * A filtered view of the Observation, Process and Systematic entries of a
+ * CombineHarvester instance
+ *
+ * Nothing is copied when a Selection is created or filtered: each entry of
+ * the viewed instance is represented by one bit in a selection bitmap. The
+ * filters have the same names and meaning as the CombineHarvester filters,
+ * but instead of testing every entry they combine the selection, one 64-bit
+ * word at a time, with the bitmap of entries holding the requested values.
+ * A chain of filters therefore costs O(N/64) per requested value. The bitmap
+ * of each property value is built on the first filter on that property and
+ * is shared by every Selection derived from the same one, so the intended
+ * use is to create one Selection outside a loop and filter a cp() of it in
+ * each iteration:
+ *
+ *     ch::Selection all(cb);
+ *     for (auto const& b : cb.bin_set()) {
+ *       ch::CombineHarvester cb_bin = all.cp().bin({b}).Materialize();
+ *       ...
+ *     }
+ *
+ * A CombineHarvester is only created when Materialize() is called, and holds
+ * just the selected entries.
+ *
+ * \warning The viewed CombineHarvester must outlive the Selection, and no
+ * entries may be added to, removed from or modified in it while the
+ * Selection (or any copy of it) is in use. A Selection is not thread-safe.
+ */
+class Selection {
+ public:
+  /// Selects every entry of `cb`
+  explicit Selection(CombineHarvester & cb);
+
+  /// A copy of the view, sharing the same value bitmaps
+  Selection cp() const { return *this; }
+
+  /**
+   * \name Filters
+   * \brief Equivalent to the CombineHarvester filters of the same name
+   */
+  /**@{*/
+  Selection& bin(std::vector<std::string> const& vec, bool cond = true);
+  Selection& bin_id(std::vector<int> const& vec, bool cond = true);
+  Selection& process(std::vector<std::string> const& vec, bool cond = true);
+  Selection& analysis(std::vector<std::string> const& vec, bool cond = true);
+  Selection& era(std::vector<std::string> const& vec, bool cond = true);
+  Selection& channel(std::vector<std::string> const& vec, bool cond = true);
+  Selection& mass(std::vector<std::string> const& vec, bool cond = true);
+  Selection& syst_name(std::vector<std::string> const& vec, bool cond = true);
+  Selection& syst_type(std::vector<std::string> const& vec, bool cond = true);
+
+  Selection& signals();
+  Selection& backgrounds();
+  Selection& histograms();
+
+  /// Deselects the entries for which `func` returns true
+  template<typename Function>
+  Selection& FilterAll(Function func);
+  /**@}*/
+
+  /// Calls `func` on each selected entry, in the viewed instance's order
+  template<typename Function>
+  void ForEachObs(Function func) const;
+  template<typename Function>
+  void ForEachProc(Function func) const;
+  template<typename Function>
+  void ForEachSyst(Function func) const;
+
+  /**
+   * Creates a shallow copy of the viewed instance holding only the selected
+   * entries
+   *
+   * This is equivalent to the same chain of filters applied to
+   * CombineHarvester::cp(), but only the selected entries are copied.
+   */
+  CombineHarvester Materialize() const;
+
+ private:
+  typedef std::vector<uint64_t> Words;
+  struct Bits {
+    Words obs;
+    Words procs;
+    Words systs;
+  };
+  struct Index;
+
+  CombineHarvester * cb_;
+  std::shared_ptr<Index> index_;
+  Bits sel_;
+
+  // Requires, or with cond = false excludes, the entries set in `mask`. The
+  // collections with an empty mask vector are left unchanged.
+  void Apply(Bits const& mask, bool cond);
+
+  template<typename Function>
+  static void ForEachBit(Words const& words, Function func);
+  template<typename T, typename Function>
+  static void DeselectIf(std::vector<std::shared_ptr<T>> const& vec,
+                         Words& words, Function func);
+};
+
+template<typename Function>
+void Selection::ForEachBit(Words const& words, Function func) {
+  for (unsigned w = 0; w < words.size(); ++w) {
+    uint64_t word = words[w];
+    while (word) {
+      func(w * 64 + __builtin_ctzll(word));
+      word &= word - 1;
+    }
+  }
+}
+
+template<typename T, typename Function>
+void Selection::DeselectIf(std::vector<std::shared_ptr<T>> const& vec,
+                           Words& words, Function func) {
+  ForEachBit(words, [&](unsigned i) {
+    if (func(vec[i].get())) words[i / 64] &= ~(uint64_t(1) << (i % 64));
+  });
+}
+
+template<typename Function>
+Selection& Selection::FilterAll(Function func) {
+  DeselectIf(cb_->obs_, sel_.obs, func);
+  DeselectIf(cb_->procs_, sel_.procs, func);
+  DeselectIf(cb_->systs_, sel_.systs, func);
+  return *this;
+}
+
+template<typename Function>
+void Selection::ForEachObs(Function func) const {
+  ForEachBit(sel_.obs, [&](unsigned i) { func(cb_->obs_[i].get()); });
+}
+
+template<typename Function>
+void Selection::ForEachProc(Function func) const {
+  ForEachBit(sel_.procs, [&](unsigned i) { func(cb_->procs_[i].get()); });
+}
+
+template<typename Function>
+void Selection::ForEachSyst(Function func) const {
+  ForEachBit(sel_.systs, [&](unsigned i) { func(cb_->systs_[i].get()); });
+}
+}
+
+#endif
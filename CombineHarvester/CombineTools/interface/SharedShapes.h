@@ -0,0 +1,64 @@
+#ifndef CombineTools_SharedShapes_h
+#define CombineTools_SharedShapes_h
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "TFile.h"
+#include "TH1.h"
+
+namespace ch {
+
+class CombineHarvester;
+
+/**
+ * A ROOT file for histograms that are common to many datacards
+ *
+ * When passed to CombineHarvester::WriteDatacard each histogram is
+ * identified by the path it would be written to and a hash of its binning
+ * and contents. A `shapes` line is pointed at this file if every histogram
+ * it covers is either new or identical to the one already stored here. A
+ * matching hash is confirmed by comparing with the stored histogram.
+ * Otherwise those histograms go into the datacard's own ROOT file as usual.
+ * In this way a mass-independent background written into many per-mass
+ * datacards is only stored once.
+ *
+ * Access is serialised internally, so one instance may be shared by threads
+ * writing different datacards. Which histograms end up here then depends on
+ * the order the datacards are written in, so ch::CardWriter always writes
+ * serially when shared shapes are used.
+ */
+class SharedShapes {
+ public:
+  /// Creates the file, overwriting any existing one
+  explicit SharedShapes(std::string const& filename);
+  ~SharedShapes();
+
+  std::string const& filename() const { return filename_; }
+
+  /// Number of distinct histograms written so far
+  unsigned size() const;
+
+  /// Hash of the binning, bin contents and bin errors of a histogram
+  static std::size_t HistHash(TH1 const* hist);
+
+  /// True if the two histograms have the same binning, bin contents and bin
+  /// errors
+  static bool SameHist(TH1 const* a, TH1 const* b);
+
+ private:
+  friend class CombineHarvester;
+  std::string filename_;
+  std::unique_ptr<TFile> file_;
+  std::map<std::string, std::size_t> hashes_;
+  mutable std::mutex mutex_;
+
+  // True if `hist` can share the histogram stored under `path`, i.e. there is
+  // none or it is identical. The caller must hold mutex_.
+  bool CanShare(std::string const& path, std::size_t hash,
+                TH1 const* hist) const;
+};
+}
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef CombineTools_Systematic_h
 #define CombineTools_Systematic_h
+#include <atomic>
+#include <iosfwd>
 #include <memory>
 #include <string>
 #include "TH1.h"
+#include "TFile.h"
 #include "RooDataHist.h"
 #include "CombineTools/interface/MakeUnique.h"
 #include "CombineTools/interface/Object.h"
@@ -23,11 +26,23 @@ class Systematic : public Object {
   void set_type(std::string const& type) { type_ = type; }
   std::string const& type() const { return type_; }
 
-  void set_value_u(double const& value_u) { value_u_ = value_u; }
-  double value_u() const { return value_u_; }
-
-  void set_value_d(double const& value_d) { value_d_ = value_d; }
-  double value_d() const { return value_d_; }
+  void set_value_u(double const& value_u) {
+    if (lazy_values_.load(std::memory_order_acquire)) ResolveLazyValues();
+    value_u_ = value_u;
+  }
+  double value_u() const {
+    if (lazy_values_.load(std::memory_order_acquire)) ResolveLazyValues();
+    return value_u_;
+  }
+
+  void set_value_d(double const& value_d) {
+    if (lazy_values_.load(std::memory_order_acquire)) ResolveLazyValues();
+    value_d_ = value_d;
+  }
+  double value_d() const {
+    if (lazy_values_.load(std::memory_order_acquire)) ResolveLazyValues();
+    return value_d_;
+  }
 
   void set_scale(double const& scale) { scale_ = scale; }
   double scale() const { return scale_; }
@@ -35,12 +50,28 @@ class Systematic : public Object {
   void set_asymm(bool const& asymm) { asymm_ = asymm; }
   bool asymm() const { return asymm_; }
 
-  TH1 const* shape_u() const { return shape_u_.get(); }
+  /**
+   * The normalised up shape, or null if there is none
+   *
+   * The returned pointer keeps the TH1 alive, even if a lazily-loaded shape
+   * is released by another Systematic loading its shapes. Shapes set with
+   * set_single_bin_shapes() are built afresh on each call and not kept.
+   */
+  std::shared_ptr<TH1 const> shape_u() const {
+    if (lazy_) return LazyShape(true);
+    if (single_nominal_) return BuildSingleBinShape(true);
+    return shape_u_;
+  }
 
   std::unique_ptr<TH1> ClonedShapeU() const;
   std::unique_ptr<TH1> ClonedShapeD() const;
 
-  TH1 const* shape_d() const { return shape_d_.get(); }
+  /// The normalised down shape, or null if there is none
+  std::shared_ptr<TH1 const> shape_d() const {
+    if (lazy_) return LazyShape(false);
+    if (single_nominal_) return BuildSingleBinShape(false);
+    return shape_d_;
+  }
 
   RooDataHist const* data_u() const { return data_u_; }
 
@@ -52,21 +83,92 @@ class Systematic : public Object {
   void set_shapes(std::unique_ptr<TH1> shape_u, std::unique_ptr<TH1> shape_d,
                   TH1 const* nominal);
 
+  /**
+   * Set shapes that differ from `nominal` only in the content of one bin
+   *
+   * Only the bin index and the up and down bin contents are stored, along
+   * with the `nominal` TH1, which is not copied and can be shared by many
+   * Systematic objects, e.g. all the bin-by-bin uncertainties of one
+   * Process. shape_u(), shape_d(), ClonedShapeU() and ClonedShapeD() give
+   * the same normalised shapes as set_shapes() would, but build them on each
+   * call without keeping a copy, so callers should hold on to the result
+   * rather than call these repeatedly. The values value_u and value_d are
+   * not modified.
+   */
+  void set_single_bin_shapes(std::shared_ptr<TH1 const> nominal, int bin,
+                             double content_u, double content_d);
+
+  /// The bin set by set_single_bin_shapes(), or zero if not in use
+  int single_bin() const { return single_nominal_ ? single_bin_ : 0; }
+  TH1 const* single_bin_nominal() const { return single_nominal_.get(); }
+  double single_bin_content_u() const { return single_u_; }
+  double single_bin_content_d() const { return single_d_; }
+
+  /**
+   * Record where the shapes can be read from, deferring the loading until
+   * the shapes or values are first accessed
+   *
+   * On first access the three TH1s are read from `file` and the values and
+   * normalised shapes are set exactly as they would be by set_shapes(). The
+   * shapes may later be released to respect the limit set by
+   * SetMaxResidentShapes(), in which case they are re-read when next
+   * needed. Copies of this Systematic share the same deferred shapes.
+   *
+   * If `warn_log` is not null, a warning is written to it when the shapes
+   * are first read for each of the three TH1s that has negative bins.
+   */
+  void set_lazy_shapes(std::shared_ptr<TFile> file, std::string const& nominal,
+                       std::string const& shape_u, std::string const& shape_d,
+                       std::ostream * warn_log = nullptr);
+
+  /// True if the shapes were set by set_lazy_shapes()
+  bool has_lazy_shapes() const { return bool(lazy_); }
+
+  /**
+   * Set the maximum number of Systematic objects whose lazily-loaded shapes
+   * are held in memory at once, evicting the least recently used when
+   * exceeded
+   *
+   * A value of zero, the default, means there is no limit. Released shapes
+   * are only deleted once no pointer returned by shape_u() or shape_d()
+   * refers to them. The loading and releasing of shapes is guarded by a
+   * mutex, so lazily-loaded Systematic objects can be accessed from several
+   * threads.
+   */
+  static void SetMaxResidentShapes(unsigned n_max);
+
   friend std::ostream& operator<< (std::ostream &out, Systematic const& val);
   static std::ostream& PrintHeader(std::ostream &out);
 
  private:
   std::string name_;
   std::string type_;
-  double value_u_;
-  double value_d_;
+  mutable double value_u_;
+  mutable double value_d_;
   double scale_;
   bool asymm_;
-  std::unique_ptr<TH1> shape_u_;
-  std::unique_ptr<TH1> shape_d_;
+  std::shared_ptr<TH1 const> shape_u_;
+  std::shared_ptr<TH1 const> shape_d_;
   RooDataHist * data_u_;
   RooDataHist * data_d_;
 
+  class LazyShapes;
+  std::shared_ptr<LazyShapes> lazy_;
+  // Set while value_u_ and value_d_ still have to be taken from lazy_. It is
+  // cleared, with release ordering, only after they have been written.
+  mutable std::atomic<bool> lazy_values_;
+
+  void ResolveLazyValues() const;
+  std::shared_ptr<TH1 const> LazyShape(bool up) const;
+  void WarnNegativeBins(unsigned negative) const;
+
+  std::shared_ptr<TH1 const> single_nominal_;
+  int single_bin_;
+  double single_u_;
+  double single_d_;
+
+  std::unique_ptr<TH1> BuildSingleBinShape(bool up) const;
+
   friend void swap(Systematic& first, Systematic& second);
 };
 }
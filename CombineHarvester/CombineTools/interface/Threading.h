@@ -0,0 +1,91 @@
+#ifndef CombineTools_Threading_h
+#define CombineTools_Threading_h
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace ch {
+
+/**
+ * The number of threads to use for n tasks when n_threads are requested
+ * (zero for one per core): never more than n, and always at least one
+ */
+inline unsigned NumThreads(unsigned n, unsigned n_threads) {
+  if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+  if (n_threads > n) n_threads = n;
+  return n_threads > 0 ? n_threads : 1;
+}
+
+/**
+ * Calls `func(i)` for each i in [0, n), sharing the calls between up to
+ * n_threads threads (zero for one per core)
+ *
+ * The calls are handed out one at a time, so their order between threads is
+ * not defined. If any call throws, the remaining calls still run and the
+ * exception of the lowest failing i is re-thrown once all threads finish.
+ */
+template <typename Function>
+void RunThreads(unsigned n, unsigned n_threads, Function func) {
+  n_threads = NumThreads(n, n_threads);
+  if (n_threads == 1) {
+    for (unsigned i = 0; i < n; ++i) func(i);
+    return;
+  }
+  std::atomic<unsigned> next(0);
+  std::vector<std::exception_ptr> errors(n);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    workers.emplace_back([&]() {
+      for (unsigned i = next++; i < n; i = next++) {
+        try {
+          func(i);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto & worker : workers) worker.join();
+  for (auto const& err : errors) {
+    if (err) std::rethrow_exception(err);
+  }
+}
+
+/**
+ * Splits [0, n) into n_threads contiguous blocks and calls
+ * `func(thread, first, last)` for each block, on its own thread when there
+ * is more than one
+ *
+ * The blocks depend only on n and n_threads, so per-thread results (e.g.
+ * random number streams seeded from `thread`) are reproducible. Pass a
+ * thread count from NumThreads(). Exceptions are handled as in RunThreads().
+ */
+template <typename Function>
+void RunBlockThreads(unsigned n, unsigned n_threads, Function func) {
+  if (n_threads <= 1) {
+    func(0, 0, n);
+    return;
+  }
+  std::vector<std::exception_ptr> errors(n_threads);
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    unsigned first = (static_cast<unsigned long long>(n) * t) / n_threads;
+    unsigned last = (static_cast<unsigned long long>(n) * (t + 1)) /
+                    n_threads;
+    workers.emplace_back([&errors, &func, t, first, last]() {
+      try {
+        func(t, first, last);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    });
+  }
+  for (auto & worker : workers) worker.join();
+  for (auto const& err : errors) {
+    if (err) std::rethrow_exception(err);
+  }
+}
+}
+
+#endif
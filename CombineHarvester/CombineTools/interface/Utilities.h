@@ -9,6 +9,7 @@
 #include "boost/lexical_cast.hpp"
 #include "boost/regex.hpp"
 #include "boost/filesystem.hpp"
+#include "boost/functional/hash.hpp"
 #include "TGraph.h"
 #include "RooFitResult.h"
 #include "RooArgSet.h"
@@ -38,32 +39,47 @@ void SetStandardBinNames(
 
 void SetStandardBinName(ch::Object* obj, std::string pattern);
 
-template<class T, class U>
-bool MatchingProcess(T const& first, U const& second) {
-  if (first.bin()         == second.bin()         &&
-      first.process()     == second.process()     &&
+// The string properties of ch::Object are interned, so comparing their
+// addresses is equivalent to comparing their values
+inline bool MatchingProcess(Object const& first, Object const& second) {
+  if (&first.bin()        == &second.bin()        &&
+      &first.process()    == &second.process()    &&
       first.signal()      == second.signal()      &&
-      first.analysis()    == second.analysis()    &&
-      first.era()         == second.era()         &&
-      first.channel()     == second.channel()     &&
+      &first.analysis()   == &second.analysis()   &&
+      &first.era()        == &second.era()        &&
+      &first.channel()    == &second.channel()    &&
       first.bin_id()      == second.bin_id()      &&
-      first.mass()        == second.mass()) {
+      &first.mass()       == &second.mass()) {
     return true;
   } else {
     return false;
   }
 }
 
+/**
+ * Hash of the properties compared by MatchingProcess
+ *
+ * Two objects for which MatchingProcess returns true are guaranteed to give
+ * the same hash value. This allows Process and Systematic entries to be
+ * matched via a hash table instead of comparing every possible pair.
+ */
+inline std::size_t ProcessHash(Object const& obj) {
+  std::size_t seed = 0;
+  boost::hash_combine(seed, &obj.bin());
+  boost::hash_combine(seed, &obj.process());
+  boost::hash_combine(seed, obj.signal());
+  boost::hash_combine(seed, &obj.analysis());
+  boost::hash_combine(seed, &obj.era());
+  boost::hash_combine(seed, &obj.channel());
+  boost::hash_combine(seed, obj.bin_id());
+  boost::hash_combine(seed, &obj.mass());
+  return seed;
+}
+
 template<class T, class U>
 void SetProperties(T * first, U const* second) {
-  first->set_bin(second->bin());
-  first->set_process(second->process());
-  first->set_signal(second->signal());
-  first->set_analysis(second->analysis());
-  first->set_era(second->era());
-  first->set_channel(second->channel());
-  first->set_bin_id(second->bin_id());
-  first->set_mass(second->mass());
+  // Copies the already-interned properties without looking them up again
+  static_cast<Object&>(*first) = static_cast<Object const&>(*second);
 }
 
 void SetFromBinName(ch::Object *input, std::string parse_rules);
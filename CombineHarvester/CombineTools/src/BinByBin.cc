@@ -1,18 +1,88 @@
 #include "CombineTools/interface/BinByBin.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 #include "boost/format.hpp"
 #include "boost/lexical_cast.hpp"
+#include "CombineTools/interface/Selection.h"
+#include "CombineTools/interface/Threading.h"
 
 namespace ch {
 
+namespace {
+// The bin-by-bin systematics to be created for one process
+struct BinByBinProc {
+  BinByBinProc() : skipped(false) {}
+  bool skipped;
+  std::vector<int> bins;
+  std::vector<std::string> names;
+  std::vector<double> values_d;
+  std::vector<double> values_u;
+};
+
+// The contents and errors of all the processes in one category, stored bin
+// by bin, i.e. val[i * procs.size() + j] for bin i of process j
+struct MergeCategory {
+  MergeCategory() : n_bins(0), bbb_added(0), bbb_removed(0) {}
+  std::string bin;
+  std::vector<Process *> procs;
+  std::vector<std::unique_ptr<TH1>> h_copies;
+  int n_bins;
+  std::vector<double> val;
+  std::vector<double> err;
+  unsigned bbb_added;
+  unsigned bbb_removed;
+};
+
+// Applies the merging algorithm described in BinByBinFactory::MergeBinErrors
+// to the errors of one category
+void MergeCategoryErrors(MergeCategory & cat, double bbb_threshold,
+                         double merge_threshold) {
+  unsigned n_procs = cat.procs.size();
+  std::vector<std::pair<double, unsigned>> result;
+  result.reserve(n_procs);
+  for (int i = 0; i < cat.n_bins; ++i) {
+    double const* val = cat.val.data() + i * n_procs;
+    double * err = cat.err.data() + i * n_procs;
+    double tot_bbb_added = 0.0;
+    result.clear();
+    for (unsigned j = 0; j < n_procs; ++j) {
+      if (val[j] == 0.0 && err[j] == 0.0) continue;
+      if (val[j] == 0 || (err[j] / val[j]) > bbb_threshold) {
+        cat.bbb_added += 1;
+        tot_bbb_added += (err[j] * err[j]);
+        result.push_back(std::make_pair(err[j] * err[j], j));
+      }
+    }
+    if (tot_bbb_added == 0.0) continue;
+    std::sort(result.begin(), result.end());
+    double removed = 0.0;
+    for (unsigned r = 0; r < result.size(); ++r) {
+      if ((result[r].first + removed) < (merge_threshold * tot_bbb_added) &&
+          r < (result.size() - 1)) {
+        cat.bbb_removed += 1;
+        removed += result[r].first;
+        err[result[r].second] = 0.0;
+      }
+    }
+    double expand = std::sqrt(1. / (1. - (removed / tot_bbb_added)));
+    for (unsigned r = 0; r < result.size(); ++r) {
+      err[result[r].second] *= expand;
+    }
+  }
+}
+}
+
 BinByBinFactory::BinByBinFactory()
     : pattern_("CMS_$ANALYSIS_$CHANNEL_$BIN_$ERA_$PROCESS_bin_$#"),
       v_(0),
       bbb_threshold_(0.),
       merge_threshold_(0.),
-      fix_norm_(true) {}
+      fix_norm_(true),
+      n_threads_(1) {}
 
 
 void BinByBinFactory::MergeBinErrors(CombineHarvester &cb) {
@@ -21,60 +91,58 @@ void BinByBinFactory::MergeBinErrors(CombineHarvester &cb) {
   // 0.5 should not result in merging - but can do depending on
   // machine and compiler
   double merge_threshold = merge_threshold_ - 1E-9 * merge_threshold_;
+  // The histograms are copied and updated serially, but the merging itself
+  // only needs the bin contents and errors, so is done on plain arrays and
+  // the categories are handled in parallel
   auto bins = cb.bin_set();
+  std::vector<MergeCategory> cats;
+  cats.reserve(bins.size());
+  ch::Selection all(cb);
   for (auto const& bin : bins) {
-    unsigned bbb_added = 0;
-    unsigned bbb_removed = 0;
-    CombineHarvester tmp = std::move(cb.cp().bin({bin}).histograms());
-    std::vector<Process *> procs;
-    tmp.ForEachProc([&](Process *p) { 
-      procs.push_back(p);
+    MergeCategory cat;
+    cat.bin = bin;
+    all.cp().bin({bin}).histograms().ForEachProc([&](Process *p) {
+      cat.procs.push_back(p);
     });
-    if (procs.size() == 0) continue;
+    if (cat.procs.size() == 0) continue;
 
-    std::vector<std::unique_ptr<TH1>> h_copies(procs.size());
-    for (unsigned i = 0; i < h_copies.size(); ++i) {
-      h_copies[i] = procs[i]->ClonedScaledShape();
+    unsigned n_procs = cat.procs.size();
+    cat.h_copies.resize(n_procs);
+    for (unsigned j = 0; j < n_procs; ++j) {
+      cat.h_copies[j] = cat.procs[j]->ClonedScaledShape();
     }
-
-    for (int i = 1; i <= h_copies[0]->GetNbinsX(); ++i) {
-      double tot_bbb_added = 0.0;
-      std::vector<std::pair<double, TH1 *>> result;
-      for (unsigned j = 0; j < h_copies.size(); ++j) {
-        double val = h_copies[j]->GetBinContent(i);
-        double err = h_copies[j]->GetBinError(i);
-        if (val == 0.0 &&  err == 0.0) continue;
-        if (val == 0 || (err/val) > bbb_threshold_) {
-          bbb_added += 1;
-          tot_bbb_added += (err * err);
-          result.push_back(std::make_pair(err*err, h_copies[j].get()));
-        }
-      }
-      if (tot_bbb_added == 0.0) continue;
-      std::sort(result.begin(), result.end());
-      double removed = 0.0;
-      for (unsigned r = 0; r < result.size(); ++r) {
-        if ((result[r].first + removed) < (merge_threshold * tot_bbb_added) &&
-            r < (result.size() - 1)) {
-          bbb_removed += 1;
-          removed += result[r].first;
-          result[r].second->SetBinError(i, 0.0);
-        }
-      }
-      double expand = std::sqrt(1. / (1. - (removed / tot_bbb_added)));
-      for (unsigned r = 0; r < result.size(); ++r) {
-        result[r]
-            .second->SetBinError(i, result[r].second->GetBinError(i) * expand);
+    cat.n_bins = cat.h_copies[0]->GetNbinsX();
+    cat.val.resize(cat.n_bins * n_procs);
+    cat.err.resize(cat.n_bins * n_procs);
+    for (unsigned j = 0; j < n_procs; ++j) {
+      for (int i = 0; i < cat.n_bins; ++i) {
+        cat.val[i * n_procs + j] = cat.h_copies[j]->GetBinContent(i + 1);
+        cat.err[i * n_procs + j] = cat.h_copies[j]->GetBinError(i + 1);
       }
     }
-    for (unsigned i = 0; i < h_copies.size(); ++i) {
-      procs[i]->set_shape(std::move(h_copies[i]), false);
+    cats.push_back(std::move(cat));
+  }
+
+  RunThreads(cats.size(), n_threads_, [&](unsigned c) {
+    MergeCategoryErrors(cats[c], bbb_threshold_, merge_threshold);
+  });
+
+  for (auto & cat : cats) {
+    unsigned n_procs = cat.procs.size();
+    for (unsigned j = 0; j < n_procs; ++j) {
+      TH1 *h = cat.h_copies[j].get();
+      for (int i = 0; i < cat.n_bins; ++i) {
+        double err = cat.err[i * n_procs + j];
+        if (err != h->GetBinError(i + 1)) h->SetBinError(i + 1, err);
+      }
+      cat.procs[j]->set_shape(std::move(cat.h_copies[j]), false);
     }
     if (v_ > 0) {
-      std::cout << "BIN: " << bin << std::endl;
-      std::cout << "Total bbb added:    " << bbb_added << "\n";
-      std::cout << "Total bbb removed:  " << bbb_removed << "\n";
-      std::cout << "Total bbb =======>: " << bbb_added-bbb_removed << "\n";
+      std::cout << "BIN: " << cat.bin << std::endl;
+      std::cout << "Total bbb added:    " << cat.bbb_added << "\n";
+      std::cout << "Total bbb removed:  " << cat.bbb_removed << "\n";
+      std::cout << "Total bbb =======>: "
+                << cat.bbb_added - cat.bbb_removed << "\n";
     }
   }
 }
@@ -85,21 +153,45 @@ void BinByBinFactory::AddBinByBin(CombineHarvester &src, CombineHarvester &dest)
   src.ForEachProc([&](Process *p) { 
     procs.push_back(p);
   });
-  for (unsigned i = 0; i < procs.size(); ++i) {
-    if (!procs[i]->shape()) continue;
+
+  // Deciding which bins need a systematic, and what it will be called, only
+  // reads the nominal templates, so each process can be done independently
+  std::vector<BinByBinProc> results(procs.size());
+  RunThreads(procs.size(), n_threads_, [&](unsigned i) {
+    if (!procs[i]->shape()) return;
     TH1 const* h = procs[i]->shape();
+    BinByBinProc & res = results[i];
     unsigned n_pop_bins = 0;
     for (int j = 1; j <= h->GetNbinsX(); ++j) {
       if (h->GetBinContent(j) > 0.0) ++n_pop_bins;
     }
     if (n_pop_bins <= 1 && fix_norm_) {
-      if (v_ >= 1) {
-        std::cout << "Requested fixed_norm but template has <= 1 populated "
-                     "bins, skipping\n";
-        std::cout << Process::PrintHeader << *(procs[i]) << "\n";
-      }
-      continue;
+      res.skipped = true;
+      return;
     }
+    // Only the $# term differs between the systematics of one process, so
+    // the other placeholders are substituted once and the result split
+    // around each $#
+    std::string pattern = pattern_;
+    Process const* proc = procs[i];
+    boost::replace_all(pattern, "$ANALYSIS", proc->analysis());
+    boost::replace_all(pattern, "$CHANNEL", proc->channel());
+    boost::replace_all(pattern, "$BIN", proc->bin());
+    boost::replace_all(pattern, "$BINID", boost::lexical_cast<std::string>(proc->bin_id()));
+    boost::replace_all(pattern, "$ERA", proc->era());
+    boost::replace_all(pattern, "$PROCESS", proc->process());
+    boost::replace_all(pattern, "$MASS", proc->mass());
+    std::vector<std::string> parts;
+    std::size_t pos = 0;
+    std::size_t found = 0;
+    while ((found = pattern.find("$#", pos)) != std::string::npos) {
+      parts.push_back(pattern.substr(pos, found - pos));
+      pos = found + 2;
+    }
+    parts.push_back(pattern.substr(pos));
+    // The integrals of the up and down templates follow directly from the
+    // change in the one bin
+    double integral = h->Integral();
     for (int j = 1; j <= h->GetNbinsX(); ++j) {
       bool do_bbb = false;
       double val = h->GetBinContent(j);
@@ -113,39 +205,59 @@ void BinByBinFactory::AddBinByBin(CombineHarvester &src, CombineHarvester &dest)
       //   }
       //   continue;
       // }
-      if (do_bbb) {
-        ++bbb_added;
-        ch::Systematic sys;
-        ch::SetProperties(&sys, procs[i]);
-        sys.set_type("shape");
-        std::string name = pattern_;
-        boost::replace_all(name, "$ANALYSIS", sys.analysis());
-        boost::replace_all(name, "$CHANNEL", sys.channel());
-        boost::replace_all(name, "$BIN", sys.bin());
-        boost::replace_all(name, "$BINID", boost::lexical_cast<std::string>(sys.bin_id()));
-        boost::replace_all(name, "$ERA", sys.era());
-        boost::replace_all(name, "$PROCESS", sys.process());
-        boost::replace_all(name, "$MASS", sys.mass());
-        boost::replace_all(name, "$#", boost::lexical_cast<std::string>(j));
-        sys.set_name(name);
-        sys.set_asymm(true);
-        std::unique_ptr<TH1> h_d(static_cast<TH1 *>(h->Clone()));
-        std::unique_ptr<TH1> h_u(static_cast<TH1 *>(h->Clone()));
-        h_d->SetBinContent(j, val - err);
-        if (h_d->GetBinContent(j) < 0.) h_d->SetBinContent(j, 0.);
-        h_u->SetBinContent(j, val + err);
-        if (fix_norm_) {
-          sys.set_value_d(1.0);
-          sys.set_value_u(1.0);
-        } else {
-          sys.set_value_d(h_d->Integral()/h->Integral());
-          sys.set_value_u(h_u->Integral()/h->Integral());
-        }
-        sys.set_shapes(std::move(h_u), std::move(h_d), nullptr);
-        dest.CreateParameterIfEmpty(sys.name());
-        dest.InsertSystematic(sys);
+      if (!do_bbb) continue;
+      std::string idx = boost::lexical_cast<std::string>(j);
+      std::string name = parts[0];
+      for (unsigned k = 1; k < parts.size(); ++k) name += idx + parts[k];
+      res.bins.push_back(j);
+      res.names.push_back(name);
+      if (fix_norm_) {
+        res.values_d.push_back(1.0);
+        res.values_u.push_back(1.0);
+      } else {
+        double val_d = std::max(val - err, 0.);
+        res.values_d.push_back((integral - val + val_d) / integral);
+        res.values_u.push_back((integral + err) / integral);
       }
     }
+  });
+
+  for (unsigned i = 0; i < procs.size(); ++i) {
+    if (results[i].skipped) {
+      if (v_ >= 1) {
+        std::cout << "Requested fixed_norm but template has <= 1 populated "
+                     "bins, skipping\n";
+        std::cout << Process::PrintHeader << *(procs[i]) << "\n";
+      }
+      continue;
+    }
+    BinByBinProc const& res = results[i];
+    if (res.bins.empty()) continue;
+    TH1 const* h = procs[i]->shape();
+    // Each systematic only records the bin it changes, with one copy of the
+    // nominal shared between them
+    TH1 *h_nom = static_cast<TH1 *>(h->Clone());
+    h_nom->SetDirectory(0);
+    std::shared_ptr<TH1 const> nominal(h_nom);
+    ch::Systematic proto;
+    ch::SetProperties(&proto, procs[i]);
+    proto.set_type("shape");
+    proto.set_asymm(true);
+    for (unsigned k = 0; k < res.bins.size(); ++k) {
+      ++bbb_added;
+      int j = res.bins[k];
+      double val = h->GetBinContent(j);
+      double err = h->GetBinError(j);
+      ch::Systematic sys(proto);
+      sys.set_name(res.names[k]);
+      double val_d = val - err;
+      if (val_d < 0.) val_d = 0.;
+      sys.set_value_d(res.values_d[k]);
+      sys.set_value_u(res.values_u[k]);
+      sys.set_single_bin_shapes(nominal, j, val + err, val_d);
+      dest.CreateParameterIfEmpty(sys.name());
+      dest.InsertSystematic(std::move(sys));
+    }
   }
   // std::cout << "bbb added: " << bbb_added << std::endl;
 }
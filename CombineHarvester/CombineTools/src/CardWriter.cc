@@ -1,11 +1,21 @@
 #include "CombineTools/interface/CardWriter.h"
+#include <atomic>
+#include <exception>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 #include "boost/format.hpp"
+#include "RVersion.h"
+#include "TROOT.h"
+#include "TFile.h"
+#include "TH1.h"
 #include "CombineTools/interface/Logging.h"
 #include "CombineTools/interface/Algorithm.h"
+#include "CombineTools/interface/SharedShapes.h"
+#include "CombineTools/interface/MakeUnique.h"
 
 namespace ch {
 
@@ -15,7 +25,8 @@ CardWriter::CardWriter(std::string const& text_pattern,
       root_pattern_(root_pattern),
       wildcard_masses_({"*"}),
       v_(0),
-      create_dirs_(true) {}
+      create_dirs_(true),
+      n_threads_(1) {}
 
 CardWriter& CardWriter::SetVerbosity(unsigned v) {
   v_ = v;
@@ -27,6 +38,16 @@ CardWriter& CardWriter::CreateDirectories(bool flag) {
   return *this;
 }
 
+CardWriter& CardWriter::SetThreads(unsigned n_threads) {
+  n_threads_ = n_threads;
+  return *this;
+}
+
+CardWriter& CardWriter::SetSharedShapes(std::string const& root_file) {
+  shared_pattern_ = root_file;
+  return *this;
+}
+
 
 CardWriter& CardWriter::SetWildcardMasses(
     std::vector<std::string> const& masses) {
@@ -71,6 +92,72 @@ void CardWriter::MakeDirs(PatternMap const& map) const {
   }
 }
 
+auto CardWriter::Partition(PatternMap const& map, ObjectMap const& obj_map,
+                           ch::CombineHarvester& cmb) const
+    -> std::vector<ch::CombineHarvester> {
+  // Invert the map so that each compiled pattern gives the indices of the
+  // map entries it belongs to. Then each Object only needs a single look-up,
+  // instead of a search through the pattern set of every entry.
+  std::unordered_map<std::string, std::vector<unsigned>> pattern_groups;
+  unsigned i = 0;
+  for (auto const& entry : map) {
+    for (auto const& pattern : entry.second) {
+      pattern_groups[pattern].push_back(i);
+    }
+    ++i;
+  }
+  std::unordered_map<Object const*, std::vector<unsigned> const*> obj_groups;
+  cmb.ForEachObj([&](ch::Object const* obj) {
+    auto it = pattern_groups.find(obj_map.at(obj));
+    if (it != pattern_groups.end()) obj_groups[obj] = &(it->second);
+  });
+  // Each group starts with the parameters, workspaces and flags of cmb but
+  // no objects. A single pass then appends every object to each of its
+  // groups, which keeps the original object order within a group.
+  ch::CombineHarvester empty = cmb.cp();
+  empty.obs_.clear();
+  empty.procs_.clear();
+  empty.systs_.clear();
+  std::vector<ch::CombineHarvester> groups(map.size(), empty);
+  for (auto const& ptr : cmb.obs_) {
+    auto it = obj_groups.find(ptr.get());
+    if (it == obj_groups.end()) continue;
+    for (unsigned g : *(it->second)) groups[g].obs_.push_back(ptr);
+  }
+  for (auto const& ptr : cmb.procs_) {
+    auto it = obj_groups.find(ptr.get());
+    if (it == obj_groups.end()) continue;
+    for (unsigned g : *(it->second)) groups[g].procs_.push_back(ptr);
+  }
+  for (auto const& ptr : cmb.systs_) {
+    auto it = obj_groups.find(ptr.get());
+    if (it == obj_groups.end()) continue;
+    for (unsigned g : *(it->second)) groups[g].systs_.push_back(ptr);
+  }
+  return groups;
+}
+
+bool CardWriter::CanWriteInParallel(ch::CombineHarvester& cmb) const {
+  // The same input objects are typically written into many files. This is
+  // fine for TH1s, which are only read, but streaming a RooWorkspace
+  // modifies it, and lazily-loaded shapes share an eviction list. The
+  // objects are checked, not the flag, as they may have been loaded with a
+  // different setting.
+  bool shared_state = false;
+  cmb.ForEachObs([&](ch::Observation const* obs) {
+    if (obs->data()) shared_state = true;
+  });
+  cmb.ForEachProc([&](ch::Process const* proc) {
+    if (proc->data() || proc->pdf() || proc->norm()) shared_state = true;
+  });
+  cmb.ForEachSyst([&](ch::Systematic const* sys) {
+    if (sys->data_u() || sys->data_d() || sys->has_lazy_shapes()) {
+      shared_state = true;
+    }
+  });
+  return !shared_state;
+}
+
 void CardWriter::WriteCards(std::string const& tag,
                        ch::CombineHarvester& cmb) const {
   #ifdef TIME_FUNCTIONS
@@ -98,44 +185,136 @@ void CardWriter::WriteCards(std::string const& tag,
   // equivalent to tens of seconds for a complex model. To avoid this we just
   // calculate once for each ch::Object and store the result in a map, which we
   // use as a look-up later.
-  std::map<Object const*, std::string> root_map;
+  ObjectMap root_map;
+  ObjectMap text_map;
   cmb.ForEachObj([&](ch::Object const* obj) {
       root_map[obj] = Compile(root_pattern_, obj);
-    });
-  std::map<Object const*, std::string> text_map;
-  cmb.ForEachObj([&](ch::Object const* obj) {
       text_map[obj] = Compile(text_pattern_, obj);
     });
 
+  // Split the CH instance into the objects that will be written into each
+  // file, and then each of these into the objects for each text datacard.
+  // Nothing is written until all of this is done, so the files are
+  // independent of each other from here on.
+  std::vector<std::string> f_names;
+  std::vector<std::vector<std::string>> d_names;
+  std::vector<std::vector<CombineHarvester>> d_cmbs;
+  auto f_cmbs = Partition(f_map, root_map, cmb);
+  unsigned f_idx = 0;
   for (auto const& f : f_map) {
-    // Create each ROOT file (overwrite pre-existing)
-    FNLOGC(std::cout, v_ > 0) << "Creating file " << f.first << "\n";
-    TFile file(f.first.c_str(), "RECREATE");
-
-    // Filter CH instance to leave only the objects that will be written into
-    // this file
-    CombineHarvester f_cmb = cmb.cp().FilterAll([&](ch::Object const* obj) {
-      return !ch::contains(f.second, root_map.at(obj));
-    });
-
     // Call BuildMap again - this time to figure out which text datacards to
     // create
-    auto d_map = BuildMap(text_pattern_, f_cmb);
+    auto d_map = BuildMap(text_pattern_, f_cmbs[f_idx]);
 
     // Create dirs if we're allowed to
     if (create_dirs_) MakeDirs(d_map);
 
+    f_names.push_back(f.first);
+    d_names.emplace_back();
+    for (auto const& d : d_map) d_names.back().push_back(d.first);
+    d_cmbs.push_back(Partition(d_map, text_map, f_cmbs[f_idx]));
+    // Release the file-level copy as we go
+    f_cmbs[f_idx] = CombineHarvester();
+    ++f_idx;
+  }
+
+  std::unique_ptr<SharedShapes> shared;
+  if (shared_pattern_.size()) {
+    std::string shared_name = shared_pattern_;
+    boost::replace_all(shared_name, "$TAG", tag_);
+    boost::filesystem::path shared_dir =
+        boost::filesystem::path(shared_name).parent_path();
+    if (create_dirs_ && !shared_dir.empty()) {
+      boost::filesystem::create_directories(shared_dir);
+    }
+    FNLOGC(std::cout, v_ > 0) << "Creating file " << shared_name << "\n";
+    shared = ch::make_unique<SharedShapes>(shared_name);
+  }
+
+  auto write_file = [&](unsigned i) {
+    // Create each ROOT file (overwrite pre-existing)
+    TFile file(f_names[i].c_str(), "RECREATE");
     // Loop through each datacard
-    for (auto const& d : d_map) {
-      // Filter CH instance to leave only the objects that will be written into
-      // this text datacard
-      CombineHarvester d_cmb = f_cmb.cp().FilterAll([&](ch::Object const* obj) {
-        return !ch::contains(d.second, text_map.at(obj));
-      });
-      FNLOGC(std::cout, v_ > 0) << "Creating datacard " << d.first << "\n";
-      d_cmb.WriteDatacard(d.first, file);
+    for (unsigned j = 0; j < d_names[i].size(); ++j) {
+      if (shared) {
+        d_cmbs[i][j].WriteDatacard(d_names[i][j], file, *shared);
+      } else {
+        d_cmbs[i][j].WriteDatacard(d_names[i][j], file);
+      }
     }
   };
+
+  unsigned n_threads = n_threads_;
+  if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+  if (n_threads > f_names.size()) n_threads = f_names.size();
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,6,0)
+  if (n_threads > 1) {
+    FNLOGC(std::cout, v_ > 0)
+        << "Parallel writing requires ROOT 6.06 or later, using one thread\n";
+    n_threads = 1;
+  }
+#endif
+  if (n_threads > 1 && shared) {
+    // Which datacards can use the shared file depends on the order they are
+    // written in, so this must be the same as for serial writing
+    FNLOGC(std::cout, v_ > 0)
+        << "Shared shapes are written in datacard order, using one thread\n";
+    n_threads = 1;
+  }
+  if (n_threads > 1 && !CanWriteInParallel(cmb)) {
+    FNLOGC(std::cout, v_ > 0)
+        << "Model contains RooFit objects or lazily-loaded shapes, using one "
+           "thread\n";
+    n_threads = 1;
+  }
+
+  if (n_threads <= 1) {
+    for (unsigned i = 0; i < f_names.size(); ++i) {
+      FNLOGC(std::cout, v_ > 0) << "Creating file " << f_names[i] << "\n";
+      for (auto const& d : d_names[i]) {
+        FNLOGC(std::cout, v_ > 0) << "Creating datacard " << d << "\n";
+      }
+      write_file(i);
+    }
+    return;
+  }
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#endif
+  // Log everything up front so that the output is in the same order as for
+  // serial writing
+  for (unsigned i = 0; i < f_names.size(); ++i) {
+    FNLOGC(std::cout, v_ > 0) << "Creating file " << f_names[i] << "\n";
+    for (auto const& d : d_names[i]) {
+      FNLOGC(std::cout, v_ > 0) << "Creating datacard " << d << "\n";
+    }
+  }
+  // WriteDatacard toggles TH1::AddDirectory around each clone. Switching it
+  // off for the duration means every thread only ever sets the same value.
+  bool add_dir = TH1::AddDirectoryStatus();
+  TH1::AddDirectory(false);
+  // Files differ a lot in size, so hand them out one at a time. Any exception
+  // is re-thrown below for the first failing file.
+  std::atomic<unsigned> next_file(0);
+  std::vector<std::exception_ptr> errors(f_names.size());
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    workers.emplace_back([&]() {
+      for (unsigned i = next_file++; i < f_names.size(); i = next_file++) {
+        try {
+          write_file(i);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto & worker : workers) worker.join();
+  TH1::AddDirectory(add_dir);
+  for (auto const& err : errors) {
+    if (err) std::rethrow_exception(err);
+  }
 }
 
 std::string CardWriter::Compile(std::string pattern, ch::Object const* obj,
@@ -19,6 +19,7 @@ CombineHarvester::CombineHarvester() : verbosity_(0), log_(&(std::cout)) {
   // }
   flags_["zero-negative-bins-on-import"] = true;
   flags_["allow-missing-shapes"] = true;
+  flags_["lazy-shape-loading"] = false;
   // std::cout << "[CombineHarvester] Constructor called for " << this << "\n";
 }
 
@@ -26,6 +27,25 @@ CombineHarvester::~CombineHarvester() {
   // std::cout << "[CombineHarvester] Destructor called for " << this << "\n";
 }
 
+void CombineHarvester::SetFlag(std::string const& flag, bool const& value) {
+  auto it = flags_.find(flag);
+  if (it == flags_.end()) {
+    throw std::runtime_error(FNERROR("Flag " + flag + " is not defined"));
+  }
+  FNLOGC(log(), verbosity_ >= 1) << "Changing value of flag \"" << flag
+                                 << "\" from " << it->second << " to "
+                                 << value << "\n";
+  it->second = value;
+}
+
+bool CombineHarvester::GetFlag(std::string const& flag) const {
+  auto it = flags_.find(flag);
+  if (it == flags_.end()) {
+    throw std::runtime_error(FNERROR("Flag " + flag + " is not defined"));
+  }
+  return it->second;
+}
+
 void swap(CombineHarvester& first, CombineHarvester& second) {
   using std::swap;
   // std::cout << "[CombineHarvester] Swap " << &first << " <-> "
@@ -162,7 +182,7 @@ CombineHarvester CombineHarvester::deep() {
     }
   }
 
-  for (auto it : cpy.params_) {
+  for (auto const& it : cpy.params_) {
     for (unsigned i = 0; i < it.second->vars().size(); ++i) {
       it.second->vars()[i] = var_map.at(it.second->vars()[i]);
     }
@@ -486,7 +506,18 @@ void CombineHarvester::LoadShapes(Systematic* entry,
   std::string p_s_lo = p_s;
   boost::replace_all(p_s_hi, "$SYSTEMATIC", entry->name() + "Up");
   boost::replace_all(p_s_lo, "$SYSTEMATIC", entry->name() + "Down");
-  if (mapping.IsHist()) {
+  // A "shape?" entry is checked for its shapes straight after this, so
+  // there is nothing to gain from deferring the loading
+  if (mapping.IsHist() && flags_.at("lazy-shape-loading") &&
+      entry->type() != "shape?") {
+    if (verbosity_ >= 2) {
+      LOGLINE(log(), "Mapping type is TH1, loading deferred");
+    }
+    // The negative bin check is done when the shapes are first read
+    entry->set_lazy_shapes(
+        mapping.file, mapping.pattern, p_s_hi, p_s_lo,
+        flags_.at("zero-negative-bins-on-import") ? log_ : nullptr);
+  } else if (mapping.IsHist()) {
     if (verbosity_ >= 2) LOGLINE(log(), "Mapping type is TH1");
     std::unique_ptr<TH1> h = GetClonedTH1(mapping.file.get(), mapping.pattern);
     std::unique_ptr<TH1> h_u = GetClonedTH1(mapping.file.get(), p_s_hi);
@@ -214,4 +214,8 @@ void CombineHarvester::InsertProcess(ch::Process const& proc) {
 void CombineHarvester::InsertSystematic(ch::Systematic const& sys) {
   systs_.push_back(std::make_shared<ch::Systematic>(sys));
 }
+
+void CombineHarvester::InsertSystematic(ch::Systematic && sys) {
+  systs_.push_back(std::make_shared<ch::Systematic>(std::move(sys)));
+}
 }
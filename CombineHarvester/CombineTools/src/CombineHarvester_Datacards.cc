@@ -1,12 +1,18 @@
 #include "CombineTools/interface/CombineHarvester.h"
 #include <cmath>
+#include <cstdio>
 #include <vector>
 #include <map>
 #include <string>
 #include <iostream>
 #include <utility>
 #include <set>
+#include <unordered_map>
 #include <fstream>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <exception>
 #include "boost/lexical_cast.hpp"
 #include "boost/algorithm/string.hpp"
 #include "boost/format.hpp"
@@ -23,20 +29,92 @@
 #include "CombineTools/interface/Utilities.h"
 #include "CombineTools/interface/TFileIO.h"
 #include "CombineTools/interface/Algorithm.h"
+#include "CombineTools/interface/Selection.h"
 #include "CombineTools/interface/GitVersion.h"
 
 namespace ch {
 
-// Extract info from filename using parse rule like:
-// ".*{MASS}/{ANALYSIS}_{CHANNEL}_{BINID}_{ERA}.txt"
-int CombineHarvester::ParseDatacard(std::string const& filename,
-    std::string parse_rules) {
+namespace {
+// Get a workspace from the file, reusing the copy in ws_store if it has
+// already been read
+std::shared_ptr<RooWorkspace> GetStoredWorkspace(
+    std::map<std::string, std::shared_ptr<RooWorkspace>> & ws_store,
+    TFile & file, std::string const& name) {
+  std::string store_key = file.GetName() + name;
+  if (!ws_store.count(store_key)) {
+    file.cd();
+    std::shared_ptr<RooWorkspace> ptr(
+        dynamic_cast<RooWorkspace*>(gDirectory->Get(name.c_str())));
+    if (!ptr) {
+      throw std::runtime_error(FNERROR("Workspace not found in file"));
+    }
+    ws_store[store_key] = ptr;
+  }
+  return ws_store.at(store_key);
+}
+
+// Load the entire datacard into memory as a vector of strings, then loop
+// through lines, trimming whitespace at the beginning or end and splitting
+// each line into a vector of words (using any amount of whitespace as the
+// separator).  We skip any line of zero length or which starts with a "#"
+// or "-" character.
+std::vector<std::vector<std::string>> TokenizeDatacard(
+    std::string const& filename) {
+  std::vector<std::string> lines = ch::ParseFileLines(filename);
+  std::vector<std::vector<std::string>> words;
+  for (unsigned i = 0; i < lines.size(); ++i) {
+    boost::trim(lines[i]);
+    if (lines[i].size() == 0) continue;
+    if (lines[i].at(0) == '#' || lines[i].at(0) == '-') continue;
+    words.push_back(std::vector<std::string>());
+    boost::split(words.back(), lines[i], boost::is_any_of("\t "),
+        boost::token_compress_on);
+  }
+  return words;
+}
+
+boost::regex ParseRuleRegex(std::string parse_rules) {
   boost::replace_all(parse_rules, "$ANALYSIS",  "(?<ANALYSIS>[\\w\\.]+)");
   boost::replace_all(parse_rules, "$ERA",       "(?<ERA>[\\w\\.]+)");
   boost::replace_all(parse_rules, "$CHANNEL",   "(?<CHANNEL>[\\w\\.]+)");
   boost::replace_all(parse_rules, "$BINID",     "(?<BINID>[\\w\\.]+)");
   boost::replace_all(parse_rules, "$MASS",      "(?<MASS>[\\w\\.]+)");
-  boost::regex rgx(parse_rules);
+  return boost::regex(parse_rules);
+}
+
+// Text output helpers for WriteDatacard. These give exactly the same text as
+// the printf-style boost::format expressions they replace ("%-15s " etc.),
+// but append straight to one buffer.
+void AppendPadded(std::string & out, std::string const& str, unsigned width) {
+  out += str;
+  if (str.size() < width) out.append(width - str.size(), ' ');
+}
+
+void AppendColumn(std::string & out, std::string const& str) {
+  AppendPadded(out, str, 15);
+  out += ' ';
+}
+
+template <typename... Args>
+void AppendFormat(std::string & out, char const* fmt, Args... args) {
+  char buf[64];
+  int n = std::snprintf(buf, sizeof(buf), fmt, args...);
+  if (n < 0) return;
+  if (unsigned(n) < sizeof(buf)) {
+    out.append(buf, n);
+  } else {
+    std::vector<char> large(n + 1);
+    std::snprintf(large.data(), large.size(), fmt, args...);
+    out.append(large.data(), n);
+  }
+}
+}
+
+// Extract info from filename using parse rule like:
+// ".*{MASS}/{ANALYSIS}_{CHANNEL}_{BINID}_{ERA}.txt"
+int CombineHarvester::ParseDatacard(std::string const& filename,
+    std::string parse_rules) {
+  boost::regex rgx = ParseRuleRegex(parse_rules);
   boost::smatch matches;
   boost::regex_search(filename, matches, rgx);
   this->ParseDatacard(filename,
@@ -49,32 +127,76 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
   return 0;
 }
 
+int CombineHarvester::ParseDatacards(std::vector<std::string> const& filenames,
+    std::string parse_rules, unsigned n_threads) {
+  if (n_threads == 0) n_threads = std::thread::hardware_concurrency();
+  if (n_threads > filenames.size()) n_threads = filenames.size();
+  if (n_threads == 0) n_threads = 1;
+
+  // Reading and splitting the cards only involves strings, so can be done in
+  // parallel. Any exception is re-thrown below for the first failing card.
+  std::vector<std::vector<std::vector<std::string>>> card_words(
+      filenames.size());
+  std::vector<std::exception_ptr> errors(filenames.size());
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < n_threads; ++t) {
+    workers.emplace_back([&, t]() {
+      for (unsigned i = t; i < filenames.size(); i += n_threads) {
+        try {
+          card_words[i] = TokenizeDatacard(filenames[i]);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto & worker : workers) worker.join();
+
+  // The input files and workspaces are shared by all the cards in this call
+  // and released when it returns
+  std::map<std::string, std::shared_ptr<TFile>> file_store;
+  std::map<std::string, std::shared_ptr<RooWorkspace>> ws_store;
+  boost::regex rgx = ParseRuleRegex(parse_rules);
+  for (unsigned i = 0; i < filenames.size(); ++i) {
+    if (errors[i]) std::rethrow_exception(errors[i]);
+    boost::smatch matches;
+    boost::regex_search(filenames[i], matches, rgx);
+    this->ParseDatacardWords(filenames[i], card_words[i],
+      matches.str("ANALYSIS"),
+      matches.str("ERA"),
+      matches.str("CHANNEL"),
+      matches.str("BINID").length() ?
+        boost::lexical_cast<int>(matches.str("BINID")) : 0,
+      matches.str("MASS"),
+      file_store, ws_store);
+    // Release the words as we go
+    std::vector<std::vector<std::string>>().swap(card_words[i]);
+  }
+  return 0;
+}
+
 int CombineHarvester::ParseDatacard(std::string const& filename,
     std::string const& analysis,
     std::string const& era,
     std::string const& channel,
     int bin_id,
     std::string const& mass) {
-  // Load the entire datacard into memory as a vector of strings
-  std::vector<std::string> lines = ch::ParseFileLines(filename);
-  // Loop through lines, trimming whitespace at the beginning or end
-  // then splitting each line into a vector of words (using any amount
-  // of whitespace as the separator).  We skip any line of zero length
-  // or which starts with a "#" or "-" character.
-  std::vector<std::vector<std::string>> words;
-  for (unsigned i = 0; i < lines.size(); ++i) {
-    boost::trim(lines[i]);
-    if (lines[i].size() == 0) continue;
-    if (lines[i].at(0) == '#' || lines[i].at(0) == '-') continue;
-    words.push_back(std::vector<std::string>());
-    boost::split(words.back(), lines[i], boost::is_any_of("\t "),
-        boost::token_compress_on);
-  }
-
-  std::vector<HistMapping> hist_mapping;
-  // std::map<std::string, RooAbsData*> data_map;
   std::map<std::string, std::shared_ptr<TFile>> file_store;
   std::map<std::string, std::shared_ptr<RooWorkspace>> ws_store;
+  return ParseDatacardWords(filename, TokenizeDatacard(filename), analysis,
+                            era, channel, bin_id, mass, file_store, ws_store);
+}
+
+int CombineHarvester::ParseDatacardWords(std::string const& filename,
+    std::vector<std::vector<std::string>> const& words,
+    std::string const& analysis,
+    std::string const& era,
+    std::string const& channel,
+    int bin_id,
+    std::string const& mass,
+    std::map<std::string, std::shared_ptr<TFile>> & file_store,
+    std::map<std::string, std::shared_ptr<RooWorkspace>> & ws_store) {
+  std::vector<HistMapping> hist_mapping;
 
   bool start_nuisance_scan = false;
   unsigned r = 0;
@@ -113,32 +235,16 @@ int CombineHarvester::ParseDatacard(std::string const& filename,
       if (words[i].size() > 5) mapping.syst_pattern = words[i][5];
 
       if (mapping.IsPdf()) {
-        std::string store_key =
-            mapping.file->GetName() + mapping.WorkspaceName();
-        if (!ws_store.count(store_key)) {
-          mapping.file->cd();
-          std::shared_ptr<RooWorkspace> ptr(dynamic_cast<RooWorkspace*>(
-              gDirectory->Get(mapping.WorkspaceName().c_str())));
-          if (!ptr) {
-            throw std::runtime_error(FNERROR("Workspace not found in file"));
-          }
-          ws_store[store_key] = ptr;
-        }
-        mapping.ws = SetupWorkspace(*(ws_store[store_key]), true);
+        mapping.ws = SetupWorkspace(
+            *GetStoredWorkspace(ws_store, *(mapping.file),
+                                mapping.WorkspaceName()),
+            true);
       }
       if (mapping.IsPdf() && mapping.syst_pattern != "") {
-        std::string store_key =
-            mapping.file->GetName() + mapping.SystWorkspaceName();
-        if (!ws_store.count(store_key)) {
-          mapping.file->cd();
-          std::shared_ptr<RooWorkspace> ptr(dynamic_cast<RooWorkspace*>(
-              gDirectory->Get(mapping.SystWorkspaceName().c_str())));
-          if (!ptr) {
-            throw std::runtime_error(FNERROR("Workspace not found in file"));
-          }
-          ws_store[store_key] = ptr;
-        }
-        mapping.sys_ws = SetupWorkspace(*(ws_store[store_key]), true);
+        mapping.sys_ws = SetupWorkspace(
+            *GetStoredWorkspace(ws_store, *(mapping.file),
+                                mapping.SystWorkspaceName()),
+            true);
       }
     }
 
@@ -372,13 +478,14 @@ void CombineHarvester::FillHistMappings(std::vector<HistMapping> & mappings) {
   // signal will. Will probably want to change this in the future
   std::set<std::string> hist_bins;
   auto bins = this->bin_set();
+  Selection all(*this);
   for (auto bin : bins) {
     unsigned shape_count = std::count_if(procs_.begin(), procs_.end(),
-        [&](std::shared_ptr<ch::Process> p) {
+        [&](std::shared_ptr<ch::Process> const& p) {
           return (p->bin() == bin && p->shape() && (!p->signal()));
         });
     shape_count += std::count_if(obs_.begin(), obs_.end(),
-        [&](std::shared_ptr<ch::Observation> p) {
+        [&](std::shared_ptr<ch::Observation> const& p) {
           return (p->bin() == bin && p->shape());
         });
 
@@ -388,10 +495,9 @@ void CombineHarvester::FillHistMappings(std::vector<HistMapping> & mappings) {
       hist_bins.insert(bin);
     }
 
-    CombineHarvester ch_signals =
-        std::move(this->cp().bin({bin}).signals().histograms());
-    auto sig_proc_set =
-        ch_signals.SetFromProcs(std::mem_fn(&ch::Process::process));
+    std::set<std::string> sig_proc_set;
+    all.cp().bin({bin}).signals().histograms().ForEachProc(
+        [&](ch::Process const* p) { sig_proc_set.insert(p->process()); });
     for (auto sig_proc : sig_proc_set) {
       mappings.emplace_back(sig_proc, bin, bin + "/" + sig_proc + "$MASS",
                             bin + "/" + sig_proc + "$MASS_$SYSTEMATIC");
@@ -400,8 +506,8 @@ void CombineHarvester::FillHistMappings(std::vector<HistMapping> & mappings) {
 
   // Generate mappings for RooFit objects
   for (auto bin : bins) {
-    CombineHarvester ch_bin = std::move(this->cp().bin({bin}));
-    for (auto obs : ch_bin.obs_) {
+    CombineHarvester ch_bin = all.cp().bin({bin}).Materialize();
+    for (auto const& obs : ch_bin.obs_) {
       if (!obs->data()) continue;
       std::string obj_name = std::string(data_ws_map[obs->data()]->GetName()) +
                              ":" + std::string(obs->data()->GetName());
@@ -478,32 +584,50 @@ void CombineHarvester::FillHistMappings(std::vector<HistMapping> & mappings) {
 
 void CombineHarvester::WriteDatacard(std::string const& name,
                                      TFile& root_file) {
-  using boost::format;
+  WriteDatacardImpl(name, root_file, nullptr);
+}
+
+void CombineHarvester::WriteDatacard(std::string const& name,
+                                     TFile& root_file, SharedShapes& shared) {
+  WriteDatacardImpl(name, root_file, &shared);
+}
+
+void CombineHarvester::WriteDatacardImpl(std::string const& name,
+                                         TFile& root_file,
+                                         SharedShapes* shared) {
   if (!root_file.IsOpen()) {
     throw std::runtime_error(FNERROR(
         std::string("Output ROOT file is not open: ") + root_file.GetName()));
   }
-  std::ofstream txt_file;
-  txt_file.open(name);
-  if (!txt_file.is_open()) {
+  std::ofstream txt_out;
+  txt_out.open(name);
+  if (!txt_out.is_open()) {
     throw std::runtime_error(FNERROR("Unable to create file: " + name));
   }
+  // The card is assembled in one buffer and written at the end. This also
+  // means that when writing to a SharedShapes file the shapes lines can be
+  // filled in once the histograms have been compared.
+  std::string txt;
 
-  txt_file << "# Datacard produced by CombineHarvester with git status: "
-           << ch::GitVersion() << "\n";
+  txt += "# Datacard produced by CombineHarvester with git status: ";
+  txt += ch::GitVersion();
+  txt += "\n";
 
   std::string dashes(80, '-');
 
   auto bin_set = this->SetFromObs(std::mem_fn(&ch::Observation::bin));
   auto proc_set = this->SetFromProcs(std::mem_fn(&ch::Process::process));
   auto sys_set = this->SetFromSysts(std::mem_fn(&ch::Systematic::name));
-  txt_file << "imax    " << bin_set.size()
-            << " number of bins\n";
-  txt_file << "jmax    " << proc_set.size() - 1
-           << " number of processes minus 1\n";
-  txt_file << "kmax    " << "*" << " number of nuisance parameters\n";
-  txt_file << dashes << "\n";
+  txt += "imax    " + std::to_string(bin_set.size()) + " number of bins\n";
+  txt += "jmax    " + std::to_string(proc_set.size() - 1) +
+         " number of processes minus 1\n";
+  txt += "kmax    *";
+  txt += " number of nuisance parameters\n";
+  txt += dashes + "\n";
 
+  // Each systematic line has one column per process, so this is roughly
+  // the size of the card
+  txt.reserve((sys_set.size() + 16) * (procs_.size() + 2) * 16);
 
   std::vector<HistMapping> mappings;
   FillHistMappings(mappings);
@@ -512,8 +636,34 @@ void CombineHarvester::WriteDatacard(std::string const& name,
 
   auto proc_sys_map = this->GenerateProcSystMap();
 
+  // Histograms are written straight away, unless they might go to the shared
+  // file, in which case they are held until the end.
+  struct PendingHist {
+    std::unique_ptr<TH1> hist;
+    int mapping;
+    std::string path;
+  };
+  std::vector<PendingHist> pending;
+  auto write_hist = [&](std::unique_ptr<TH1> h, std::string const& bin,
+                        std::string const& process, std::string const& mass,
+                        std::string const& nuisance, unsigned type) {
+    if (!shared) {
+      WriteHistToFile(h.get(), &root_file, mappings, bin, process, mass,
+                      nuisance, type);
+      return;
+    }
+    PendingHist entry;
+    entry.mapping =
+        ResolveHistPath(mappings, bin, process, mass, nuisance, type,
+                        entry.path);
+    if (entry.mapping < 0) return;
+    h->SetDirectory(0);
+    entry.hist = std::move(h);
+    pending.push_back(std::move(entry));
+  };
+
   std::set<std::string> all_dependents_pars;
-  for (auto proc : procs_) {
+  for (auto const& proc : procs_) {
     if (!proc->pdf()) continue;
     // The rest of this is building the list of dependents
     /**
@@ -567,47 +717,39 @@ void CombineHarvester::WriteDatacard(std::string const& name,
   // Compute the relative path from the txt file to the root file
   file_name = make_relative(txt_file_path, root_file_path).string();
 
-  for (auto const& mapping : mappings) {
-    txt_file << format("shapes %s %s %s %s %s\n")
-      % mapping.process
-      % mapping.category
-      % file_name
-      % mapping.pattern
-      % mapping.syst_pattern;
-  }
-  txt_file << dashes << "\n";
+  // The shapes lines are inserted here at the end
+  std::string::size_type shapes_pos = txt.size();
+  txt += dashes + "\n";
 
-  for (auto ws_it : wspaces_) {
+  for (auto const& ws_it : wspaces_) {
     ch::WriteToTFile(ws_it.second.get(), &root_file, ws_it.second->GetName());
   }
 
   // Writing observations
-  txt_file << "bin          ";
+  txt += "bin          ";
   for (auto const& obs : obs_) {
-    txt_file << format("%-15s ") % obs->bin();
+    AppendColumn(txt, obs->bin());
     if (obs->shape()) {
       std::unique_ptr<TH1> h((TH1*)(obs->shape()->Clone()));
       h->Scale(obs->rate());
-      WriteHistToFile(h.get(), &root_file, mappings, obs->bin(), "data_obs",
-                      obs->mass(), "", 0);
+      write_hist(std::move(h), obs->bin(), "data_obs", obs->mass(), "", 0);
     }
   }
-  txt_file << "\n";
-  txt_file << "observation  ";
+  txt += "\n";
+  txt += "observation  ";
   // On the precision of the observation yields: .1f is not sufficient for
   // combine to be happy if we have some asimov dataset with non-integer values.
   // We could just always give .4f but this doesn't look nice for the majority
   // of cards that have real data. Instead we'll check...
-  std::string obs_fmt_int = "%-15.1f ";
-  std::string obs_fmt_flt = "%-15.4f ";
+  char const* obs_fmt_int = "%-15.1f ";
+  char const* obs_fmt_flt = "%-15.4f ";
   for (auto const& obs : obs_) {
     bool is_float =
         std::fabs(obs->rate() - std::round(obs->rate())) > 1E-4;
-    txt_file << format(is_float ? obs_fmt_flt : obs_fmt_int)
-        % obs->rate();
+    AppendFormat(txt, is_float ? obs_fmt_flt : obs_fmt_int, obs->rate());
   }
-  txt_file << "\n";
-  txt_file << dashes << "\n";
+  txt += "\n";
+  txt += dashes + "\n";
 
   unsigned sys_str_len = 14;
   for (auto const& sys : sys_set) {
@@ -616,28 +758,26 @@ void CombineHarvester::WriteDatacard(std::string const& name,
   for (auto const& sys : all_dependents_pars) {
     if (sys.length() > sys_str_len) sys_str_len = sys.length();
   }
-  std::string sys_str_short = boost::lexical_cast<std::string>(sys_str_len);
-  std::string sys_str_long = boost::lexical_cast<std::string>(sys_str_len+9);
+  unsigned sys_str_long = sys_str_len + 9;
 
-  txt_file << format("%-"+sys_str_long+"s") % "bin";
+  AppendPadded(txt, "bin", sys_str_long);
   for (auto const& proc : procs_) {
     if (proc->shape()) {
-      std::unique_ptr<TH1> h = proc->ClonedScaledShape();
-      WriteHistToFile(h.get(), &root_file, mappings, proc->bin(),
-                      proc->process(), proc->mass(), "", 0);
+      write_hist(proc->ClonedScaledShape(), proc->bin(), proc->process(),
+                 proc->mass(), "", 0);
     }
-    txt_file << format("%-15s ") % proc->bin();
+    AppendColumn(txt, proc->bin());
   }
-  txt_file << "\n";
+  txt += "\n";
 
-  txt_file << format("%-"+sys_str_long+"s") % "process";
+  AppendPadded(txt, "process", sys_str_long);
 
   for (auto const& proc : procs_) {
-    txt_file << format("%-15s ") % proc->process();
+    AppendColumn(txt, proc->process());
   }
-  txt_file << "\n";
+  txt += "\n";
 
-  txt_file << format("%-"+sys_str_long+"s") % "process";
+  AppendPadded(txt, "process", sys_str_long);
 
   // Setup process_ids first
   std::map<std::string, int> p_ids;
@@ -655,116 +795,140 @@ void CombineHarvester::WriteDatacard(std::string const& name,
     }
   }
   for (auto const& proc : procs_) {
-    txt_file << format("%-15s ") % p_ids[proc->process()];
+    AppendColumn(txt, std::to_string(p_ids[proc->process()]));
   }
-  txt_file << "\n";
+  txt += "\n";
 
 
-  txt_file << format("%-"+sys_str_long+"s") % "rate";
+  AppendPadded(txt, "rate", sys_str_long);
   for (auto const& proc : procs_) {
-    txt_file << format("%-15.4g ") % proc->no_norm_rate();
+    AppendFormat(txt, "%-15.4g ", proc->no_norm_rate());
   }
-  txt_file << "\n";
-  txt_file << dashes << "\n";
+  txt += "\n";
+  txt += dashes + "\n";
 
   // Need to write parameters here that feature both in the list of pdf
   // dependents and sys_set.
-  for (auto par : params_) {
+  for (auto const& par : params_) {
     Parameter const* p = par.second.get();
     if (p->err_d() != 0.0 && p->err_u() != 0.0 &&
         all_dependents_pars.count(p->name()) && sys_set.count(p->name())) {
-      txt_file << format((format("%%-%is param %%g %%g") % sys_str_len).str()) %
-                      p->name() % p->val() % ((p->err_u() - p->err_d()) / 2.0);
+      AppendPadded(txt, p->name(), sys_str_len);
+      AppendFormat(txt, " param %g %g", p->val(),
+                   (p->err_u() - p->err_d()) / 2.0);
       if (p->range_d() != std::numeric_limits<double>::lowest() &&
           p->range_u() != std::numeric_limits<double>::max()) {
-        txt_file << format(" [%.4g,%.4g]") % p->range_d() % p->range_u();
+        AppendFormat(txt, " [%.4g,%.4g]", p->range_d(), p->range_u());
       }
-      txt_file << "\n";
+      txt += "\n";
     }
   }
 
+  // Sort the (process, systematic) pairs by systematic name in one pass,
+  // keeping them in process order, instead of searching every process for
+  // each name in turn
+  std::unordered_map<std::string, unsigned> sys_idx;
+  for (auto const& sys : sys_set) {
+    sys_idx.insert({sys, unsigned(sys_idx.size())});
+  }
+  std::vector<std::vector<std::pair<unsigned, ch::Systematic const*>>>
+      sys_entries(sys_set.size());
+  for (unsigned p = 0; p < procs_.size(); ++p) {
+    for (unsigned n = 0; n < proc_sys_map[p].size(); ++n) {
+      ch::Systematic const* sys_ptr = proc_sys_map[p][n];
+      sys_entries[sys_idx.at(sys_ptr->name())].push_back({p, sys_ptr});
+    }
+  }
+
+  std::vector<std::string> line(procs_.size());
+  unsigned s = 0;
   for (auto const& sys : sys_set) {
-    std::vector<std::string> line(procs_.size() + 2);
-    line[0] = sys;
     bool seen_lnN = false;
     bool seen_lnU = false;
     bool seen_shape = false;
     bool seen_shapeN2 = false;
-    for (unsigned p = 0; p < procs_.size(); ++p) {
-      line[p+2] = "-";
-      for (unsigned n = 0; n < proc_sys_map[p].size(); ++n) {
-        ch::Systematic const* sys_ptr = proc_sys_map[p][n];
-        if (sys_ptr->name() == sys) {
-          if (sys_ptr->type() == "lnN" || sys_ptr->type() == "lnU") {
-            if (sys_ptr->type() == "lnN") seen_lnN = true;
-            if (sys_ptr->type() == "lnU") seen_lnU = true;
-            line[p + 2] =
-                sys_ptr->asymm()
-                    ? (format("%g/%g") % sys_ptr->value_d() %
-                       sys_ptr->value_u()).str()
-                    : (format("%g") % sys_ptr->value_u()).str();
-            break;
-          }
-          if (sys_ptr->type() == "shape" || sys_ptr->type() == "shapeN2") {
-            if (sys_ptr->type() == "shape") seen_shape = true;
-            if (sys_ptr->type() == "shapeN2") seen_shapeN2 = true;
-            line[p+2] = (format("%g") % sys_ptr->scale()).str();
-            if (sys_ptr->shape_u() && sys_ptr->shape_d()) {
-              bool add_dir = TH1::AddDirectoryStatus();
-              TH1::AddDirectory(false);
-              std::unique_ptr<TH1> h_d = sys_ptr->ClonedShapeD();
-              h_d->Scale(procs_[p]->rate()*sys_ptr->value_d());
-              WriteHistToFile(h_d.get(), &root_file, mappings, sys_ptr->bin(),
-                              sys_ptr->process(), sys_ptr->mass(),
-                              sys_ptr->name(), 1);
-              std::unique_ptr<TH1> h_u = sys_ptr->ClonedShapeU();
-              h_u->Scale(procs_[p]->rate()*sys_ptr->value_u());
-              WriteHistToFile(h_u.get(), &root_file, mappings, sys_ptr->bin(),
-                              sys_ptr->process(), sys_ptr->mass(),
-                              sys_ptr->name(), 2);
-              TH1::AddDirectory(add_dir);
-              break;
-            } else if (sys_ptr->data_u() && sys_ptr->data_d()) {
-            } else {
-              if (!flags_.at("allow-missing-shapes")) {
-                std::stringstream err;
-                err << "Trying to write shape uncertainty with missing "
-                       "shapes:\n";
-                err << Systematic::PrintHeader << *sys_ptr;
-                throw std::runtime_error(FNERROR(err.str()));
-              }
-            }
+    for (auto & col : line) col = "-";
+    // Once an entry is complete the rest for the same process are skipped
+    unsigned p_done = procs_.size();
+    for (auto const& entry : sys_entries[s]) {
+      unsigned p = entry.first;
+      ch::Systematic const* sys_ptr = entry.second;
+      if (p == p_done) continue;
+      if (sys_ptr->type() == "lnN" || sys_ptr->type() == "lnU") {
+        if (sys_ptr->type() == "lnN") seen_lnN = true;
+        if (sys_ptr->type() == "lnU") seen_lnU = true;
+        line[p].clear();
+        if (sys_ptr->asymm()) {
+          AppendFormat(line[p], "%g/%g", sys_ptr->value_d(),
+                       sys_ptr->value_u());
+        } else {
+          AppendFormat(line[p], "%g", sys_ptr->value_u());
+        }
+        p_done = p;
+        continue;
+      }
+      if (sys_ptr->type() == "shape" || sys_ptr->type() == "shapeN2") {
+        if (sys_ptr->type() == "shape") seen_shape = true;
+        if (sys_ptr->type() == "shapeN2") seen_shapeN2 = true;
+        line[p].clear();
+        AppendFormat(line[p], "%g", sys_ptr->scale());
+        // Single-bin shapes are only expanded here, one at a time
+        if (sys_ptr->single_bin() ||
+            (sys_ptr->shape_u() && sys_ptr->shape_d())) {
+          bool add_dir = TH1::AddDirectoryStatus();
+          TH1::AddDirectory(false);
+          std::unique_ptr<TH1> h_d = sys_ptr->ClonedShapeD();
+          h_d->Scale(procs_[p]->rate()*sys_ptr->value_d());
+          write_hist(std::move(h_d), sys_ptr->bin(), sys_ptr->process(),
+                     sys_ptr->mass(), sys_ptr->name(), 1);
+          std::unique_ptr<TH1> h_u = sys_ptr->ClonedShapeU();
+          h_u->Scale(procs_[p]->rate()*sys_ptr->value_u());
+          write_hist(std::move(h_u), sys_ptr->bin(), sys_ptr->process(),
+                     sys_ptr->mass(), sys_ptr->name(), 2);
+          TH1::AddDirectory(add_dir);
+          p_done = p;
+        } else if (sys_ptr->data_u() && sys_ptr->data_d()) {
+        } else {
+          if (!flags_.at("allow-missing-shapes")) {
+            std::stringstream err;
+            err << "Trying to write shape uncertainty with missing "
+                   "shapes:\n";
+            err << Systematic::PrintHeader << *sys_ptr;
+            throw std::runtime_error(FNERROR(err.str()));
           }
         }
       }
     }
+    ++s;
+    char const* type = nullptr;
     if (seen_shapeN2) {
-      line[1] = "shapeN2";
+      type = "shapeN2";
     } else if (seen_lnU) {
-      line[1] = "lnU";
+      type = "lnU";
     } else if (seen_lnN && !seen_shape) {
-      line[1] = "lnN";
+      type = "lnN";
     } else if (!seen_lnN && seen_shape) {
-      line[1] = "shape";
+      type = "shape";
     } else if (seen_lnN && seen_shape) {
-      line[1] = "shape?";
+      type = "shape?";
     } else {
       throw std::runtime_error(FNERROR("Systematic type could not be deduced"));
     }
-    txt_file << format(
-      "%-"+sys_str_short+"s %-7s ")
-      % line[0] % line[1];
-    for (unsigned p = 0; p < procs_.size(); ++p) {
-      txt_file << format("%-15s ") % line[p+2];
+    AppendPadded(txt, sys, sys_str_len);
+    txt += ' ';
+    AppendPadded(txt, type, 7);
+    txt += ' ';
+    for (auto const& col : line) {
+      AppendColumn(txt, col);
     }
-    txt_file << "\n";
+    txt += "\n";
   }
   // write param line for any parameter which has a non-zero error
   // and which doesn't appear in list of nuisances
 
 
   std::set<std::string> ws_vars;
-  for (auto iter : wspaces_) {
+  for (auto const& iter : wspaces_) {
     RooArgSet vars = iter.second->allVars();
     auto v = vars.createIterator();
     do {
@@ -782,20 +946,71 @@ void CombineHarvester::WriteDatacard(std::string const& name,
   //  - it has non-zero errors
   //  - it appears in the first list
   //  - it doesn't appear in the second list
-  for (auto par : params_) {
+  for (auto const& par : params_) {
     Parameter const* p = par.second.get();
     if (p->err_d() != 0.0 && p->err_u() != 0.0 &&
         all_dependents_pars.count(p->name()) && !sys_set.count(p->name())) {
-      txt_file << format((format("%%-%is param %%g %%g") % sys_str_len).str()) %
-                      p->name() % p->val() % ((p->err_u() - p->err_d()) / 2.0);
+      AppendPadded(txt, p->name(), sys_str_len);
+      AppendFormat(txt, " param %g %g", p->val(),
+                   (p->err_u() - p->err_d()) / 2.0);
       if (p->range_d() != std::numeric_limits<double>::lowest() &&
           p->range_u() != std::numeric_limits<double>::max()) {
-        txt_file << format(" [%.4g,%.4g]") % p->range_d() % p->range_u();
+        AppendFormat(txt, " [%.4g,%.4g]", p->range_d(), p->range_u());
       }
-      txt_file << "\n";
+      txt += "\n";
     }
   }
-  txt_file.close();
+
+  // A shapes line can use the shared file only if none of its histograms
+  // conflict with what is already there. The check and the writes must be
+  // done in one go in case other threads are using the same file, although
+  // the result then depends on the order in which the threads get here.
+  std::vector<bool> use_shared(mappings.size(), false);
+  if (shared) {
+    std::vector<std::size_t> hashes(pending.size());
+    for (unsigned i = 0; i < pending.size(); ++i) {
+      hashes[i] = SharedShapes::HistHash(pending[i].hist.get());
+      use_shared[pending[i].mapping] = true;
+    }
+    std::lock_guard<std::mutex> lock(shared->mutex_);
+    for (unsigned i = 0; i < pending.size(); ++i) {
+      if (use_shared[pending[i].mapping] &&
+          !shared->CanShare(pending[i].path, hashes[i],
+                            pending[i].hist.get())) {
+        use_shared[pending[i].mapping] = false;
+      }
+    }
+    for (unsigned i = 0; i < pending.size(); ++i) {
+      if (!use_shared[pending[i].mapping] ||
+          shared->hashes_.count(pending[i].path)) {
+        continue;
+      }
+      WriteToTFile(pending[i].hist.get(), shared->file_.get(),
+                   pending[i].path);
+      shared->hashes_[pending[i].path] = hashes[i];
+    }
+  }
+  for (auto const& entry : pending) {
+    if (use_shared[entry.mapping]) continue;
+    WriteToTFile(entry.hist.get(), &root_file, entry.path);
+  }
+
+  std::string shared_name;
+  if (shared) {
+    shared_name = make_relative(
+        txt_file_path, boost::filesystem::absolute(shared->filename()))
+        .string();
+  }
+  std::string shapes_txt;
+  for (unsigned m = 0; m < mappings.size(); ++m) {
+    shapes_txt += "shapes " + mappings[m].process + " " +
+                  mappings[m].category + " " +
+                  (use_shared[m] ? shared_name : file_name) + " " +
+                  mappings[m].pattern + " " + mappings[m].syst_pattern + "\n";
+  }
+  txt.insert(shapes_pos, shapes_txt);
+  txt_out.write(txt.data(), txt.size());
+  txt_out.close();
 }
 
 void CombineHarvester::WriteHistToFile(
@@ -807,6 +1022,20 @@ void CombineHarvester::WriteHistToFile(
     std::string const& mass,
     std::string const& nuisance,
     unsigned type) {
+  std::string p;
+  if (ResolveHistPath(mappings, bin, process, mass, nuisance, type, p) >= 0) {
+    WriteToTFile(hist, file, p);
+  }
+}
+
+int CombineHarvester::ResolveHistPath(
+    std::vector<HistMapping> const& mappings,
+    std::string const& bin,
+    std::string const& process,
+    std::string const& mass,
+    std::string const& nuisance,
+    unsigned type,
+    std::string & path) {
   StrPairVec attempts = this->GenerateShapeMapAttempts(process, bin);
   for (unsigned a = 0; a < attempts.size(); ++a) {
     for (unsigned m = 0; m < mappings.size(); ++m) {
@@ -819,10 +1048,11 @@ void CombineHarvester::WriteHistToFile(
         boost::replace_all(p, "$MASS", mass);
         if (type == 1) boost::replace_all(p, "$SYSTEMATIC", nuisance+"Down");
         if (type == 2) boost::replace_all(p, "$SYSTEMATIC", nuisance+"Up");
-        WriteToTFile(hist, file, p);
-        return;
+        path = p;
+        return m;
       }
     }
   }
+  return -1;
 }
 }
@@ -6,6 +6,11 @@
 #include <utility>
 #include <set>
 #include <fstream>
+#include <unordered_map>
+#include <algorithm>
+#include <random>
+#include <memory>
+#include <cmath>
 #include "boost/lexical_cast.hpp"
 #include "boost/algorithm/string.hpp"
 #include "boost/range/algorithm_ext/erase.hpp"
@@ -13,6 +18,7 @@
 #include "boost/format.hpp"
 #include "TDirectory.h"
 #include "TH1.h"
+#include "TMatrixDSym.h"
 #include "CombineTools/interface/Observation.h"
 #include "CombineTools/interface/Process.h"
 #include "CombineTools/interface/Systematic.h"
@@ -20,6 +26,7 @@
 #include "CombineTools/interface/MakeUnique.h"
 #include "CombineTools/interface/Utilities.h"
 #include "CombineTools/interface/Algorithm.h"
+#include "CombineTools/interface/Threading.h"
 
 // #include "TMath.h"
 // #include "boost/format.hpp"
@@ -28,12 +35,158 @@
 
 namespace ch {
 
+namespace {
+/**
+ * Draws correlated Gaussian values for the floating parameters of a
+ * RooFitResult, using a Cholesky factorisation of the fit covariance matrix
+ * that is computed once in the constructor
+ *
+ * Only the fit parameters that also appear in `params` are sampled, and each
+ * sampled value is written to the corresponding position in the parameter
+ * vector passed to Sample().
+ */
+class FitSampler {
+ public:
+  FitSampler(RooFitResult const& fit,
+             std::vector<Parameter const*> const& params) {
+    std::map<std::string, unsigned> param_idx;
+    for (unsigned k = 0; k < params.size(); ++k) {
+      param_idx[params[k]->name()] = k;
+    }
+    RooArgList const& floats = fit.floatParsFinal();
+    std::vector<int> fit_idx;
+    for (int i = 0; i < floats.getSize(); ++i) {
+      RooRealVar const* var = dynamic_cast<RooRealVar const*>(floats.at(i));
+      auto it = param_idx.find(var->GetName());
+      if (it == param_idx.end()) continue;
+      fit_idx.push_back(i);
+      idx_.push_back(it->second);
+      mean_.push_back(var->getVal());
+    }
+    // Cholesky-Banachiewicz decomposition of the covariance sub-matrix for
+    // the parameters we actually use. Directions with zero variance are left
+    // with a zero column so that the corresponding parameter stays fixed.
+    unsigned n = idx_.size();
+    TMatrixDSym const& cov = fit.covarianceMatrix();
+    chol_.assign(n * n, 0.);
+    for (unsigned i = 0; i < n; ++i) {
+      for (unsigned j = 0; j <= i; ++j) {
+        double sum = cov(fit_idx[i], fit_idx[j]);
+        for (unsigned k = 0; k < j; ++k) {
+          sum -= chol_[i * n + k] * chol_[j * n + k];
+        }
+        if (i == j) {
+          chol_[i * n + i] = sum > 0. ? std::sqrt(sum) : 0.;
+        } else if (chol_[j * n + j] > 0.) {
+          chol_[i * n + j] = sum / chol_[j * n + j];
+        }
+      }
+    }
+  }
+
+  void Sample(std::mt19937_64& rng, std::vector<double>& z,
+              std::vector<double>& vals) const {
+    unsigned n = idx_.size();
+    std::normal_distribution<double> gaus(0., 1.);
+    z.resize(n);
+    for (unsigned i = 0; i < n; ++i) z[i] = gaus(rng);
+    for (unsigned i = 0; i < n; ++i) {
+      double val = mean_[i];
+      double const* row = &(chol_[i * n]);
+      for (unsigned k = 0; k <= i; ++k) val += row[k] * z[k];
+      vals[idx_[i]] = val;
+    }
+  }
+
+ private:
+  std::vector<unsigned> idx_;
+  std::vector<double> mean_;
+  std::vector<double> chol_;
+};
+
+// One histogram to be rebinned by VariableRebin: the bin contents of `hist`,
+// multiplied by `scale`, optionally with bin `single_bin` set to
+// `single_content` and the result normalised to unity first
+struct RebinJob {
+  RebinJob()
+      : hist(nullptr), scale(1.), single_bin(0), single_content(0.),
+        mapping(0) {}
+  TH1 const* hist;
+  double scale;
+  int single_bin;
+  double single_content;
+  unsigned mapping;
+  std::shared_ptr<TH1 const> owned;
+  std::vector<double> contents;
+  std::vector<double> errors2;
+};
+
+// The old -> new bin mapping applied by TH1::Rebin for variable bin edges,
+// including the underflow (0) and overflow (n + 1) bins. Each old bin goes
+// to the first new bin whose upper edge is at or above its centre, and old
+// bins outside the new range go to the underflow or overflow.
+std::vector<int> RebinMapping(TAxis const* axis,
+                              std::vector<double> const& bins) {
+  int n_old = axis->GetNbins();
+  int n_new = bins.size() - 1;
+  std::vector<int> target(n_old + 2, 0);
+  int old_bin = 1;
+  while (old_bin <= n_old && axis->GetBinCenter(old_bin) < bins.front()) {
+    ++old_bin;
+  }
+  for (int b = 1; b <= n_new; ++b) {
+    while (old_bin <= n_old && axis->GetBinCenter(old_bin) <= bins[b]) {
+      target[old_bin++] = b;
+    }
+  }
+  for (int i = old_bin; i <= n_old + 1; ++i) target[i] = n_new + 1;
+  return target;
+}
+
+// Fills the new contents and squared errors of a RebinJob. The histogram is
+// only read, so different jobs can run concurrently.
+void RebinContents(RebinJob & job, std::vector<int> const& target,
+                   unsigned n_new) {
+  TH1 const* h = job.hist;
+  int n_old = h->GetNbinsX();
+  double scale = job.scale;
+  if (job.single_bin > 0) {
+    double integral = 0.;
+    for (int b = 1; b <= n_old; ++b) {
+      integral += (b == job.single_bin) ? job.single_content
+                                        : h->GetBinContent(b);
+    }
+    if (integral > 0.) scale /= integral;
+  }
+  job.contents.assign(n_new + 2, 0.);
+  job.errors2.assign(n_new + 2, 0.);
+  for (int b = 0; b <= n_old + 1; ++b) {
+    double val = (b == job.single_bin) ? job.single_content
+                                       : h->GetBinContent(b);
+    double err = h->GetBinError(b) * scale;
+    job.contents[target[b]] += val * scale;
+    job.errors2[target[b]] += err * err;
+  }
+}
+}
+
 CombineHarvester::ProcSystMap CombineHarvester::GenerateProcSystMap() {
   ProcSystMap lookup(procs_.size());
+  // Index the Process entries by the hash of their properties so that each
+  // Systematic only has to be compared against the (usually single) Process
+  // with the same hash, instead of against every Process in turn. The index
+  // is rebuilt on each call: the objects are shared between shallow copies
+  // and can be modified in place, so a stored index could go out of date.
+  std::unordered_multimap<std::size_t, unsigned> proc_index;
+  proc_index.reserve(procs_.size());
+  for (unsigned j = 0; j < procs_.size(); ++j) {
+    proc_index.emplace(ProcessHash(*(procs_[j])), j);
+  }
   for (unsigned i = 0; i < systs_.size(); ++i) {
-    for (unsigned j = 0; j < procs_.size(); ++j) {
-      if (MatchingProcess(*(systs_[i]), *(procs_[j]))) {
-        lookup[j].push_back(systs_[i].get());
+    auto range = proc_index.equal_range(ProcessHash(*(systs_[i])));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (MatchingProcess(*(systs_[i]), *(procs_[it->second]))) {
+        lookup[it->second].push_back(systs_[i].get());
       }
     }
   }
@@ -42,14 +195,36 @@ CombineHarvester::ProcSystMap CombineHarvester::GenerateProcSystMap() {
 
 double CombineHarvester::GetUncertainty() {
   auto lookup = GenerateProcSystMap();
+  // Only the processes that depend on a parameter need to be re-evaluated
+  // when it is shifted, as the others cancel in the up-down difference.
+  // Processes with a pdf may depend on any parameter so are always included.
+  std::vector<unsigned> pdf_procs;
+  std::map<std::string, std::vector<unsigned>> param_procs;
+  for (unsigned i = 0; i < procs_.size(); ++i) {
+    if (procs_[i]->pdf()) {
+      pdf_procs.push_back(i);
+      continue;
+    }
+    for (auto sys : lookup[i]) {
+      auto & affected = param_procs[sys->name()];
+      if (affected.empty() || affected.back() != i) affected.push_back(i);
+    }
+  }
+  std::vector<unsigned> no_procs;
   double err_sq = 0.0;
-  for (auto param_it : params_) {
+  for (auto const& param_it : params_) {
+    auto it = param_procs.find(param_it.first);
+    auto const& affected = it != param_procs.end() ? it->second : no_procs;
+    if (affected.empty() && pdf_procs.empty()) continue;
     double backup = param_it.second->val();
+    double diff = 0.0;
     param_it.second->set_val(backup+param_it.second->err_d());
-    double rate_d = this->GetRateInternal(lookup, param_it.first);
+    for (unsigned i : affected) diff -= GetProcRateInternal(i, lookup);
+    for (unsigned i : pdf_procs) diff -= GetProcRateInternal(i, lookup);
     param_it.second->set_val(backup+param_it.second->err_u());
-    double rate_u = this->GetRateInternal(lookup, param_it.first);
-    double err = std::fabs(rate_u-rate_d) / 2.0;
+    for (unsigned i : affected) diff += GetProcRateInternal(i, lookup);
+    for (unsigned i : pdf_procs) diff += GetProcRateInternal(i, lookup);
+    double err = std::fabs(diff) / 2.0;
     err_sq += err * err;
     param_it.second->set_val(backup);
   }
@@ -99,27 +274,106 @@ double CombineHarvester::GetUncertainty(RooFitResult const& fit,
   return std::sqrt(err_sq/double(n_samples));
 }
 
+double CombineHarvester::GetUncertainty(RooFitResult const& fit,
+                                        unsigned n_samples,
+                                        unsigned n_threads, unsigned seed) {
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  if (!CanSampleInParallel(cache)) {
+    FNLOGC(log(), verbosity_ >= 1)
+        << "RooFit-based processes cannot be sampled in parallel, "
+           "using the serial method\n";
+    return GetUncertainty(fit, n_samples);
+  }
+  std::vector<double> nominal(cache.params.size());
+  for (unsigned n = 0; n < nominal.size(); ++n) {
+    nominal[n] = cache.params[n]->val();
+  }
+  double rate = 0.;
+  for (auto const& pc : cache.procs) rate += EvalProcRate(pc, nominal);
+
+  FitSampler sampler(fit, cache.params);
+  n_threads = NumThreads(n_samples, n_threads);
+  std::vector<double> thread_err_sq(n_threads, 0.);
+  RunBlockThreads(n_samples, n_threads,
+                  [&](unsigned t, unsigned first, unsigned last) {
+    std::seed_seq seq{seed, t};
+    std::mt19937_64 rng(seq);
+    std::vector<double> vals = nominal;
+    std::vector<double> z;
+    double err_sq = 0.;
+    for (unsigned i = first; i < last; ++i) {
+      sampler.Sample(rng, z, vals);
+      double rand_rate = 0.;
+      for (auto const& pc : cache.procs) rand_rate += EvalProcRate(pc, vals);
+      double err = rand_rate - rate;
+      err_sq += err * err;
+    }
+    thread_err_sq[t] = err_sq;
+  });
+  double err_sq = 0.;
+  for (unsigned t = 0; t < n_threads; ++t) err_sq += thread_err_sq[t];
+  return std::sqrt(err_sq/double(n_samples));
+}
+
 TH1F CombineHarvester::GetShapeWithUncertainty() {
-  auto lookup = GenerateProcSystMap();
-  TH1F shape = GetShape();
-  for (int i = 1; i <= shape.GetNbinsX(); ++i) {
-    shape.SetBinError(i, 0.0);
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  TH1F shape = GetShapeInternal(cache);
+  unsigned n_bins = shape.GetNbinsX();
+  std::vector<double> vals(cache.params.size());
+  std::map<std::string, unsigned> param_idx;
+  for (unsigned n = 0; n < vals.size(); ++n) {
+    vals[n] = cache.params[n]->val();
+    param_idx[cache.params[n]->name()] = n;
   }
-  for (auto param_it : params_) {
+  std::vector<unsigned> pdf_procs;
+  for (unsigned i = 0; i < cache.procs.size(); ++i) {
+    if (!cache.procs[i].has_hist && cache.procs[i].proc->pdf()) {
+      pdf_procs.push_back(i);
+    }
+  }
+  std::vector<unsigned> no_procs;
+  std::vector<double> err_sq(n_bins, 0.);
+  std::vector<double> diff(n_bins);
+  std::vector<double> work;
+  // Adds weight * (shape of each process in `affected`) to the difference,
+  // re-evaluating only the processes that depend on the shifted parameter
+  auto add_procs = [&](std::vector<unsigned> const& affected, double weight) {
+    for (unsigned i : affected) {
+      if (!cache.procs[i].has_hist) continue;
+      EvalProcShape(cache.procs[i], vals, work);
+      unsigned n = std::min(unsigned(work.size()), n_bins);
+      for (unsigned b = 0; b < n; ++b) diff[b] += weight * work[b];
+    }
+    for (unsigned i : pdf_procs) {
+      TH1F pdf_shape = EvalProcPdfShape(cache.procs[i], vals);
+      unsigned n = std::min(unsigned(pdf_shape.GetNbinsX()), n_bins);
+      for (unsigned b = 0; b < n; ++b) {
+        diff[b] += weight * pdf_shape.GetBinContent(b + 1);
+      }
+    }
+  };
+  for (auto const& param_it : params_) {
+    auto it = param_idx.find(param_it.first);
+    auto const& affected =
+        it != param_idx.end() ? cache.param_procs[it->second] : no_procs;
+    if (affected.empty() && pdf_procs.empty()) continue;
     double backup = param_it.second->val();
+    diff.assign(n_bins, 0.);
     param_it.second->set_val(backup+param_it.second->err_d());
-    TH1F shape_d = this->GetShapeInternal(lookup, param_it.first);
+    if (it != param_idx.end()) vals[it->second] = param_it.second->val();
+    add_procs(affected, -1.);
     param_it.second->set_val(backup+param_it.second->err_u());
-    TH1F shape_u = this->GetShapeInternal(lookup, param_it.first);
-    for (int i = 1; i <= shape.GetNbinsX(); ++i) {
-      double err =
-          std::fabs(shape_u.GetBinContent(i) - shape_d.GetBinContent(i)) / 2.0;
-      shape.SetBinError(i, err*err + shape.GetBinError(i));
-    }
+    if (it != param_idx.end()) vals[it->second] = param_it.second->val();
+    add_procs(affected, +1.);
     param_it.second->set_val(backup);
+    if (it != param_idx.end()) vals[it->second] = backup;
+    for (unsigned b = 0; b < n_bins; ++b) {
+      double err = std::fabs(diff[b]) / 2.0;
+      err_sq[b] += err * err;
+    }
   }
-  for (int i = 1; i <= shape.GetNbinsX(); ++i) {
-    shape.SetBinError(i, std::sqrt(shape.GetBinError(i)));
+  for (unsigned b = 0; b < n_bins; ++b) {
+    shape.SetBinError(b + 1, std::sqrt(err_sq[b]));
   }
   return shape;
 }
@@ -131,8 +385,8 @@ TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const* fit,
 
 TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const& fit,
                                                unsigned n_samples) {
-  auto lookup = GenerateProcSystMap();
-  TH1F shape = GetShapeInternal(lookup);
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  TH1F shape = GetShapeInternal(cache);
   for (int i = 1; i <= shape.GetNbinsX(); ++i) {
     shape.SetBinError(i, 0.0);
   }
@@ -161,7 +415,7 @@ TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const& fit,
       if (p_vec[n]) p_vec[n]->set_val(r_vec[n]->getVal());
     }
 
-    TH1F rand_shape = this->GetShapeInternal(lookup);
+    TH1F rand_shape = this->GetShapeInternal(cache);
     for (int i = 1; i <= shape.GetNbinsX(); ++i) {
       double err =
           std::fabs(rand_shape.GetBinContent(i) - shape.GetBinContent(i));
@@ -175,133 +429,504 @@ TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const& fit,
   return shape;
 }
 
+TH1F CombineHarvester::GetShapeWithUncertainty(RooFitResult const& fit,
+                                               unsigned n_samples,
+                                               unsigned n_threads,
+                                               unsigned seed) {
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  if (!CanSampleInParallel(cache)) {
+    FNLOGC(log(), verbosity_ >= 1)
+        << "RooFit-based processes cannot be sampled in parallel, "
+           "using the serial method\n";
+    return GetShapeWithUncertainty(fit, n_samples);
+  }
+  TH1F shape = GetShapeInternal(cache);
+  std::vector<double> nominal_vals(cache.params.size());
+  for (unsigned n = 0; n < nominal_vals.size(); ++n) {
+    nominal_vals[n] = cache.params[n]->val();
+  }
+  std::vector<double> nominal;
+  std::vector<double> work;
+  EvalTotalShape(cache, nominal_vals, nominal, work);
+  unsigned n_bins = nominal.size();
+
+  FitSampler sampler(fit, cache.params);
+  n_threads = NumThreads(n_samples, n_threads);
+  std::vector<std::vector<double>> thread_err_sq(
+      n_threads, std::vector<double>(n_bins, 0.));
+  RunBlockThreads(n_samples, n_threads,
+                  [&](unsigned t, unsigned first, unsigned last) {
+    std::seed_seq seq{seed, t};
+    std::mt19937_64 rng(seq);
+    std::vector<double> vals = nominal_vals;
+    std::vector<double> z;
+    std::vector<double> total;
+    std::vector<double> proc_work;
+    std::vector<double> & err_sq = thread_err_sq[t];
+    for (unsigned i = first; i < last; ++i) {
+      sampler.Sample(rng, z, vals);
+      EvalTotalShape(cache, vals, total, proc_work);
+      for (unsigned b = 0; b < n_bins; ++b) {
+        double err = total[b] - nominal[b];
+        err_sq[b] += err * err;
+      }
+    }
+  });
+  for (unsigned b = 0; b < n_bins; ++b) {
+    double err_sq = 0.;
+    for (unsigned t = 0; t < n_threads; ++t) err_sq += thread_err_sq[t][b];
+    shape.SetBinError(b + 1, std::sqrt(err_sq / double(n_samples)));
+  }
+  return shape;
+}
+
+std::map<std::string, TH1F> CombineHarvester::GetShapesWithUncertainty(
+    RooFitResult const& fit, unsigned n_samples, unsigned n_threads,
+    unsigned seed) {
+  std::map<std::string, TH1F> result;
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  if (!CanSampleInParallel(cache)) {
+    FNLOGC(log(), verbosity_ >= 1)
+        << "RooFit-based processes cannot be sampled in parallel, "
+           "evaluating each process separately\n";
+    for (auto const& proc : process_set()) {
+      result[proc] = cp().process({proc}).GetShapeWithUncertainty(
+          fit, n_samples);
+    }
+    result["TotalBkg"] = cp().backgrounds().GetShapeWithUncertainty(
+        fit, n_samples);
+    result["TotalSig"] = cp().signals().GetShapeWithUncertainty(
+        fit, n_samples);
+    result["TotalProcs"] = GetShapeWithUncertainty(fit, n_samples);
+    return result;
+  }
+
+  // Each process contributes to the total, to either the total signal or
+  // background, and to the group of processes sharing its name
+  std::vector<std::string> names = {"TotalProcs", "TotalBkg", "TotalSig"};
+  std::map<std::string, unsigned> name_idx;
+  std::vector<std::vector<unsigned>> proc_groups(cache.procs.size());
+  for (unsigned i = 0; i < cache.procs.size(); ++i) {
+    Process const* proc = cache.procs[i].proc;
+    auto it = name_idx.find(proc->process());
+    if (it == name_idx.end()) {
+      it = name_idx.insert({proc->process(), names.size()}).first;
+      names.push_back(proc->process());
+    }
+    proc_groups[i] = {0, proc->signal() ? 2u : 1u, it->second};
+  }
+  unsigned n_groups = names.size();
+
+  // Evaluates every group in one pass over the processes, with `sums` sized
+  // from the first process to contribute to each group
+  auto eval_groups = [&](std::vector<double> const& vals,
+                         std::vector<std::vector<double>>& sums,
+                         std::vector<double>& work) {
+    sums.resize(n_groups);
+    for (auto & sum : sums) sum.clear();
+    for (unsigned i = 0; i < cache.procs.size(); ++i) {
+      if (!cache.procs[i].has_hist) continue;
+      EvalProcShape(cache.procs[i], vals, work);
+      for (unsigned g : proc_groups[i]) {
+        if (sums[g].empty()) sums[g].assign(work.size(), 0.);
+        unsigned n_bins = std::min(sums[g].size(), work.size());
+        for (unsigned b = 0; b < n_bins; ++b) sums[g][b] += work[b];
+      }
+    }
+  };
+
+  std::vector<double> nominal_vals(cache.params.size());
+  for (unsigned n = 0; n < nominal_vals.size(); ++n) {
+    nominal_vals[n] = cache.params[n]->val();
+  }
+  std::vector<std::vector<double>> nominal;
+  std::vector<double> work;
+  eval_groups(nominal_vals, nominal, work);
+
+  FitSampler sampler(fit, cache.params);
+  n_threads = NumThreads(n_samples, n_threads);
+  std::vector<std::vector<std::vector<double>>> thread_err_sq(n_threads);
+  for (auto & err_sq : thread_err_sq) {
+    for (auto const& nom : nominal) {
+      err_sq.push_back(std::vector<double>(nom.size(), 0.));
+    }
+  }
+  RunBlockThreads(n_samples, n_threads,
+                  [&](unsigned t, unsigned first, unsigned last) {
+    std::seed_seq seq{seed, t};
+    std::mt19937_64 rng(seq);
+    std::vector<double> vals = nominal_vals;
+    std::vector<double> z;
+    std::vector<std::vector<double>> sums;
+    std::vector<double> proc_work;
+    auto & err_sq = thread_err_sq[t];
+    for (unsigned i = first; i < last; ++i) {
+      sampler.Sample(rng, z, vals);
+      eval_groups(vals, sums, proc_work);
+      for (unsigned g = 0; g < n_groups; ++g) {
+        unsigned n_bins = std::min(sums[g].size(), nominal[g].size());
+        for (unsigned b = 0; b < n_bins; ++b) {
+          double err = sums[g][b] - nominal[g][b];
+          err_sq[g][b] += err * err;
+        }
+      }
+    }
+  });
+
+  // Histograms take their binning from the first process in each group
+  std::vector<TH1F const*> templates(n_groups, nullptr);
+  for (unsigned i = 0; i < cache.procs.size(); ++i) {
+    if (!cache.procs[i].has_hist) continue;
+    for (unsigned g : proc_groups[i]) {
+      if (!templates[g]) templates[g] = &(cache.procs[i].hist);
+    }
+  }
+  for (unsigned g = 0; g < n_groups; ++g) {
+    TH1F & shape = result[names[g]];
+    if (!templates[g]) continue;
+    templates[g]->Copy(shape);
+    shape.Reset();
+    for (unsigned b = 0; b < nominal[g].size(); ++b) {
+      double err_sq = 0.;
+      for (unsigned t = 0; t < n_threads; ++t) err_sq += thread_err_sq[t][g][b];
+      shape.SetBinContent(b + 1, nominal[g][b]);
+      shape.SetBinError(b + 1, std::sqrt(err_sq / double(n_samples)));
+    }
+  }
+  return result;
+}
+
 double CombineHarvester::GetRate() {
   auto lookup = GenerateProcSystMap();
   return GetRateInternal(lookup);
 }
 
 TH1F CombineHarvester::GetShape() {
-  auto lookup = GenerateProcSystMap();
-  return GetShapeInternal(lookup);
+  auto cache = GenerateShapeCache(GenerateProcSystMap());
+  return GetShapeInternal(cache);
 }
 
-double CombineHarvester::GetRateInternal(ProcSystMap const& lookup,
-    std::string const& single_sys) {
+double CombineHarvester::GetProcRateInternal(unsigned i,
+                                             ProcSystMap const& lookup) {
+  double p_rate = procs_[i]->rate();
+  for (auto sys_it : lookup[i]) {
+    double x = params_[sys_it->name()]->val();
+    if (sys_it->asymm()) {
+      p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
+                             sys_it->value_u());
+    } else {
+      p_rate *= std::pow(sys_it->value_u(), x * sys_it->scale());
+    }
+  }
+  return p_rate;
+}
+
+double CombineHarvester::GetRateInternal(ProcSystMap const& lookup) {
   double rate = 0.0;
-  // TH1F tot_shape
   for (unsigned i = 0; i < procs_.size(); ++i) {
-    double p_rate = procs_[i]->rate();
-    // If we are evaluating the effect of a single parameter
-    // check the list of associated nuisances and skip if
-    // this "single_sys" is not in the list
-    // However - we can't skip if the process has a pdf, as
-    // we haven't checked what the parameters are
-    if (single_sys != "" && !procs_[i]->pdf()) {
-      if (!ch::any_of(lookup[i], [&](Systematic const* sys) {
-        return sys->name() == single_sys;
-      })) continue;
-    }
-    for (auto sys_it : lookup[i]) {
-      double x = params_[sys_it->name()]->val();
-      if (sys_it->asymm()) {
-        p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
-                               sys_it->value_u());
-      } else {
-        p_rate *= std::pow(sys_it->value_u(), x * sys_it->scale());
-      }
-    }
-    rate += p_rate;
+    rate += GetProcRateInternal(i, lookup);
   }
   return rate;
 }
 
-TH1F CombineHarvester::GetShapeInternal(ProcSystMap const& lookup,
-    std::string const& single_sys) {
-  TH1F shape;
-  bool shape_init = false;
+CombineHarvester::ShapeCache CombineHarvester::GenerateShapeCache(
+    ProcSystMap const& lookup) {
+  ShapeCache cache;
+  cache.procs.resize(procs_.size());
+  std::map<std::string, unsigned> param_idx;
 
   for (unsigned i = 0; i < procs_.size(); ++i) {
-    // Might be able to skip if only interested in one nuisance
-    // However - we can't skip if the process has a pdf, as
-    // we haven't checked what the parameters are
-    if (single_sys != "" && !procs_[i]->pdf()) {
-      if (!ch::any_of(lookup[i], [&](Systematic const* sys) {
-        return sys->name() == single_sys;
-      })) continue;
-    }
-
-    double p_rate = procs_[i]->rate();
-    if (procs_[i]->shape() || procs_[i]->data()) {
-      TH1F proc_shape = procs_[i]->ShapeAsTH1F();
-      for (auto sys_it : lookup[i]) {
-        double x = params_[sys_it->name()]->val();
-        if (sys_it->asymm()) {
-          p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
-                                 sys_it->value_u());
-          if (sys_it->type() == "shape" || sys_it->type() == "shapeN2") {
-            bool linear = true;
-            if (sys_it->type() == "shapeN2") linear = false;
-            if (sys_it->shape_u() && sys_it->shape_d()) {
-              ShapeDiff(x * sys_it->scale(), &proc_shape, procs_[i]->shape(),
-                        sys_it->shape_d(), sys_it->shape_u(), linear);
-            }
-            if (sys_it->data_u() && sys_it->data_d()) {
-              RooDataHist const* nom =
-                  dynamic_cast<RooDataHist const*>(procs_[i]->data());
-              if (nom) {
-                ShapeDiff(x * sys_it->scale(), &proc_shape, nom,
-                          sys_it->data_d(), sys_it->data_u());
-              }
-            }
+    Process const* proc = procs_[i].get();
+    ProcShape & pc = cache.procs[i];
+    pc.proc = proc;
+    pc.has_hist = false;
+    if (proc->shape() || proc->data()) {
+      pc.has_hist = true;
+      pc.hist = proc->ShapeAsTH1F();
+      int n_bins = pc.hist.GetNbinsX();
+      pc.nom.resize(n_bins);
+      pc.err.resize(n_bins);
+      for (int b = 0; b < n_bins; ++b) {
+        pc.nom[b] = pc.hist.GetBinContent(b + 1);
+        pc.err[b] = pc.hist.GetBinError(b + 1);
+      }
+    } else if (proc->pdf()) {
+      RooAbsData const* data_obj = FindMatchingData(proc);
+      pc.var_name = "CMS_th1x";
+      if (data_obj) pc.var_name = data_obj->get()->first()->GetName();
+    }
+
+    // Single-bin terms can use the Process template directly if their nominal
+    // is identical to it. This is checked, and the nominal integral found,
+    // once for each distinct nominal.
+    std::map<TH1 const*, std::pair<bool, double>> single_noms;
+    auto single_nom_info = [&](TH1 const* h) {
+      auto it = single_noms.find(h);
+      if (it != single_noms.end()) return it->second;
+      TH1 const* nom = proc->shape();
+      bool same = h->GetNbinsX() == nom->GetNbinsX();
+      for (int b = 1; same && b <= nom->GetNbinsX(); ++b) {
+        same = h->GetBinContent(b) == nom->GetBinContent(b);
+      }
+      return single_noms[h] = std::make_pair(same, h->Integral());
+    };
+
+    pc.terms.resize(lookup[i].size());
+    for (unsigned j = 0; j < lookup[i].size(); ++j) {
+      Systematic const* sys = lookup[i][j];
+      ShapeTerm & term = pc.terms[j];
+      term.sys = sys;
+      auto it = param_idx.find(sys->name());
+      if (it == param_idx.end()) {
+        it = param_idx.insert({sys->name(), cache.params.size()}).first;
+        cache.params.push_back(params_.at(sys->name()).get());
+        cache.param_procs.push_back(std::vector<unsigned>());
+      }
+      term.param = it->second;
+      auto & affected = cache.param_procs[term.param];
+      if (affected.empty() || affected.back() != i) affected.push_back(i);
+      term.scale = sys->scale();
+      term.value_u = sys->value_u();
+      term.value_d = sys->value_d();
+      term.asymm = sys->asymm();
+      term.mode = ShapeTerm::kRateOnly;
+      if (!pc.has_hist || !sys->asymm() ||
+          (sys->type() != "shape" && sys->type() != "shapeN2")) {
+        continue;
+      }
+      unsigned n_bins = pc.nom.size();
+      bool single = sys->single_bin() && sys->type() == "shape" &&
+                    proc->shape() &&
+                    single_nom_info(sys->single_bin_nominal()).first;
+      // Otherwise get each shape once, as single-bin shapes are built on
+      // every call
+      std::shared_ptr<TH1 const> low = single ? nullptr : sys->shape_d();
+      std::shared_ptr<TH1 const> high = single ? nullptr : sys->shape_u();
+      if (single) {
+        TH1 const* nom = proc->shape();
+        if (pc.single_nom.empty()) {
+          pc.single_nom.resize(n_bins);
+          for (unsigned b = 0; b < n_bins; ++b) {
+            pc.single_nom[b] = nom->GetBinContent(b + 1);
+          }
+        }
+        double integral = single_nom_info(sys->single_bin_nominal()).second;
+        unsigned bin = sys->single_bin() - 1;
+        double n = pc.single_nom[bin];
+        double c_u = sys->single_bin_content_u();
+        double c_d = sys->single_bin_content_d();
+        // The templates are normalised to unity, unless the integral is zero
+        double int_u = integral - n + c_u;
+        double int_d = integral - n + c_d;
+        double a_u = int_u > 0. ? 1. / int_u : 1.;
+        double a_d = int_d > 0. ? 1. / int_d : 1.;
+        term.mode = ShapeTerm::kSingleBin;
+        term.bin = bin;
+        term.norm_diff = 0.5 * (a_u - a_d);
+        term.norm_sum = 0.5 * (a_u + a_d) - 1.;
+        term.bin_diff = 0.5 * (a_u * c_u - a_d * c_d) - term.norm_diff * n;
+        term.bin_sum =
+            0.5 * (a_u * c_u + a_d * c_d) - n - term.norm_sum * n;
+      } else if (high && low && proc->shape()) {
+        TH1 const* nom = proc->shape();
+        term.mode = sys->type() == "shapeN2" ? ShapeTerm::kLog
+                                             : ShapeTerm::kLinear;
+        term.half_diff.resize(n_bins);
+        term.half_sum.resize(n_bins);
+        for (unsigned b = 0; b < n_bins; ++b) {
+          double h = high->GetBinContent(b + 1);
+          double l = low->GetBinContent(b + 1);
+          double n = nom->GetBinContent(b + 1);
+          if (term.mode == ShapeTerm::kLog) {
+            h = (h > 0. && n > 0.) ? std::log(h/n) : 0.;
+            l = (l > 0. && n > 0.) ? std::log(l/n) : 0.;
+            n = 0.;
           }
-        } else {
-          p_rate *= std::pow(sys_it->value_u(), x * sys_it->scale());
+          term.half_diff[b] = 0.5 * (h - l);
+          term.half_sum[b] = 0.5 * (h + l) - n;
+        }
+      } else if (sys->data_u() && sys->data_d()) {
+        RooDataHist const* nom = dynamic_cast<RooDataHist const*>(proc->data());
+        if (!nom) continue;
+        RooDataHist const* low = sys->data_d();
+        RooDataHist const* high = sys->data_u();
+        term.mode = ShapeTerm::kLinear;
+        term.half_diff.resize(n_bins);
+        term.half_sum.resize(n_bins);
+        for (unsigned b = 0; b < n_bins; ++b) {
+          high->get(b);
+          low->get(b);
+          nom->get(b);
+          // The RooDataHists are not scaled to unity (unlike in the TH1 case
+          // above) so we have to normalise the bin contents here
+          double h = high->weight() / high->sumEntries();
+          double l = low->weight() / low->sumEntries();
+          double n = nom->weight() / nom->sumEntries();
+          term.half_diff[b] = 0.5 * (h - l);
+          term.half_sum[b] = 0.5 * (h + l) - n;
         }
       }
-      for (int b = 1; b <= proc_shape.GetNbinsX(); ++b) {
-        if (proc_shape.GetBinContent(b) < 0.) proc_shape.SetBinContent(b, 0.);
+    }
+  }
+  return cache;
+}
+
+double CombineHarvester::TermRateFactor(ShapeTerm const& term,
+                                        double x) const {
+  if (term.asymm) {
+    return logKappaForX(x * term.scale, term.value_d, term.value_u);
+  } else {
+    return std::pow(term.value_u, x * term.scale);
+  }
+}
+
+double CombineHarvester::EvalProcShape(ProcShape const& pc,
+                                       std::vector<double> const& vals,
+                                       std::vector<double>& result) const {
+  double p_rate = pc.proc->rate();
+  unsigned n_bins = pc.nom.size();
+  result.assign(pc.nom.begin(), pc.nom.end());
+  // The kSingleBin terms each add a multiple of the nominal to every bin.
+  // These are summed, and only applied before a kLog term or at the end.
+  double norm_shift = 0.;
+  auto apply_norm_shift = [&]() {
+    if (norm_shift == 0.) return;
+    double const* nom = pc.single_nom.data();
+    double *res = result.data();
+    for (unsigned b = 0; b < n_bins; ++b) {
+      res[b] += norm_shift * nom[b];
+    }
+    norm_shift = 0.;
+  };
+  for (auto const& term : pc.terms) {
+    double x = vals[term.param];
+    p_rate *= TermRateFactor(term, x);
+    if (term.mode == ShapeTerm::kRateOnly) continue;
+    double xs = x * term.scale;
+    double fx = smoothStepFunc(xs);
+    if (term.mode == ShapeTerm::kSingleBin) {
+      norm_shift += xs * (term.norm_diff + term.norm_sum * fx);
+      result[term.bin] += xs * (term.bin_diff + term.bin_sum * fx);
+      continue;
+    }
+    if (term.mode == ShapeTerm::kLog) apply_norm_shift();
+    double const* h_diff = term.half_diff.data();
+    double const* h_sum = term.half_sum.data();
+    double *res = result.data();
+    if (term.mode == ShapeTerm::kLinear) {
+      for (unsigned b = 0; b < n_bins; ++b) {
+        res[b] += xs * (h_diff[b] + h_sum[b] * fx);
       }
-      proc_shape.Scale(p_rate);
+    } else {
+      for (unsigned b = 0; b < n_bins; ++b) {
+        double t = res[b] > 0. ? std::log(res[b]) : -999.;
+        res[b] = std::exp(t + xs * (h_diff[b] + h_sum[b] * fx));
+      }
+    }
+  }
+  apply_norm_shift();
+  for (unsigned b = 0; b < n_bins; ++b) {
+    result[b] = result[b] < 0. ? 0. : result[b] * p_rate;
+  }
+  return p_rate;
+}
+
+TH1F CombineHarvester::EvalProcPdfShape(
+    ProcShape const& pc, std::vector<double> const& vals) const {
+  TH1::AddDirectory(false);
+  TH1F *tmp = dynamic_cast<TH1F*>(
+      pc.proc->pdf()->createHistogram(pc.var_name.c_str()));
+  TH1F proc_shape = *tmp;
+  delete tmp;
+  if (!pc.proc->pdf()->selfNormalized()) {
+    if (proc_shape.Integral() > 0.) {
+      proc_shape.Scale(1. / proc_shape.Integral());
+    }
+  }
+  proc_shape.Scale(EvalProcRate(pc, vals));
+  return proc_shape;
+}
+
+double CombineHarvester::EvalProcRate(ProcShape const& pc,
+                                      std::vector<double> const& vals) const {
+  double p_rate = pc.proc->rate();
+  for (auto const& term : pc.terms) {
+    p_rate *= TermRateFactor(term, vals[term.param]);
+  }
+  return p_rate;
+}
+
+void CombineHarvester::EvalTotalShape(ShapeCache const& cache,
+                                      std::vector<double> const& vals,
+                                      std::vector<double>& total,
+                                      std::vector<double>& work) const {
+  bool total_init = false;
+  for (auto const& pc : cache.procs) {
+    if (!pc.has_hist) continue;
+    EvalProcShape(pc, vals, work);
+    if (!total_init) {
+      total.assign(work.size(), 0.);
+      total_init = true;
+    }
+    unsigned n_bins = std::min(total.size(), work.size());
+    for (unsigned b = 0; b < n_bins; ++b) total[b] += work[b];
+  }
+  if (!total_init) total.clear();
+}
+
+bool CombineHarvester::CanSampleInParallel(ShapeCache const& cache) const {
+  return !ch::any_of(cache.procs, [](ProcShape const& pc) {
+    return pc.proc->pdf() || pc.proc->norm();
+  });
+}
+
+TH1F CombineHarvester::GetShapeInternal(ShapeCache const& cache) {
+  TH1F shape;
+  bool shape_init = false;
+  std::vector<double> tot;
+  std::vector<double> tot_err2;
+  std::vector<double> proc_vals;
+
+  std::vector<double> vals(cache.params.size());
+  for (unsigned n = 0; n < vals.size(); ++n) vals[n] = cache.params[n]->val();
+
+  for (auto const& pc : cache.procs) {
+    if (pc.has_hist) {
+      double p_rate = EvalProcShape(pc, vals, proc_vals);
       if (!shape_init) {
-        proc_shape.Copy(shape);
+        pc.hist.Copy(shape);
         shape.Reset();
+        tot.assign(proc_vals.size(), 0.);
+        tot_err2.assign(proc_vals.size(), 0.);
         shape_init = true;
       }
-      shape.Add(&proc_shape);
-    } else if (procs_[i]->pdf()) {
-      RooAbsData const* data_obj = FindMatchingData(procs_[i].get());
-      std::string var_name = "CMS_th1x";
-      if (data_obj) var_name = data_obj->get()->first()->GetName();
-      TH1::AddDirectory(false);
-      TH1F *tmp = dynamic_cast<TH1F*>(
-          procs_[i]->pdf()->createHistogram(var_name.c_str()));
-      TH1F proc_shape = *tmp;
-      delete tmp;
-      if (!procs_[i]->pdf()->selfNormalized()) {
-        // LOGLINE(log(), "Have a pdf that is not selfNormalized");
-        // std::cout << "Integral: " << proc_shape.Integral() << "\n";
-        if (proc_shape.Integral() > 0.) {
-          proc_shape.Scale(1. / proc_shape.Integral());
-        }
-      }
-      for (auto sys_it : lookup[i]) {
-        double x = params_[sys_it->name()]->val();
-        if (sys_it->asymm()) {
-          p_rate *= logKappaForX(x * sys_it->scale(), sys_it->value_d(),
-                                 sys_it->value_u());
-        } else {
-          p_rate *= std::pow(sys_it->value_u(), x * sys_it->scale());
-        }
+      unsigned n_bins = std::min(tot.size(), proc_vals.size());
+      for (unsigned b = 0; b < n_bins; ++b) {
+        tot[b] += proc_vals[b];
+        double err = pc.err[b] * p_rate;
+        tot_err2[b] += err * err;
       }
-      proc_shape.Scale(p_rate);
+    } else if (pc.proc->pdf()) {
+      TH1F proc_shape = EvalProcPdfShape(pc, vals);
       if (!shape_init) {
         proc_shape.Copy(shape);
         shape.Reset();
+        tot.assign(proc_shape.GetNbinsX(), 0.);
+        tot_err2.assign(proc_shape.GetNbinsX(), 0.);
         shape_init = true;
       }
-      shape.Add(&proc_shape);
+      unsigned n_bins = std::min(int(tot.size()), proc_shape.GetNbinsX());
+      for (unsigned b = 0; b < n_bins; ++b) {
+        tot[b] += proc_shape.GetBinContent(b + 1);
+        double err = proc_shape.GetBinError(b + 1);
+        tot_err2[b] += err * err;
+      }
     }
   }
+  for (unsigned b = 0; b < tot.size(); ++b) {
+    shape.SetBinContent(b + 1, tot[b]);
+    shape.SetBinError(b + 1, std::sqrt(tot_err2[b]));
+  }
   return shape;
 }
 
@@ -341,52 +966,6 @@ TH1F CombineHarvester::GetObservedShape() {
   return shape;
 }
 
-void CombineHarvester::ShapeDiff(double x,
-    TH1F * target,
-    TH1 const* nom,
-    TH1 const* low,
-    TH1 const* high,
-    bool linear) {
-  double fx = smoothStepFunc(x);
-  for (int i = 1; i <= target->GetNbinsX(); ++i) {
-    float h = high->GetBinContent(i);
-    float l = low->GetBinContent(i);
-    float n = nom->GetBinContent(i);
-    if (!linear) {
-      float t = target->GetBinContent(i);
-      target->SetBinContent(i, t > 0. ? std::log(t) : -999.);
-      h = (h > 0. && n > 0.) ? std::log(h/n) : 0.;
-      l = (l > 0. && n > 0.) ? std::log(l/n) : 0.;
-      target->SetBinContent(i, target->GetBinContent(i) +
-                                   0.5 * x * ((h - l) + (h + l) * fx));
-      target->SetBinContent(i, std::exp(target->GetBinContent(i)));
-    } else {
-      target->SetBinContent(i, target->GetBinContent(i) +
-                                   0.5 * x * ((h - l) + (h + l - 2. * n) * fx));
-    }
-  }
-}
-
-void CombineHarvester::ShapeDiff(double x,
-    TH1F * target,
-    RooDataHist const* nom,
-    RooDataHist const* low,
-    RooDataHist const* high) {
-  double fx = smoothStepFunc(x);
-  for (int i = 1; i <= target->GetNbinsX(); ++i) {
-    high->get(i-1);
-    low->get(i-1);
-    nom->get(i-1);
-    // The RooDataHists are not scaled to unity (unlike in the TH1 case above)
-    // so we have to normalise the bin contents on the fly
-    float h = high->weight() / high->sumEntries();
-    float l = low->weight() / low->sumEntries();
-    float n = nom->weight() / nom->sumEntries();
-    target->SetBinContent(i, target->GetBinContent(i) +
-                                 0.5 * x * ((h - l) + (h + l - 2. * n) * fx));
-  }
-}
-
 // void CombineHarvester::SetParameters(std::vector<ch::Parameter> params) {
 //   params_.clear();
 //   for (unsigned i = 0; i < params.size(); ++i) {
@@ -471,64 +1050,161 @@ std::vector<ch::Parameter> CombineHarvester::GetParameters() const {
 }
 
 void CombineHarvester::VariableRebin(std::vector<double> bins) {
+  VariableRebin(bins, 1);
+}
+
+void CombineHarvester::VariableRebin(std::vector<double> bins,
+                                     unsigned n_threads) {
+  if (bins.size() < 2) return;
+  unsigned n_new = bins.size() - 1;
   // We need to keep a record of the Process rates before we rebin. The
   // reasoning comes from the following scenario: the user might choose a new
   // binning which excludes some of the existing bins - thus changing the
   // process normalisation. This is fine, but we also need to adjust the shape
   // Systematic entries - both the rebinning and the adjustment of the value_u
   // and value_d shifts.
-  std::vector<double> prev_proc_rates(procs_.size());
-
-  // Also hold on the scaled Process hists *after* the rebinning is done - these
-  // are needed to update the associated Systematic entries
-  std::vector<std::unique_ptr<TH1>> scaled_procs(procs_.size());
-
+  //
+  // Every histogram is rebinned by summing its (scaled) bin contents
+  // according to a mapping that is found once per distinct input binning.
+  // Each output is a copy of a rebinned template histogram made once per
+  // binning and histogram class.
+  std::vector<RebinJob> jobs;
+  jobs.reserve(procs_.size() + obs_.size() + 2 * systs_.size());
+  std::vector<int> proc_job(procs_.size(), -1);
   for (unsigned i = 0; i < procs_.size(); ++i) {
-    if (procs_[i]->shape()) {
-      // Get the scaled shape here
-      std::unique_ptr<TH1> copy(procs_[i]->ClonedScaledShape());
-      // shape norm should only be "no_norm_rate"
-      prev_proc_rates[i] = procs_[i]->no_norm_rate();
-      std::unique_ptr<TH1> copy2(copy->Rebin(bins.size()-1, "", &(bins[0])));
-      // The process shape & rate will be reset here
-      procs_[i]->set_shape(std::move(copy2), true);
-      scaled_procs[i] = procs_[i]->ClonedScaledShape();
-    }
+    if (!procs_[i]->shape()) continue;
+    proc_job[i] = jobs.size();
+    RebinJob job;
+    job.hist = procs_[i]->shape();
+    // shape norm should only be "no_norm_rate"
+    job.scale = procs_[i]->no_norm_rate();
+    jobs.push_back(job);
   }
+  std::vector<int> obs_job(obs_.size(), -1);
   for (unsigned i = 0; i < obs_.size(); ++i) {
-    if (obs_[i]->shape()) {
-      std::unique_ptr<TH1> copy(obs_[i]->ClonedScaledShape());
-      std::unique_ptr<TH1> copy2(copy->Rebin(bins.size()-1, "", &(bins[0])));
-      obs_[i]->set_shape(std::move(copy2), true);
-    }
+    if (!obs_[i]->shape()) continue;
+    obs_job[i] = jobs.size();
+    RebinJob job;
+    job.hist = obs_[i]->shape();
+    job.scale = obs_[i]->rate();
+    jobs.push_back(job);
   }
+
+  // The parent Process of each Systematic is found through the same hashed
+  // index as GenerateProcSystMap. If there are several matches the last
+  // one is used.
+  std::unordered_multimap<std::size_t, unsigned> proc_index;
+  proc_index.reserve(procs_.size());
+  for (unsigned j = 0; j < procs_.size(); ++j) {
+    proc_index.emplace(ProcessHash(*(procs_[j])), j);
+  }
+  std::vector<int> syst_parent(systs_.size(), -1);
+  std::vector<int> syst_job(systs_.size(), -1);
   for (unsigned i = 0; i < systs_.size(); ++i) {
-    TH1 const* proc_hist = nullptr;
-    double prev_rate = 0.;
-    for (unsigned j = 0; j < procs_.size(); ++j) {
-      if (MatchingProcess(*(procs_[j]), *(systs_[i].get()))) {
-        proc_hist = scaled_procs[j].get();
-        prev_rate = prev_proc_rates[j];
+    Systematic const* sys = systs_[i].get();
+    auto range = proc_index.equal_range(ProcessHash(*sys));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (int(it->second) > syst_parent[i] &&
+          MatchingProcess(*(procs_[it->second]), *sys)) {
+        syst_parent[i] = it->second;
       }
     }
-    if (systs_[i]->shape_u() && systs_[i]->shape_d()) {
-      // These hists will be normalised to unity
-      std::unique_ptr<TH1> copy_u(systs_[i]->ClonedShapeU());
-      std::unique_ptr<TH1> copy_d(systs_[i]->ClonedShapeD());
-
-      // If we found a matching Process we will scale this back up to their
-      // initial rates
-      if (proc_hist) {
-        copy_u->Scale(systs_[i]->value_u() * prev_rate);
-        copy_d->Scale(systs_[i]->value_d() * prev_rate);
+    bool single = sys->single_bin();
+    if (!single && !(sys->shape_u() && sys->shape_d())) continue;
+    syst_job[i] = jobs.size();
+    // These hists are normalised to unity. If we found a matching Process
+    // with a shape they are scaled back up to their initial rates.
+    int parent = syst_parent[i];
+    bool scale = parent >= 0 && procs_[parent]->shape();
+    double prev_rate = scale ? procs_[parent]->no_norm_rate() : 0.;
+    for (bool up : {true, false}) {
+      RebinJob job;
+      if (single) {
+        job.hist = sys->single_bin_nominal();
+        job.single_bin = sys->single_bin();
+        job.single_content = up ? sys->single_bin_content_u()
+                                : sys->single_bin_content_d();
+      } else {
+        // Holding the shape keeps it alive if it is lazily-loaded and
+        // released when another one is loaded
+        job.owned = up ? sys->shape_u() : sys->shape_d();
+        job.hist = job.owned.get();
       }
-      std::unique_ptr<TH1> copy2_u(
-          copy_u->Rebin(bins.size() - 1, "", &(bins[0])));
-      std::unique_ptr<TH1> copy2_d(
-          copy_d->Rebin(bins.size() - 1, "", &(bins[0])));
-      // If we have proc_hist != nullptr, set_shapes will re-calculate value_u
-      // and value_d for us, before scaling the new hists back to unity
-      systs_[i]->set_shapes(std::move(copy2_u), std::move(copy2_d), proc_hist);
+      job.scale = scale ? (up ? sys->value_u() : sys->value_d()) * prev_rate
+                        : 1.;
+      jobs.push_back(job);
+    }
+  }
+
+  std::map<std::vector<double>, unsigned> binning_idx;
+  std::vector<std::vector<int>> mappings;
+  std::vector<double> edges;
+  for (auto & job : jobs) {
+    TAxis const* axis = job.hist->GetXaxis();
+    int n_old = axis->GetNbins();
+    edges.resize(n_old + 1);
+    for (int b = 1; b <= n_old; ++b) edges[b - 1] = axis->GetBinLowEdge(b);
+    edges[n_old] = axis->GetBinUpEdge(n_old);
+    auto it = binning_idx.find(edges);
+    if (it == binning_idx.end()) {
+      it = binning_idx.emplace(edges, mappings.size()).first;
+      mappings.push_back(RebinMapping(axis, bins));
+    }
+    job.mapping = it->second;
+  }
+
+  unsigned n_run = NumThreads(jobs.size(), n_threads);
+  auto run_jobs = [&](unsigned, unsigned first, unsigned last) {
+    for (unsigned i = first; i < last; ++i) {
+      RebinContents(jobs[i], mappings[jobs[i].mapping], n_new);
+    }
+  };
+  RunBlockThreads(jobs.size(), n_run, run_jobs);
+
+  std::map<std::pair<unsigned, TClass*>, std::unique_ptr<TH1>> templates;
+  auto make_hist = [&](RebinJob const& job) {
+    auto & tmpl = templates[std::make_pair(job.mapping, job.hist->IsA())];
+    if (!tmpl) {
+      std::unique_ptr<TH1> copy(static_cast<TH1 *>(job.hist->Clone()));
+      copy->SetDirectory(0);
+      tmpl.reset(copy->Rebin(n_new, "", &(bins[0])));
+      tmpl->SetDirectory(0);
+      tmpl->Reset();
+      if (!tmpl->GetSumw2N()) tmpl->Sumw2();
+    }
+    std::unique_ptr<TH1> res(static_cast<TH1 *>(tmpl->Clone()));
+    res->SetDirectory(0);
+    for (unsigned b = 0; b < n_new + 2; ++b) {
+      res->SetBinContent(b, job.contents[b]);
+      res->SetBinError(b, std::sqrt(job.errors2[b]));
+    }
+    res->SetEntries(job.hist->GetEntries());
+    return res;
+  };
+
+  for (unsigned i = 0; i < procs_.size(); ++i) {
+    if (proc_job[i] < 0) continue;
+    // The process shape & rate will be reset here
+    procs_[i]->set_shape(make_hist(jobs[proc_job[i]]), true);
+  }
+  for (unsigned i = 0; i < obs_.size(); ++i) {
+    if (obs_job[i] < 0) continue;
+    obs_[i]->set_shape(make_hist(jobs[obs_job[i]]), true);
+  }
+  for (unsigned i = 0; i < systs_.size(); ++i) {
+    if (syst_job[i] < 0) continue;
+    std::unique_ptr<TH1> copy_u = make_hist(jobs[syst_job[i]]);
+    std::unique_ptr<TH1> copy_d = make_hist(jobs[syst_job[i] + 1]);
+    double integral_u = copy_u->Integral();
+    double integral_d = copy_d->Integral();
+    systs_[i]->set_shapes(std::move(copy_u), std::move(copy_d), nullptr);
+    // If we have a matching Process with a shape we re-calculate value_u and
+    // value_d from its new rate
+    int parent = syst_parent[i];
+    if (parent >= 0 && proc_job[parent] >= 0 &&
+        procs_[parent]->no_norm_rate() > 0.) {
+      systs_[i]->set_value_u(integral_u / procs_[parent]->no_norm_rate());
+      systs_[i]->set_value_d(integral_d / procs_[parent]->no_norm_rate());
     }
   }
 }
@@ -12,9 +12,9 @@ namespace ch {
 
 CombineHarvester& CombineHarvester::bin(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::bin), cond);
-  FilterContaining(obs_, vec, std::mem_fn(&Observation::bin), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::bin), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::bin), cond);
+  FilterContainingInterned(obs_, vec, std::mem_fn(&Observation::bin), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::bin), cond);
   return *this;
 }
 
@@ -28,8 +28,8 @@ CombineHarvester& CombineHarvester::bin_id(
 
 CombineHarvester& CombineHarvester::process(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::process), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::process), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::process), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::process), cond);
   return *this;
 }
 
@@ -42,33 +42,33 @@ CombineHarvester& CombineHarvester::process_rgx(
 
 CombineHarvester& CombineHarvester::analysis(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::analysis), cond);
-  FilterContaining(obs_, vec, std::mem_fn(&Observation::analysis), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::analysis), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::analysis), cond);
+  FilterContainingInterned(obs_, vec, std::mem_fn(&Observation::analysis), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::analysis), cond);
   return *this;
 }
 
 CombineHarvester& CombineHarvester::era(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::era), cond);
-  FilterContaining(obs_, vec, std::mem_fn(&Observation::era), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::era), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::era), cond);
+  FilterContainingInterned(obs_, vec, std::mem_fn(&Observation::era), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::era), cond);
   return *this;
 }
 
 CombineHarvester& CombineHarvester::channel(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::channel), cond);
-  FilterContaining(obs_, vec, std::mem_fn(&Observation::channel), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::channel), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::channel), cond);
+  FilterContainingInterned(obs_, vec, std::mem_fn(&Observation::channel), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::channel), cond);
   return *this;
 }
 
 CombineHarvester& CombineHarvester::mass(
     std::vector<std::string> const& vec, bool cond) {
-  FilterContaining(procs_, vec, std::mem_fn(&Process::mass), cond);
-  FilterContaining(obs_, vec, std::mem_fn(&Observation::mass), cond);
-  FilterContaining(systs_, vec, std::mem_fn(&Systematic::mass), cond);
+  FilterContainingInterned(procs_, vec, std::mem_fn(&Process::mass), cond);
+  FilterContainingInterned(obs_, vec, std::mem_fn(&Observation::mass), cond);
+  FilterContainingInterned(systs_, vec, std::mem_fn(&Systematic::mass), cond);
   return *this;
 }
 
@@ -85,44 +85,44 @@ CombineHarvester& CombineHarvester::syst_type(
 }
 
 CombineHarvester & CombineHarvester::signals() {
-  ch::erase_if(systs_, [&] (std::shared_ptr<Systematic> val) {
+  ch::erase_if(systs_, [&] (std::shared_ptr<Systematic> const& val) {
     return !val->signal();
   });
-  ch::erase_if(procs_, [&] (std::shared_ptr<Process> val) {
+  ch::erase_if(procs_, [&] (std::shared_ptr<Process> const& val) {
     return !val->signal();
   });
   return *this;
 }
 
 CombineHarvester & CombineHarvester::backgrounds() {
-  ch::erase_if(systs_, [&] (std::shared_ptr<Systematic> val) {
+  ch::erase_if(systs_, [&] (std::shared_ptr<Systematic> const& val) {
     return val->signal();
   });
-  ch::erase_if(procs_, [&] (std::shared_ptr<Process> val) {
+  ch::erase_if(procs_, [&] (std::shared_ptr<Process> const& val) {
     return val->signal();
   });
   return *this;
 }
 
 CombineHarvester & CombineHarvester::histograms() {
-  ch::erase_if(obs_, [&] (std::shared_ptr<Observation> val) {
+  ch::erase_if(obs_, [&] (std::shared_ptr<Observation> const& val) {
     return val->shape() == nullptr;
   });
-  ch::erase_if(procs_, [&] (std::shared_ptr<Process> val) {
+  ch::erase_if(procs_, [&] (std::shared_ptr<Process> const& val) {
     return val->shape() == nullptr;
   });
   return *this;
 }
 
 CombineHarvester & CombineHarvester::pdfs() {
-  ch::erase_if(procs_, [&] (std::shared_ptr<Process> val) {
+  ch::erase_if(procs_, [&] (std::shared_ptr<Process> const& val) {
     return val->pdf() == nullptr;
   });
   return *this;
 }
 
 CombineHarvester & CombineHarvester::data() {
-  ch::erase_if(obs_, [&] (std::shared_ptr<Observation> val) {
+  ch::erase_if(obs_, [&] (std::shared_ptr<Observation> const& val) {
     return val->data() == nullptr;
   });
   return *this;
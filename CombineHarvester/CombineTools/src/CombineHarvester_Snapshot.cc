@@ -0,0 +1,521 @@
+#include "CombineTools/interface/CombineHarvester.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include "boost/lexical_cast.hpp"
+#include "TFile.h"
+#include "TH1.h"
+#include "RooWorkspace.h"
+#include "RooRealVar.h"
+#include "RooAbsPdf.h"
+#include "RooAbsData.h"
+#include "RooDataHist.h"
+#include "CombineTools/interface/Observation.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+#include "CombineTools/interface/Parameter.h"
+#include "CombineTools/interface/MakeUnique.h"
+#include "CombineTools/interface/Logging.h"
+#include "CombineTools/interface/TFileIO.h"
+
+namespace ch {
+
+namespace {
+// Snapshot layout (all values in native byte order):
+//   header:     "CHSNAP" + uint32 version
+//   flags:      uint32 n, then n x (string name, uint8 value)
+//   workspaces: string companion file, uint32 n, then n x (string name)
+//   params:     uint32 n, then n x (string name, 5 x double, uint32 n_vars,
+//               n_vars x workspace ref)
+//   obs:        uint32 n, then n x (object, double rate, hist, ws ref data)
+//   procs:      uint32 n, then n x (object, double rate, hist, ws ref pdf,
+//               ws ref data, ws ref norm)
+//   nominals:   uint32 n, then n x hist
+//   systs:      uint32 n, then n x (object, string name, string type,
+//               3 x double, uint8 asymm, uint8 kind, shapes, ws ref u,
+//               ws ref d)
+// where strings are written as uint32 length + bytes, a workspace ref is
+// uint32 workspace index (kNoWorkspace for none) + string object name and
+// a hist is uint8 type (0 = none, 1 = TH1F, 2 = TH1D) + string name +
+// int32 n_bins + uint8 fixed + binning + (n_bins + 2) contents + uint8 sumw2
+// + (n_bins + 2) squared errors if sumw2 is set. The binning is xmin and
+// xmax for fixed-width bins, otherwise the (n_bins + 1) edges.
+//
+// The nominals are the TH1s shared by the single-bin shapes of the
+// Systematic entries (see Systematic::set_single_bin_shapes), each written
+// once. The shapes of a Systematic are hist u + hist d if kind is 0, or if it
+// is 1, uint32 nominal index + int32 bin + 2 x double for the up and down
+// contents of that bin.
+//
+// Version 1 files, which have no fixed flag and always store the edges, and
+// version 2 files, which have no nominals or kind and always store hist u +
+// hist d, can still be read.
+char const kSnapshotMagic[6] = {'C', 'H', 'S', 'N', 'A', 'P'};
+uint32_t const kSnapshotVersion = 3;
+uint32_t const kNoWorkspace = std::numeric_limits<uint32_t>::max();
+
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(std::ofstream & out) : out_(out) {}
+
+  template <class T>
+  void Write(T const& val) {
+    out_.write(reinterpret_cast<char const*>(&val), sizeof(T));
+  }
+
+  void Write(std::string const& str) {
+    Write(uint32_t(str.size()));
+    out_.write(str.data(), str.size());
+  }
+
+  void Write(std::vector<double> const& vec) {
+    out_.write(reinterpret_cast<char const*>(vec.data()),
+               vec.size() * sizeof(double));
+  }
+
+  void Write(Object const& obj) {
+    Write(obj.bin());
+    Write(obj.process());
+    Write(uint8_t(obj.signal()));
+    Write(obj.analysis());
+    Write(obj.era());
+    Write(obj.channel());
+    Write(int32_t(obj.bin_id()));
+    Write(obj.mass());
+  }
+
+  void Write(TH1 const* h) {
+    uint8_t type = 0;
+    if (h) type = h->InheritsFrom("TH1F") ? 1 : 2;
+    Write(type);
+    if (!h) return;
+    int n_bins = h->GetNbinsX();
+    Write(std::string(h->GetName()));
+    Write(int32_t(n_bins));
+    bool fixed = !h->GetXaxis()->IsVariableBinSize();
+    Write(uint8_t(fixed));
+    std::vector<double> vals;
+    if (fixed) {
+      vals = {h->GetXaxis()->GetXmin(), h->GetXaxis()->GetXmax()};
+    } else {
+      vals.resize(n_bins + 1);
+      for (int i = 0; i <= n_bins; ++i) vals[i] = h->GetBinLowEdge(i + 1);
+    }
+    Write(vals);
+    vals.resize(n_bins + 2);
+    for (int i = 0; i <= n_bins + 1; ++i) vals[i] = h->GetBinContent(i);
+    Write(vals);
+    bool sumw2 = h->GetSumw2N() > 0;
+    Write(uint8_t(sumw2));
+    if (!sumw2) return;
+    for (int i = 0; i <= n_bins + 1; ++i) {
+      vals[i] = h->GetBinError(i) * h->GetBinError(i);
+    }
+    Write(vals);
+  }
+
+  void WriteRef(std::pair<uint32_t, std::string> const& ref) {
+    Write(ref.first);
+    Write(ref.second);
+  }
+
+ private:
+  std::ofstream & out_;
+};
+
+class SnapshotReader {
+ public:
+  SnapshotReader(std::ifstream & in, std::string const& filename)
+      : in_(in), filename_(filename), version_(kSnapshotVersion) {}
+
+  void SetVersion(uint32_t version) { version_ = version; }
+
+  template <class T>
+  T Read() {
+    T val;
+    Check(in_.read(reinterpret_cast<char *>(&val), sizeof(T)));
+    return val;
+  }
+
+  std::string ReadString() {
+    std::string str(Read<uint32_t>(), '\0');
+    if (str.size()) Check(in_.read(&str[0], str.size()));
+    return str;
+  }
+
+  void ReadVector(std::vector<double> & vec, unsigned n) {
+    vec.resize(n);
+    if (n) {
+      Check(in_.read(reinterpret_cast<char *>(vec.data()),
+                     n * sizeof(double)));
+    }
+  }
+
+  void ReadObject(Object * obj) {
+    obj->set_bin(ReadString());
+    obj->set_process(ReadString());
+    obj->set_signal(Read<uint8_t>());
+    obj->set_analysis(ReadString());
+    obj->set_era(ReadString());
+    obj->set_channel(ReadString());
+    obj->set_bin_id(Read<int32_t>());
+    obj->set_mass(ReadString());
+  }
+
+  std::unique_ptr<TH1> ReadHist() {
+    uint8_t type = Read<uint8_t>();
+    if (type == 0) return std::unique_ptr<TH1>();
+    std::string name = ReadString();
+    int n_bins = Read<int32_t>();
+    bool fixed = version_ >= 2 ? Read<uint8_t>() : false;
+    std::vector<double> vals;
+    ReadVector(vals, fixed ? 2 : n_bins + 1);
+    std::unique_ptr<TH1> h;
+    bool add_status = TH1::AddDirectoryStatus();
+    TH1::AddDirectory(false);
+    if (type == 1 && fixed) {
+      h = std::unique_ptr<TH1>(
+          new TH1F(name.c_str(), name.c_str(), n_bins, vals[0], vals[1]));
+    } else if (type == 1) {
+      h = std::unique_ptr<TH1>(
+          new TH1F(name.c_str(), name.c_str(), n_bins, vals.data()));
+    } else if (fixed) {
+      h = std::unique_ptr<TH1>(
+          new TH1D(name.c_str(), name.c_str(), n_bins, vals[0], vals[1]));
+    } else {
+      h = std::unique_ptr<TH1>(
+          new TH1D(name.c_str(), name.c_str(), n_bins, vals.data()));
+    }
+    TH1::AddDirectory(add_status);
+    ReadVector(vals, n_bins + 2);
+    for (int i = 0; i <= n_bins + 1; ++i) h->SetBinContent(i, vals[i]);
+    if (Read<uint8_t>()) {
+      ReadVector(vals, n_bins + 2);
+      for (int i = 0; i <= n_bins + 1; ++i) {
+        h->SetBinError(i, std::sqrt(vals[i]));
+      }
+    }
+    return h;
+  }
+
+  std::pair<uint32_t, std::string> ReadRef() {
+    uint32_t idx = Read<uint32_t>();
+    return std::make_pair(idx, ReadString());
+  }
+
+ private:
+  void Check(std::istream const& in) const {
+    if (!in) {
+      throw std::runtime_error(
+          FNERROR("Snapshot file " + filename_ + " is truncated or corrupt"));
+    }
+  }
+  std::ifstream & in_;
+  std::string filename_;
+  uint32_t version_;
+};
+}
+
+void CombineHarvester::SaveSnapshot(std::string const& filename) {
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    throw std::runtime_error(
+        FNERROR("File " + filename + " could not be opened"));
+  }
+  SnapshotWriter w(out);
+  out.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+  w.Write(kSnapshotVersion);
+
+  w.Write(uint32_t(flags_.size()));
+  for (auto const& it : flags_) {
+    w.Write(it.first);
+    w.Write(uint8_t(it.second));
+  }
+
+  // The workspaces are written to a companion ROOT file and all RooFit
+  // objects are stored by reference: the index of the workspace holding the
+  // object, and the name of the object within it
+  std::vector<RooWorkspace const*> ws_vec;
+  std::string ws_file;
+  if (wspaces_.size()) {
+    ws_file = filename + ".ws.root";
+    TFile file(ws_file.c_str(), "RECREATE");
+    for (auto const& it : wspaces_) {
+      ch::WriteToTFile(it.second.get(), &file, it.first);
+      ws_vec.push_back(it.second.get());
+    }
+    file.Close();
+    std::size_t slash = ws_file.find_last_of('/');
+    if (slash != ws_file.npos) ws_file = ws_file.substr(slash + 1);
+  }
+  w.Write(ws_file);
+  w.Write(uint32_t(wspaces_.size()));
+  for (auto const& it : wspaces_) w.Write(it.first);
+
+  auto arg_ref = [&](RooAbsArg const* arg) {
+    if (arg) {
+      for (unsigned i = 0; i < ws_vec.size(); ++i) {
+        if (ws_vec[i]->arg(arg->GetName()) == arg) {
+          return std::make_pair(uint32_t(i), std::string(arg->GetName()));
+        }
+      }
+    }
+    return std::make_pair(kNoWorkspace, std::string());
+  };
+  auto data_ref = [&](RooAbsData const* data) {
+    if (data) {
+      for (unsigned i = 0; i < ws_vec.size(); ++i) {
+        if (ws_vec[i]->data(data->GetName()) == data) {
+          return std::make_pair(uint32_t(i), std::string(data->GetName()));
+        }
+      }
+    }
+    return std::make_pair(kNoWorkspace, std::string());
+  };
+
+  w.Write(uint32_t(params_.size()));
+  for (auto const& it : params_) {
+    Parameter & par = *(it.second);
+    w.Write(par.name());
+    w.Write(par.val());
+    w.Write(par.err_u());
+    w.Write(par.err_d());
+    w.Write(par.range_u());
+    w.Write(par.range_d());
+    w.Write(uint32_t(par.vars().size()));
+    for (auto var : par.vars()) w.WriteRef(arg_ref(var));
+  }
+
+  w.Write(uint32_t(obs_.size()));
+  for (auto const& obs : obs_) {
+    w.Write(static_cast<Object const&>(*obs));
+    w.Write(obs->rate());
+    w.Write(obs->shape());
+    w.WriteRef(data_ref(obs->data()));
+  }
+
+  w.Write(uint32_t(procs_.size()));
+  for (auto const& proc : procs_) {
+    w.Write(static_cast<Object const&>(*proc));
+    w.Write(proc->no_norm_rate());
+    w.Write(proc->shape());
+    w.WriteRef(arg_ref(proc->pdf()));
+    w.WriteRef(data_ref(proc->data()));
+    w.WriteRef(arg_ref(proc->norm()));
+  }
+
+  std::map<TH1 const*, uint32_t> nominal_idx;
+  std::vector<TH1 const*> nominals;
+  for (auto const& sys : systs_) {
+    TH1 const* nom = sys->single_bin_nominal();
+    if (nom && !nominal_idx.count(nom)) {
+      nominal_idx[nom] = nominals.size();
+      nominals.push_back(nom);
+    }
+  }
+  w.Write(uint32_t(nominals.size()));
+  for (auto nom : nominals) w.Write(nom);
+
+  w.Write(uint32_t(systs_.size()));
+  for (auto const& sys : systs_) {
+    w.Write(static_cast<Object const&>(*sys));
+    w.Write(sys->name());
+    w.Write(sys->type());
+    w.Write(sys->value_u());
+    w.Write(sys->value_d());
+    w.Write(sys->scale());
+    w.Write(uint8_t(sys->asymm()));
+    if (sys->single_bin()) {
+      w.Write(uint8_t(1));
+      w.Write(nominal_idx.at(sys->single_bin_nominal()));
+      w.Write(int32_t(sys->single_bin()));
+      w.Write(sys->single_bin_content_u());
+      w.Write(sys->single_bin_content_d());
+    } else {
+      w.Write(uint8_t(0));
+      w.Write(sys->shape_u().get());
+      w.Write(sys->shape_d().get());
+    }
+    w.WriteRef(data_ref(sys->data_u()));
+    w.WriteRef(data_ref(sys->data_d()));
+  }
+  if (!out) {
+    throw std::runtime_error(
+        FNERROR("Error writing snapshot file " + filename));
+  }
+}
+
+void CombineHarvester::LoadSnapshot(std::string const& filename) {
+  std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error(
+        FNERROR("File " + filename + " could not be opened"));
+  }
+  SnapshotReader r(in, filename);
+  char magic[sizeof(kSnapshotMagic)];
+  in.read(magic, sizeof(magic));
+  if (!in || !std::equal(magic, magic + sizeof(magic), kSnapshotMagic)) {
+    throw std::runtime_error(
+        FNERROR("File " + filename + " is not a CombineHarvester snapshot"));
+  }
+  uint32_t version = r.Read<uint32_t>();
+  if (version < 1 || version > kSnapshotVersion) {
+    throw std::runtime_error(FNERROR(
+        "Snapshot file " + filename + " has unsupported version " +
+        boost::lexical_cast<std::string>(version)));
+  }
+  r.SetVersion(version);
+
+  // Everything is read into a new instance first, so that *this is left
+  // unmodified if the snapshot turns out to be invalid
+  CombineHarvester res;
+  res.verbosity_ = verbosity_;
+  res.log_ = log_;
+
+  uint32_t n_flags = r.Read<uint32_t>();
+  for (uint32_t i = 0; i < n_flags; ++i) {
+    std::string name = r.ReadString();
+    res.flags_[name] = r.Read<uint8_t>();
+  }
+
+  std::string ws_file = r.ReadString();
+  uint32_t n_ws = r.Read<uint32_t>();
+  std::vector<RooWorkspace *> ws_vec;
+  if (n_ws > 0) {
+    std::size_t slash = filename.find_last_of('/');
+    if (slash != filename.npos) {
+      ws_file = filename.substr(0, slash) + "/" + ws_file;
+    }
+    TFile file(ws_file.c_str());
+    for (uint32_t i = 0; i < n_ws; ++i) {
+      std::string name = r.ReadString();
+      file.cd();
+      std::shared_ptr<RooWorkspace> ptr(
+          dynamic_cast<RooWorkspace*>(gDirectory->Get(name.c_str())));
+      if (!ptr) {
+        throw std::runtime_error(FNERROR("Workspace " + name +
+                                         " not found in file " + ws_file));
+      }
+      res.wspaces_[name] = ptr;
+      ws_vec.push_back(ptr.get());
+    }
+    file.Close();
+  }
+
+  auto get_arg = [&](std::pair<uint32_t, std::string> const& ref) {
+    RooAbsArg * arg = nullptr;
+    if (ref.first == kNoWorkspace) return arg;
+    if (ref.first < ws_vec.size()) {
+      arg = ws_vec[ref.first]->arg(ref.second.c_str());
+    }
+    if (!arg) {
+      throw std::runtime_error(
+          FNERROR("Object " + ref.second + " not found in workspace"));
+    }
+    return arg;
+  };
+  auto get_data = [&](std::pair<uint32_t, std::string> const& ref) {
+    RooAbsData * data = nullptr;
+    if (ref.first == kNoWorkspace) return data;
+    if (ref.first < ws_vec.size()) {
+      data = ws_vec[ref.first]->data(ref.second.c_str());
+    }
+    if (!data) {
+      throw std::runtime_error(
+          FNERROR("Dataset " + ref.second + " not found in workspace"));
+    }
+    return data;
+  };
+
+  uint32_t n_params = r.Read<uint32_t>();
+  for (uint32_t i = 0; i < n_params; ++i) {
+    auto par = std::make_shared<Parameter>();
+    par->set_name(r.ReadString());
+    double val = r.Read<double>();
+    par->set_err_u(r.Read<double>());
+    par->set_err_d(r.Read<double>());
+    par->set_range_u(r.Read<double>());
+    par->set_range_d(r.Read<double>());
+    uint32_t n_vars = r.Read<uint32_t>();
+    for (uint32_t j = 0; j < n_vars; ++j) {
+      RooRealVar * var = dynamic_cast<RooRealVar*>(get_arg(r.ReadRef()));
+      if (var) par->vars().push_back(var);
+    }
+    par->set_val(val);
+    res.params_[par->name()] = par;
+  }
+
+  res.obs_.resize(r.Read<uint32_t>());
+  for (auto & obs : res.obs_) {
+    obs = std::make_shared<Observation>();
+    r.ReadObject(obs.get());
+    obs->set_rate(r.Read<double>());
+    obs->set_shape(r.ReadHist(), false);
+    obs->set_data(get_data(r.ReadRef()));
+  }
+
+  res.procs_.resize(r.Read<uint32_t>());
+  for (auto & proc : res.procs_) {
+    proc = std::make_shared<Process>();
+    r.ReadObject(proc.get());
+    proc->set_rate(r.Read<double>());
+    proc->set_shape(r.ReadHist(), false);
+    proc->set_pdf(dynamic_cast<RooAbsPdf*>(get_arg(r.ReadRef())));
+    proc->set_data(get_data(r.ReadRef()));
+    proc->set_norm(dynamic_cast<RooAbsReal*>(get_arg(r.ReadRef())));
+  }
+
+  std::vector<std::shared_ptr<TH1 const>> nominals;
+  if (version >= 3) {
+    nominals.resize(r.Read<uint32_t>());
+    for (auto & nom : nominals) {
+      nom = r.ReadHist();
+      if (!nom) {
+        throw std::runtime_error(FNERROR(
+            "Snapshot file " + filename + " is truncated or corrupt"));
+      }
+    }
+  }
+
+  res.systs_.resize(r.Read<uint32_t>());
+  for (auto & sys : res.systs_) {
+    sys = std::make_shared<Systematic>();
+    r.ReadObject(sys.get());
+    sys->set_name(r.ReadString());
+    sys->set_type(r.ReadString());
+    sys->set_value_u(r.Read<double>());
+    sys->set_value_d(r.Read<double>());
+    sys->set_scale(r.Read<double>());
+    sys->set_asymm(r.Read<uint8_t>());
+    uint8_t kind = version >= 3 ? r.Read<uint8_t>() : 0;
+    if (kind == 1) {
+      uint32_t idx = r.Read<uint32_t>();
+      int bin = r.Read<int32_t>();
+      double content_u = r.Read<double>();
+      double content_d = r.Read<double>();
+      if (idx >= nominals.size()) {
+        throw std::runtime_error(FNERROR(
+            "Snapshot file " + filename + " is truncated or corrupt"));
+      }
+      sys->set_single_bin_shapes(nominals[idx], bin, content_u, content_d);
+    } else if (kind == 0) {
+      std::unique_ptr<TH1> shape_u = r.ReadHist();
+      std::unique_ptr<TH1> shape_d = r.ReadHist();
+      sys->set_shapes(std::move(shape_u), std::move(shape_d), nullptr);
+    } else {
+      throw std::runtime_error(FNERROR(
+          "Snapshot file " + filename + " is truncated or corrupt"));
+    }
+    RooDataHist * data_u = dynamic_cast<RooDataHist*>(get_data(r.ReadRef()));
+    RooDataHist * data_d = dynamic_cast<RooDataHist*>(get_data(r.ReadRef()));
+    sys->set_data(data_u, data_d, nullptr);
+  }
+
+  swap(*this, res);
+}
+}
@@ -0,0 +1,463 @@
+#include "CombineTools/interface/HorizontalMorphing.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "boost/lexical_cast.hpp"
+#include "CombineTools/interface/Logging.h"
+#include "CombineTools/interface/Threading.h"
+#include "CombineTools/interface/Utilities.h"
+
+namespace ch {
+
+namespace {
+// The normalised cumulative distribution of a template at its bin edges, with
+// negative bin contents treated as zero. Returns false if the template is
+// empty, in which case all the entries are zero.
+bool Cumulative(std::vector<double> const& contents, std::vector<double> & cdf) {
+  cdf.assign(contents.size() + 1, 0.);
+  for (unsigned i = 0; i < contents.size(); ++i) {
+    cdf[i + 1] = cdf[i] + std::max(contents[i], 0.);
+  }
+  double total = cdf.back();
+  if (total <= 0.) return false;
+  for (auto & c : cdf) c /= total;
+  return true;
+}
+
+// Horizontal interpolation between two templates with the same bin edges.
+// Both cumulative distributions are piecewise linear, so between consecutive
+// levels of either one the two inverse distributions are linear in the level.
+// The interpolated distribution is therefore described exactly by the
+// weighted inverses at these levels, which only depend on the two templates
+// and are found once for any number of weights.
+class CdfMorph {
+ public:
+  CdfMorph(std::vector<double> const& edges, std::vector<double> const& lo,
+           std::vector<double> const& hi);
+
+  // Fills res with the normalised contents for weight w of the upper
+  // template, i.e. w = 0 gives lo and w = 1 gives hi
+  void Evaluate(double w, std::vector<double> & res) const;
+
+ private:
+  void AddLevel(double y, bool first, bool last);
+
+  std::vector<double> const& edges_;
+  std::vector<double> cdf_lo_;
+  std::vector<double> cdf_hi_;
+  bool has_lo_;
+  bool has_hi_;
+  // The vertices of the interpolated cumulative distribution: the level, and
+  // the inverse of each template at that level
+  std::vector<double> y_;
+  std::vector<double> x_lo_;
+  std::vector<double> x_hi_;
+};
+
+// The smallest x with cdf(x) >= y
+double InverseLow(std::vector<double> const& edges,
+                  std::vector<double> const& cdf, double y) {
+  unsigned k = std::lower_bound(cdf.begin(), cdf.end(), y) - cdf.begin();
+  if (k == 0) return edges.front();
+  if (k == cdf.size()) return edges.back();
+  return edges[k - 1] + (y - cdf[k - 1]) / (cdf[k] - cdf[k - 1]) *
+                            (edges[k] - edges[k - 1]);
+}
+
+// The largest x with cdf(x) <= y
+double InverseHigh(std::vector<double> const& edges,
+                   std::vector<double> const& cdf, double y) {
+  unsigned j = std::upper_bound(cdf.begin(), cdf.end(), y) - cdf.begin();
+  if (j == 0) return edges.front();
+  --j;
+  if (j + 1 == cdf.size()) return edges.back();
+  return edges[j] + (y - cdf[j]) / (cdf[j + 1] - cdf[j]) *
+                        (edges[j + 1] - edges[j]);
+}
+
+CdfMorph::CdfMorph(std::vector<double> const& edges,
+                   std::vector<double> const& lo,
+                   std::vector<double> const& hi)
+    : edges_(edges) {
+  has_lo_ = Cumulative(lo, cdf_lo_);
+  has_hi_ = Cumulative(hi, cdf_hi_);
+  if (!has_lo_ || !has_hi_) return;
+  std::vector<double> levels;
+  levels.reserve(cdf_lo_.size() + cdf_hi_.size());
+  std::merge(cdf_lo_.begin(), cdf_lo_.end(), cdf_hi_.begin(), cdf_hi_.end(),
+             std::back_inserter(levels));
+  levels.erase(std::unique(levels.begin(), levels.end()), levels.end());
+  // Where a template has empty bins its inverse jumps at that level, so
+  // each level gets a vertex either side of the jump. Only the upper one is
+  // needed at zero and the lower one at one.
+  y_.reserve(2 * levels.size());
+  x_lo_.reserve(2 * levels.size());
+  x_hi_.reserve(2 * levels.size());
+  for (unsigned i = 0; i < levels.size(); ++i) {
+    AddLevel(levels[i], i == 0, i + 1 == levels.size());
+  }
+}
+
+void CdfMorph::AddLevel(double y, bool first, bool last) {
+  if (!first) {
+    y_.push_back(y);
+    x_lo_.push_back(InverseLow(edges_, cdf_lo_, y));
+    x_hi_.push_back(InverseLow(edges_, cdf_hi_, y));
+  }
+  if (!last) {
+    y_.push_back(y);
+    x_lo_.push_back(InverseHigh(edges_, cdf_lo_, y));
+    x_hi_.push_back(InverseHigh(edges_, cdf_hi_, y));
+  }
+}
+
+void CdfMorph::Evaluate(double w, std::vector<double> & res) const {
+  unsigned n = edges_.size() - 1;
+  res.assign(n, 0.);
+  // An empty template can't be interpolated, so the other one is used
+  std::vector<double> const* pivot = nullptr;
+  if (!has_lo_ && !has_hi_) return;
+  if (!has_lo_ || w == 1.) pivot = &cdf_hi_;
+  if (!has_hi_ || w == 0.) pivot = &cdf_lo_;
+  if (pivot) {
+    for (unsigned k = 0; k < n; ++k) res[k] = (*pivot)[k + 1] - (*pivot)[k];
+    return;
+  }
+  unsigned nv = y_.size();
+  std::vector<double> x(nv);
+  for (unsigned j = 0; j < nv; ++j) {
+    x[j] = (1. - w) * x_lo_[j] + w * x_hi_[j];
+    // When extrapolating the inverse is no longer guaranteed to increase
+    if (j > 0 && x[j] < x[j - 1]) x[j] = x[j - 1];
+  }
+  // Edges and vertices are both sorted, so one pass evaluates the
+  // cumulative distribution at every edge
+  unsigned j = 0;
+  double prev = 0.;
+  double sum = 0.;
+  for (unsigned k = 0; k <= n; ++k) {
+    double e = edges_[k];
+    while (j < nv && x[j] <= e) ++j;
+    double g = 0.;
+    if (j == nv) {
+      g = 1.;
+    } else if (j > 0) {
+      g = y_[j - 1] +
+          (e - x[j - 1]) / (x[j] - x[j - 1]) * (y_[j] - y_[j - 1]);
+    }
+    if (k > 0) {
+      res[k - 1] = g - prev;
+      sum += res[k - 1];
+    }
+    prev = g;
+  }
+  // Only needed if part of an extrapolated template is outside the axis
+  if (sum > 0. && std::fabs(sum - 1.) > 1E-12) {
+    for (auto & r : res) r /= sum;
+  }
+}
+
+void ReadTemplate(TH1 const* h, std::vector<double> & contents,
+                  std::vector<double> * errors = nullptr) {
+  int n = h->GetNbinsX();
+  contents.resize(n);
+  if (errors) errors->resize(n);
+  for (int i = 1; i <= n; ++i) {
+    contents[i - 1] = h->GetBinContent(i);
+    if (errors) (*errors)[i - 1] = h->GetBinError(i);
+  }
+}
+
+void CheckBinning(TH1 const* h, unsigned n, ch::Object const* obj) {
+  if (unsigned(h->GetNbinsX()) != n) {
+    throw std::runtime_error(FNERROR(
+        "Templates for bin " + obj->bin() + ", process " + obj->process() +
+        " have a different number of bins at different mass points"));
+  }
+}
+
+// Appends the contents of h to dest, after checking it has n bins
+void AppendTemplate(TH1 const* h, unsigned n, ch::Object const* obj,
+                    std::vector<std::vector<double>> & dest) {
+  CheckBinning(h, n, obj);
+  dest.emplace_back();
+  ReadTemplate(h, dest.back());
+}
+
+std::unique_ptr<TH1> FilledClone(std::unique_ptr<TH1> h,
+                                 std::vector<double> const& contents,
+                                 std::vector<double> const* errors = nullptr) {
+  for (unsigned k = 0; k < contents.size(); ++k) {
+    h->SetBinContent(k + 1, contents[k]);
+    h->SetBinError(k + 1, errors ? (*errors)[k] : 0.);
+  }
+  return h;
+}
+
+// All the properties except the mass
+typedef std::tuple<std::string, std::string, std::string, int, std::string,
+                   std::string> MorphKey;
+
+MorphKey KeyOf(ch::Object const* obj) {
+  return MorphKey(obj->analysis(), obj->era(), obj->channel(), obj->bin_id(),
+                  obj->bin(), obj->process());
+}
+
+struct MorphGroup {
+  // Keyed by the mass, then the systematic name
+  std::map<double, ch::Process *> procs;
+  std::map<double, std::map<std::string, ch::Systematic *>> systs;
+};
+
+// The new mass points between one pair of pivots
+struct MorphInterval {
+  ch::Process const* p_lo;
+  ch::Process const* p_hi;
+  std::vector<std::pair<ch::Systematic const*, ch::Systematic const*>> systs;
+  std::vector<std::string> masses;
+  // The interpolation weight of the upper pivot, used for the rates and
+  // values, and the weight used for the templates, which is the nearest
+  // pivot's in trivial mode
+  std::vector<double> weights;
+  std::vector<double> shape_weights;
+  // The templates at the two pivots: the nominal first, if there is one,
+  // then the up and down of each shape systematic
+  bool has_nominal;
+  std::vector<int> shape_idx;
+  std::vector<double> edges;
+  std::vector<std::vector<double>> lo;
+  std::vector<std::vector<double>> hi;
+  std::vector<double> err_lo;
+  std::vector<double> err_hi;
+  // The interpolated templates for each mass
+  std::vector<std::vector<std::vector<double>>> res;
+  std::vector<std::vector<double>> res_err;
+};
+
+void MorphTemplates(MorphInterval & iv) {
+  unsigned n_t = iv.lo.size();
+  iv.res.assign(iv.masses.size(), std::vector<std::vector<double>>(n_t));
+  iv.res_err.assign(iv.masses.size(), std::vector<double>());
+  for (unsigned t = 0; t < n_t; ++t) {
+    CdfMorph morph(iv.edges, iv.lo[t], iv.hi[t]);
+    for (unsigned i = 0; i < iv.masses.size(); ++i) {
+      morph.Evaluate(iv.shape_weights[i], iv.res[i][t]);
+    }
+  }
+  if (!iv.has_nominal) return;
+  // The nominal keeps the interpolated fractional error in each bin
+  unsigned n = iv.err_lo.size();
+  for (unsigned i = 0; i < iv.masses.size(); ++i) {
+    double w = iv.shape_weights[i];
+    std::vector<double> const& c = iv.res[i][0];
+    std::vector<double> & err = iv.res_err[i];
+    err.resize(n);
+    for (unsigned k = 0; k < n; ++k) {
+      double r_lo = iv.lo[0][k] != 0. ? iv.err_lo[k] / iv.lo[0][k] : 0.;
+      double r_hi = iv.hi[0][k] != 0. ? iv.err_hi[k] / iv.hi[0][k] : 0.;
+      err[k] = std::fabs(((1. - w) * r_lo + w * r_hi) * c[k]);
+    }
+  }
+}
+}
+
+HorizontalMorphingFactory::HorizontalMorphingFactory()
+    : v_(0),
+      extrapolate_(false),
+      trivial_(false),
+      n_threads_(1) {}
+
+void HorizontalMorphingFactory::AddMassPoints(
+    CombineHarvester &src, CombineHarvester &dest,
+    std::vector<std::string> const& masses) {
+  // Group everything by all the properties except the mass, in one pass over
+  // the processes and one over the systematics
+  std::map<MorphKey, MorphGroup> groups;
+  auto mass_val = [](ch::Object const* obj, double & val) -> bool {
+    try {
+      val = boost::lexical_cast<double>(obj->mass());
+    } catch (boost::bad_lexical_cast const&) {
+      return false;
+    }
+    return true;
+  };
+  src.ForEachProc([&](ch::Process *p) {
+    double m = 0.;
+    if (!mass_val(p, m)) return;
+    if (p->pdf() || p->data() || p->norm()) {
+      throw std::runtime_error(FNERROR(
+          "Processes with RooFit objects are not supported, found bin " +
+          p->bin() + ", process " + p->process()));
+    }
+    groups[KeyOf(p)].procs[m] = p;
+  });
+  src.ForEachSyst([&](ch::Systematic *s) {
+    double m = 0.;
+    if (!mass_val(s, m)) return;
+    auto it = groups.find(KeyOf(s));
+    if (it != groups.end()) it->second.systs[m][s->name()] = s;
+  });
+
+  std::vector<std::pair<std::string, double>> targets;
+  for (auto const& m : masses) {
+    targets.push_back(std::make_pair(m, boost::lexical_cast<double>(m)));
+  }
+
+  // Work out which pivots each new mass uses, and copy out the pivot
+  // templates, which may be shapes that are only built or loaded on access
+  std::vector<MorphInterval> intervals;
+  for (auto & grp : groups) {
+    MorphGroup & g = grp.second;
+    if (g.procs.size() < 2) continue;
+    std::vector<double> pivots;
+    for (auto const& it : g.procs) pivots.push_back(it.first);
+    std::map<unsigned, MorphInterval> g_intervals;
+    for (auto const& target : targets) {
+      double m = target.second;
+      if (g.procs.count(m)) continue;
+      unsigned hi = std::upper_bound(pivots.begin(), pivots.end(), m) -
+                    pivots.begin();
+      if (hi == 0 || hi == pivots.size()) {
+        if (!extrapolate_) {
+          if (v_ > 0) {
+            std::cout << "Mass " << target.first
+                      << " is outside the range of the pivots, skipping\n"
+                      << Process::PrintHeader << *(g.procs.begin()->second)
+                      << "\n";
+          }
+          continue;
+        }
+        hi = (hi == 0) ? 1 : pivots.size() - 1;
+      }
+      double m_lo = pivots[hi - 1];
+      double m_hi = pivots[hi];
+      double w = (m - m_lo) / (m_hi - m_lo);
+      MorphInterval & iv = g_intervals[hi];
+      iv.masses.push_back(target.first);
+      iv.weights.push_back(w);
+      iv.shape_weights.push_back(trivial_ ? (w < 0.5 ? 0. : 1.) : w);
+    }
+    for (auto & it : g_intervals) {
+      MorphInterval & iv = it.second;
+      double m_lo = pivots[it.first - 1];
+      double m_hi = pivots[it.first];
+      iv.p_lo = g.procs[m_lo];
+      iv.p_hi = g.procs[m_hi];
+      if (v_ > 0) {
+        std::cout << "Morphing " << iv.masses.size() << " mass point(s) from "
+                  << iv.p_lo->mass() << " and " << iv.p_hi->mass()
+                  << " for bin " << iv.p_lo->bin() << ", process "
+                  << iv.p_lo->process() << "\n";
+      }
+      auto const& s_lo = g.systs[m_lo];
+      auto const& s_hi = g.systs[m_hi];
+      for (auto const& s : s_lo) {
+        auto s_it = s_hi.find(s.first);
+        if (s_it == s_hi.end()) {
+          throw std::runtime_error(FNERROR(
+              "Systematic " + s.first + " for bin " + iv.p_lo->bin() +
+              ", process " + iv.p_lo->process() + " is present at mass " +
+              iv.p_lo->mass() + " but not at mass " + iv.p_hi->mass()));
+        }
+        iv.systs.push_back(std::make_pair(s.second, s_it->second));
+      }
+      if (bool(iv.p_lo->shape()) != bool(iv.p_hi->shape())) {
+        throw std::runtime_error(FNERROR(
+            "Bin " + iv.p_lo->bin() + ", process " + iv.p_lo->process() +
+            " only has a shape template at one of the masses " +
+            iv.p_lo->mass() + " and " + iv.p_hi->mass()));
+      }
+      iv.has_nominal = iv.p_lo->shape();
+      if (!iv.has_nominal) {
+        intervals.push_back(std::move(iv));
+        continue;
+      }
+      TH1 const* h = iv.p_lo->shape();
+      unsigned n = h->GetNbinsX();
+      CheckBinning(iv.p_hi->shape(), n, iv.p_lo);
+      iv.edges.resize(n + 1);
+      for (unsigned k = 0; k < n; ++k) {
+        iv.edges[k] = h->GetXaxis()->GetBinLowEdge(k + 1);
+      }
+      iv.edges[n] = h->GetXaxis()->GetBinUpEdge(n);
+      iv.lo.emplace_back();
+      iv.hi.emplace_back();
+      ReadTemplate(iv.p_lo->shape(), iv.lo.back(), &iv.err_lo);
+      ReadTemplate(iv.p_hi->shape(), iv.hi.back(), &iv.err_hi);
+      for (auto const& s : iv.systs) {
+        bool has_lo = s.first->single_bin() || bool(s.first->shape_u());
+        bool has_hi = s.second->single_bin() || bool(s.second->shape_u());
+        if (has_lo != has_hi) {
+          throw std::runtime_error(FNERROR(
+              "Systematic " + s.first->name() + " for bin " + iv.p_lo->bin() +
+              ", process " + iv.p_lo->process() +
+              " only has shape templates at one of the masses " +
+              iv.p_lo->mass() + " and " + iv.p_hi->mass()));
+        }
+        if (!has_lo) {
+          iv.shape_idx.push_back(-1);
+          continue;
+        }
+        iv.shape_idx.push_back(iv.lo.size());
+        // Each template is read as soon as it is accessed: loading the
+        // shapes of one lazily-loaded Systematic can release those of another
+        AppendTemplate(s.first->shape_u().get(), n, iv.p_lo, iv.lo);
+        AppendTemplate(s.second->shape_u().get(), n, iv.p_lo, iv.hi);
+        AppendTemplate(s.first->shape_d().get(), n, iv.p_lo, iv.lo);
+        AppendTemplate(s.second->shape_d().get(), n, iv.p_lo, iv.hi);
+      }
+      intervals.push_back(std::move(iv));
+    }
+  }
+
+  // Evaluating the interpolated templates only uses the copied contents
+  RunThreads(intervals.size(), n_threads_, [&](unsigned i) {
+    MorphTemplates(intervals[i]);
+  });
+
+  auto lerp = [](double lo, double hi, double w) {
+    return lo + (hi - lo) * w;
+  };
+  for (auto const& iv : intervals) {
+    for (unsigned i = 0; i < iv.masses.size(); ++i) {
+      double w = iv.weights[i];
+      ch::Process proc;
+      ch::SetProperties(&proc, iv.p_lo);
+      proc.set_mass(iv.masses[i]);
+      proc.set_rate(std::max(lerp(iv.p_lo->rate(), iv.p_hi->rate(), w), 0.));
+      if (iv.has_nominal) {
+        proc.set_shape(FilledClone(iv.p_lo->ClonedShape(), iv.res[i][0],
+                                   &(iv.res_err[i])), false);
+      }
+      dest.InsertProcess(proc);
+      for (unsigned j = 0; j < iv.systs.size(); ++j) {
+        ch::Systematic const* s_lo = iv.systs[j].first;
+        ch::Systematic const* s_hi = iv.systs[j].second;
+        ch::Systematic sys;
+        ch::SetProperties(&sys, s_lo);
+        sys.set_mass(iv.masses[i]);
+        sys.set_name(s_lo->name());
+        sys.set_type(s_lo->type());
+        sys.set_scale(s_lo->scale());
+        sys.set_asymm(s_lo->asymm());
+        if (iv.has_nominal && iv.shape_idx[j] >= 0) {
+          unsigned t = iv.shape_idx[j];
+          sys.set_shapes(FilledClone(s_lo->ClonedShapeU(), iv.res[i][t]),
+                         FilledClone(s_lo->ClonedShapeD(), iv.res[i][t + 1]),
+                         nullptr);
+        }
+        sys.set_value_u(lerp(s_lo->value_u(), s_hi->value_u(), w));
+        sys.set_value_d(lerp(s_lo->value_d(), s_hi->value_d(), w));
+        dest.CreateParameterIfEmpty(sys.name());
+        dest.InsertSystematic(std::move(sys));
+      }
+    }
+  }
+}
+}
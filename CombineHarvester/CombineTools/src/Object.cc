@@ -1,16 +1,50 @@
 #include "CombineTools/interface/Object.h"
 #include <iostream>
+#include <mutex>
+#include <unordered_set>
 namespace ch {
 
+namespace {
+// Elements of an unordered_set are never moved, so the pointers stay valid
+// as the table grows
+std::mutex & InternMutex() {
+  static std::mutex table_mutex;
+  return table_mutex;
+}
+
+std::unordered_set<std::string> & InternTable() {
+  static std::unordered_set<std::string> table;
+  return table;
+}
+}
+
+std::string const* InternString(std::string const& str) {
+  std::lock_guard<std::mutex> lock(InternMutex());
+  return &(*InternTable().insert(str).first);
+}
+
+std::string const* FindInternedString(std::string const& str) {
+  std::lock_guard<std::mutex> lock(InternMutex());
+  auto it = InternTable().find(str);
+  return it != InternTable().end() ? &(*it) : nullptr;
+}
+
+namespace {
+std::string const* EmptyString() {
+  static std::string const* empty = InternString("");
+  return empty;
+}
+}
+
 Object::Object()
-    : bin_(""),
-      process_(""),
+    : bin_(EmptyString()),
+      process_(EmptyString()),
       signal_(false),
-      analysis_(""),
-      era_(""),
-      channel_(""),
+      analysis_(EmptyString()),
+      era_(EmptyString()),
+      channel_(EmptyString()),
       bin_id_(0),
-      mass_("") {
+      mass_(EmptyString()) {
   }
 
 Object::~Object() { }
@@ -39,14 +73,14 @@ Object::Object(Object const& other)
 }
 
 Object::Object(Object&& other)
-    : bin_(""),
-      process_(""),
+    : bin_(EmptyString()),
+      process_(EmptyString()),
       signal_(false),
-      analysis_(""),
-      era_(""),
-      channel_(""),
+      analysis_(EmptyString()),
+      era_(EmptyString()),
+      channel_(EmptyString()),
       bin_id_(0),
-      mass_("") {
+      mass_(EmptyString()) {
   swap(*this, other);
 }
 
@@ -30,16 +30,10 @@ void swap(Process& first, Process& second) {
 Process::Process(Process const& other)
     : Object(other),
       rate_(other.rate_),
+      shape_(other.shape_),
       pdf_(other.pdf_),
       data_(other.data_),
-      norm_(other.norm_) {
-  TH1 *h = nullptr;
-  if (other.shape_) {
-    h = static_cast<TH1*>(other.shape_->Clone());
-    h->SetDirectory(0);
-  }
-  shape_ = std::unique_ptr<TH1>(h);
-}
+      norm_(other.norm_) {}
 
 Process::Process(Process&& other)
     : Object(),
@@ -70,14 +64,15 @@ void Process::set_shape(std::unique_ptr<TH1> shape, bool set_rate) {
   //     throw std::runtime_error(FNERROR("TH1 has a bin with content < 0"));
   //   }
   // }
-  // At this point we can safely move the shape in and take ownership
-  shape_ = std::move(shape);
   // Ensure that root will not try and clean this up
-  shape_->SetDirectory(0);
+  shape->SetDirectory(0);
   if (set_rate) {
-    this->set_rate(shape_->Integral());
+    this->set_rate(shape->Integral());
   }
-  if (shape_->Integral() > 0.) shape_->Scale(1. / shape_->Integral());
+  if (shape->Integral() > 0.) shape->Scale(1. / shape->Integral());
+  // At this point we can safely move the shape in and take ownership. It is
+  // not modified again, so copies of this object can share it
+  shape_ = std::move(shape);
 }
 
 std::unique_ptr<TH1> Process::ClonedShape() const {
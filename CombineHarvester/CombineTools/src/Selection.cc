@@ -0,0 +1,266 @@
+#include "CombineTools/interface/Selection.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CombineTools/interface/Object.h"
+
+namespace ch {
+
+// The bitmaps of the entries holding each value of a property. A Bits with
+// an empty vector for one of the collections means the property does not
+// apply to that collection.
+struct Selection::Index {
+  Index(std::vector<std::shared_ptr<Observation>> const& obs,
+        std::vector<std::shared_ptr<Process>> const& procs,
+        std::vector<std::shared_ptr<Systematic>> const& systs)
+      : obs(obs), procs(procs), systs(systs) {
+    all.obs = AllSet(obs.size());
+    all.procs = AllSet(procs.size());
+    all.systs = AllSet(systs.size());
+  }
+
+  std::vector<std::shared_ptr<Observation>> const& obs;
+  std::vector<std::shared_ptr<Process>> const& procs;
+  std::vector<std::shared_ptr<Systematic>> const& systs;
+
+  Bits all;
+  // Keyed by the property name, then by the interned value
+  std::map<std::string, std::unordered_map<std::string const*, Bits>> strings;
+  // Keyed by the property name ("name" or "type"), then by the value
+  std::map<std::string, std::map<std::string, Bits>> syst_strings;
+  std::unique_ptr<std::map<int, Bits>> bin_ids;
+  std::unique_ptr<Bits> signals;
+  std::unique_ptr<Bits> histograms;
+
+  static Words AllSet(unsigned n) {
+    Words res((n + 63) / 64, ~uint64_t(0));
+    if (n % 64) res.back() = (uint64_t(1) << (n % 64)) - 1;
+    return res;
+  }
+
+  // All bits unset in the collections the property applies to
+  Bits Zeros(bool on_obs, bool on_procs, bool on_systs) const {
+    Bits res;
+    if (on_obs) res.obs.assign(all.obs.size(), 0);
+    if (on_procs) res.procs.assign(all.procs.size(), 0);
+    if (on_systs) res.systs.assign(all.systs.size(), 0);
+    return res;
+  }
+
+  template<typename T, typename Map, typename KeyFn>
+  static void Fill(std::vector<std::shared_ptr<T>> const& vec,
+                   Words Bits::*words, Map& map, KeyFn key,
+                   Bits const& zeros) {
+    for (unsigned i = 0; i < vec.size(); ++i) {
+      auto it = map.find(key(vec[i].get()));
+      if (it == map.end()) {
+        it = map.insert(std::make_pair(key(vec[i].get()), zeros)).first;
+      }
+      (it->second.*words)[i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+
+  template<typename Map, typename KeyFn>
+  void Build(Map& map, KeyFn key, bool on_obs, bool on_procs,
+             bool on_systs) const {
+    Bits zeros = Zeros(on_obs, on_procs, on_systs);
+    if (on_obs) Fill(obs, &Bits::obs, map, key, zeros);
+    if (on_procs) Fill(procs, &Bits::procs, map, key, zeros);
+    if (on_systs) Fill(systs, &Bits::systs, map, key, zeros);
+  }
+
+  static void Or(Words& dest, Words const& src) {
+    for (unsigned i = 0; i < src.size(); ++i) dest[i] |= src[i];
+  }
+
+  // The union of the bitmaps of the requested values
+  template<typename Map, typename Key>
+  Bits Union(Map const& map, std::vector<Key> const& keys, bool on_obs,
+             bool on_procs, bool on_systs) const {
+    Bits res = Zeros(on_obs, on_procs, on_systs);
+    for (auto const& key : keys) {
+      auto it = map.find(key);
+      if (it == map.end()) continue;
+      Or(res.obs, it->second.obs);
+      Or(res.procs, it->second.procs);
+      Or(res.systs, it->second.systs);
+    }
+    return res;
+  }
+
+  template<typename KeyFn>
+  Bits StringMask(std::string const& prop, KeyFn key,
+                  std::vector<std::string> const& vec, bool on_obs) {
+    auto it = strings.find(prop);
+    if (it == strings.end()) {
+      it = strings.insert(std::make_pair(
+          prop, std::unordered_map<std::string const*, Bits>())).first;
+      Build(it->second, key, on_obs, true, true);
+    }
+    // Values that have never been interned cannot match any entry
+    std::vector<std::string const*> interned;
+    interned.reserve(vec.size());
+    for (auto const& str : vec) {
+      std::string const* ptr = FindInternedString(str);
+      if (ptr) interned.push_back(ptr);
+    }
+    return Union(it->second, interned, on_obs, true, true);
+  }
+
+  template<typename KeyFn>
+  Bits SystStringMask(std::string const& prop, KeyFn key,
+                      std::vector<std::string> const& vec) {
+    auto it = syst_strings.find(prop);
+    if (it == syst_strings.end()) {
+      it = syst_strings.insert(std::make_pair(
+          prop, std::map<std::string, Bits>())).first;
+      Fill(systs, &Bits::systs, it->second, key, Zeros(false, false, true));
+    }
+    return Union(it->second, vec, false, false, true);
+  }
+
+  Bits const& SignalMask() {
+    if (!signals) {
+      std::map<bool, Bits> by_signal;
+      Build(by_signal, [](Object const* o) { return o->signal(); }, false,
+            true, true);
+      signals.reset(new Bits(
+          Union(by_signal, std::vector<bool>{true}, false, true, true)));
+    }
+    return *signals;
+  }
+
+  Bits const& HistogramMask() {
+    if (!histograms) {
+      std::map<bool, Bits> by_shape;
+      Bits zeros = Zeros(true, true, false);
+      Fill(obs, &Bits::obs, by_shape,
+           [](Observation const* o) { return o->shape() != nullptr; }, zeros);
+      Fill(procs, &Bits::procs, by_shape,
+           [](Process const* p) { return p->shape() != nullptr; }, zeros);
+      histograms.reset(new Bits(
+          Union(by_shape, std::vector<bool>{true}, true, true, false)));
+    }
+    return *histograms;
+  }
+};
+
+Selection::Selection(CombineHarvester & cb)
+    : cb_(&cb),
+      index_(std::make_shared<Index>(cb.obs_, cb.procs_, cb.systs_)),
+      sel_(index_->all) {}
+
+void Selection::Apply(Bits const& mask, bool cond) {
+  auto apply = [&](Words& sel, Words const& m) {
+    if (cond) {
+      for (unsigned i = 0; i < m.size(); ++i) sel[i] &= m[i];
+    } else {
+      for (unsigned i = 0; i < m.size(); ++i) sel[i] &= ~m[i];
+    }
+  };
+  apply(sel_.obs, mask.obs);
+  apply(sel_.procs, mask.procs);
+  apply(sel_.systs, mask.systs);
+}
+
+Selection& Selection::bin(std::vector<std::string> const& vec, bool cond) {
+  Apply(index_->StringMask("bin", [](Object const* o) { return &o->bin(); },
+                           vec, true), cond);
+  return *this;
+}
+
+Selection& Selection::bin_id(std::vector<int> const& vec, bool cond) {
+  if (!index_->bin_ids) {
+    index_->bin_ids.reset(new std::map<int, Bits>());
+    index_->Build(*(index_->bin_ids),
+                  [](Object const* o) { return o->bin_id(); }, true, true,
+                  true);
+  }
+  Apply(index_->Union(*(index_->bin_ids), vec, true, true, true), cond);
+  return *this;
+}
+
+Selection& Selection::process(std::vector<std::string> const& vec,
+                              bool cond) {
+  Apply(index_->StringMask("process",
+                           [](Object const* o) { return &o->process(); }, vec,
+                           false), cond);
+  return *this;
+}
+
+Selection& Selection::analysis(std::vector<std::string> const& vec,
+                               bool cond) {
+  Apply(index_->StringMask("analysis",
+                           [](Object const* o) { return &o->analysis(); }, vec,
+                           true), cond);
+  return *this;
+}
+
+Selection& Selection::era(std::vector<std::string> const& vec, bool cond) {
+  Apply(index_->StringMask("era", [](Object const* o) { return &o->era(); },
+                           vec, true), cond);
+  return *this;
+}
+
+Selection& Selection::channel(std::vector<std::string> const& vec,
+                              bool cond) {
+  Apply(index_->StringMask("channel",
+                           [](Object const* o) { return &o->channel(); }, vec,
+                           true), cond);
+  return *this;
+}
+
+Selection& Selection::mass(std::vector<std::string> const& vec, bool cond) {
+  Apply(index_->StringMask("mass", [](Object const* o) { return &o->mass(); },
+                           vec, true), cond);
+  return *this;
+}
+
+Selection& Selection::syst_name(std::vector<std::string> const& vec,
+                                bool cond) {
+  Apply(index_->SystStringMask(
+            "name", [](Systematic const* s) { return s->name(); }, vec),
+        cond);
+  return *this;
+}
+
+Selection& Selection::syst_type(std::vector<std::string> const& vec,
+                                bool cond) {
+  Apply(index_->SystStringMask(
+            "type", [](Systematic const* s) { return s->type(); }, vec),
+        cond);
+  return *this;
+}
+
+Selection& Selection::signals() {
+  Apply(index_->SignalMask(), true);
+  return *this;
+}
+
+Selection& Selection::backgrounds() {
+  Apply(index_->SignalMask(), false);
+  return *this;
+}
+
+Selection& Selection::histograms() {
+  Apply(index_->HistogramMask(), true);
+  return *this;
+}
+
+CombineHarvester Selection::Materialize() const {
+  CombineHarvester res;
+  res.params_ = cb_->params_;
+  res.wspaces_ = cb_->wspaces_;
+  res.flags_ = cb_->flags_;
+  res.verbosity_ = cb_->verbosity_;
+  res.log_ = cb_->log_;
+  ForEachBit(sel_.obs, [&](unsigned i) { res.obs_.push_back(cb_->obs_[i]); });
+  ForEachBit(sel_.procs,
+             [&](unsigned i) { res.procs_.push_back(cb_->procs_[i]); });
+  ForEachBit(sel_.systs,
+             [&](unsigned i) { res.systs_.push_back(cb_->systs_[i]); });
+  return res;
+}
+}
@@ -0,0 +1,68 @@
+#include "CombineTools/interface/SharedShapes.h"
+#include <string>
+#include "boost/functional/hash.hpp"
+#include "TAxis.h"
+#include "CombineTools/interface/Logging.h"
+#include "CombineTools/interface/TFileIO.h"
+
+namespace ch {
+
+SharedShapes::SharedShapes(std::string const& filename)
+    : filename_(filename),
+      file_(new TFile(filename.c_str(), "RECREATE")) {
+  if (!file_->IsOpen()) {
+    throw std::runtime_error(FNERROR("Unable to create file: " + filename));
+  }
+}
+
+SharedShapes::~SharedShapes() {
+  file_->Close();
+}
+
+unsigned SharedShapes::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hashes_.size();
+}
+
+std::size_t SharedShapes::HistHash(TH1 const* hist) {
+  std::size_t seed = 0;
+  int n = hist->GetNbinsX();
+  boost::hash_combine(seed, n);
+  TAxis const* axis = hist->GetXaxis();
+  for (int i = 1; i <= n + 1; ++i) {
+    boost::hash_combine(seed, axis->GetBinLowEdge(i));
+  }
+  for (int i = 0; i <= n + 1; ++i) {
+    boost::hash_combine(seed, hist->GetBinContent(i));
+    boost::hash_combine(seed, hist->GetBinError(i));
+  }
+  return seed;
+}
+
+bool SharedShapes::SameHist(TH1 const* a, TH1 const* b) {
+  int n = a->GetNbinsX();
+  if (b->GetNbinsX() != n) return false;
+  for (int i = 1; i <= n + 1; ++i) {
+    if (a->GetXaxis()->GetBinLowEdge(i) != b->GetXaxis()->GetBinLowEdge(i)) {
+      return false;
+    }
+  }
+  for (int i = 0; i <= n + 1; ++i) {
+    if (a->GetBinContent(i) != b->GetBinContent(i) ||
+        a->GetBinError(i) != b->GetBinError(i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SharedShapes::CanShare(std::string const& path, std::size_t hash,
+                            TH1 const* hist) const {
+  auto it = hashes_.find(path);
+  if (it == hashes_.end()) return true;
+  if (it->second != hash) return false;
+  // Equal hashes do not guarantee equal histograms
+  std::unique_ptr<TH1> stored = GetClonedTH1(file_.get(), path);
+  return SameHist(stored.get(), hist);
+}
+}
@@ -1,10 +1,165 @@
 #include "CombineTools/interface/Systematic.h"
 #include <iostream>
+#include <list>
+#include <mutex>
 #include "boost/format.hpp"
 #include "CombineTools/interface/Logging.h"
+#include "CombineTools/interface/TFileIO.h"
+#include "CombineTools/interface/Utilities.h"
 
 namespace ch {
 
+/**
+ * The deferred shapes of a Systematic, together with the value_u and
+ * value_d derived from them once they have first been read
+ *
+ * Instances holding loaded shapes are tracked in a least-recently-used list
+ * so that the oldest can be released when the limit set by
+ * Systematic::SetMaxResidentShapes is exceeded. The list is shared by all
+ * instances, so it and the loading of the shapes are guarded by one mutex.
+ *
+ * If a log is given, the TH1s with negative bins are recorded when the shapes
+ * are first read, as a mask of kNegativeNominal, kNegativeUp and
+ * kNegativeDown. This is handed to the next caller of shape() or values(),
+ * which writes the warnings once the mutex has been released.
+ */
+class Systematic::LazyShapes {
+ public:
+  enum { kNegativeNominal = 1, kNegativeUp = 2, kNegativeDown = 4 };
+
+  LazyShapes(std::shared_ptr<TFile> file, std::string const& nominal,
+             std::string const& path_u, std::string const& path_d,
+             std::ostream * warn_log)
+      : file_(file),
+        nominal_(nominal),
+        path_u_(path_u),
+        path_d_(path_d),
+        warn_log_(warn_log),
+        negative_(0),
+        has_values_(false),
+        valid_values_(false),
+        value_u_(0.0),
+        value_d_(0.0),
+        resident_(false) {}
+
+  ~LazyShapes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Release();
+  }
+
+  std::shared_ptr<TH1 const> shape(bool up, unsigned & negative) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!shape_u_) Load();
+    Touch();
+    negative = negative_;
+    negative_ = 0;
+    return up ? shape_u_ : shape_d_;
+  }
+
+  // If pending is set, sets value_u and value_d, when the nominal integral
+  // allows these to be determined, and then clears pending
+  void values(double & value_u, double & value_d,
+              std::atomic<bool> & pending, unsigned & negative) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    negative = 0;
+    if (!pending.load(std::memory_order_relaxed)) return;
+    if (!has_values_) {
+      Load();
+      Touch();
+    }
+    if (valid_values_) {
+      value_u = value_u_;
+      value_d = value_d_;
+    }
+    pending.store(false, std::memory_order_release);
+    negative = negative_;
+    negative_ = 0;
+  }
+
+  std::ostream * warn_log() const { return warn_log_; }
+
+  static void SetMaxResident(unsigned n_max) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_resident_ = n_max;
+    Evict(nullptr);
+  }
+
+ private:
+  void Load() {
+    std::unique_ptr<TH1> h = GetClonedTH1(file_.get(), nominal_);
+    std::unique_ptr<TH1> shape_u = GetClonedTH1(file_.get(), path_u_);
+    std::unique_ptr<TH1> shape_d = GetClonedTH1(file_.get(), path_d_);
+    if (!has_values_) {
+      if (warn_log_) {
+        negative_ = (HasNegativeBins(h.get()) ? kNegativeNominal : 0) |
+                    (HasNegativeBins(shape_u.get()) ? kNegativeUp : 0) |
+                    (HasNegativeBins(shape_d.get()) ? kNegativeDown : 0);
+      }
+      if (h->Integral() > 0.) {
+        value_u_ = shape_u->Integral() / h->Integral();
+        value_d_ = shape_d->Integral() / h->Integral();
+        valid_values_ = true;
+      }
+      has_values_ = true;
+    }
+    if (shape_u->Integral() > 0.) shape_u->Scale(1. / shape_u->Integral());
+    if (shape_d->Integral() > 0.) shape_d->Scale(1. / shape_d->Integral());
+    shape_u_ = std::move(shape_u);
+    shape_d_ = std::move(shape_d);
+  }
+
+  void Touch() {
+    if (resident_) {
+      resident_list_.splice(resident_list_.begin(), resident_list_, it_);
+    } else {
+      resident_list_.push_front(this);
+      it_ = resident_list_.begin();
+      resident_ = true;
+      Evict(this);
+    }
+  }
+
+  void Release() {
+    if (!resident_) return;
+    resident_list_.erase(it_);
+    resident_ = false;
+    shape_u_ = nullptr;
+    shape_d_ = nullptr;
+  }
+
+  // Release the least recently used shapes, but never those of `keep`
+  static void Evict(LazyShapes const* keep) {
+    if (max_resident_ == 0) return;
+    while (resident_list_.size() > max_resident_ &&
+           resident_list_.back() != keep) {
+      resident_list_.back()->Release();
+    }
+  }
+
+  std::shared_ptr<TFile> file_;
+  std::string nominal_;
+  std::string path_u_;
+  std::string path_d_;
+  std::ostream * warn_log_;
+  unsigned negative_;
+  bool has_values_;
+  bool valid_values_;
+  double value_u_;
+  double value_d_;
+  std::shared_ptr<TH1 const> shape_u_;
+  std::shared_ptr<TH1 const> shape_d_;
+  bool resident_;
+  std::list<LazyShapes*>::iterator it_;
+
+  static std::mutex mutex_;
+  static std::list<LazyShapes*> resident_list_;
+  static unsigned max_resident_;
+};
+
+std::mutex Systematic::LazyShapes::mutex_;
+std::list<Systematic::LazyShapes*> Systematic::LazyShapes::resident_list_;
+unsigned Systematic::LazyShapes::max_resident_ = 0;
+
 Systematic::Systematic()
     : Object(),
       name_(""),
@@ -16,7 +171,13 @@ Systematic::Systematic()
       shape_u_(),
       shape_d_(),
       data_u_(nullptr),
-      data_d_(nullptr) {
+      data_d_(nullptr),
+      lazy_(),
+      lazy_values_(false),
+      single_nominal_(),
+      single_bin_(0),
+      single_u_(0.0),
+      single_d_(0.0) {
   }
 
 Systematic::~Systematic() { }
@@ -34,6 +195,14 @@ void swap(Systematic& first, Systematic& second) {
   swap(first.shape_d_, second.shape_d_);
   swap(first.data_u_, second.data_u_);
   swap(first.data_d_, second.data_d_);
+  swap(first.lazy_, second.lazy_);
+  bool lazy_values = first.lazy_values_.load();
+  first.lazy_values_.store(second.lazy_values_.load());
+  second.lazy_values_.store(lazy_values);
+  swap(first.single_nominal_, second.single_nominal_);
+  swap(first.single_bin_, second.single_bin_);
+  swap(first.single_u_, second.single_u_);
+  swap(first.single_d_, second.single_d_);
 }
 
 Systematic::Systematic(Systematic const& other)
@@ -44,21 +213,16 @@ Systematic::Systematic(Systematic const& other)
       value_d_(other.value_d_),
       scale_(other.scale_),
       asymm_(other.asymm_),
+      shape_u_(other.shape_u_),
+      shape_d_(other.shape_d_),
       data_u_(other.data_u_),
-      data_d_(other.data_d_) {
-  TH1 *h_u = nullptr;
-  if (other.shape_u_) {
-    h_u = dynamic_cast<TH1*>(other.shape_u_->Clone());
-    h_u->SetDirectory(0);
-  }
-  shape_u_ = std::unique_ptr<TH1>(h_u);
-  TH1 *h_d = nullptr;
-  if (other.shape_d_) {
-    h_d = dynamic_cast<TH1*>(other.shape_d_->Clone());
-    h_d->SetDirectory(0);
-  }
-  shape_d_ = std::unique_ptr<TH1>(h_d);
-}
+      data_d_(other.data_d_),
+      lazy_(other.lazy_),
+      lazy_values_(other.lazy_values_.load(std::memory_order_acquire)),
+      single_nominal_(other.single_nominal_),
+      single_bin_(other.single_bin_),
+      single_u_(other.single_u_),
+      single_d_(other.single_d_) {}
 
 Systematic::Systematic(Systematic&& other)
     : Object(),
@@ -71,7 +235,13 @@ Systematic::Systematic(Systematic&& other)
       shape_u_(),
       shape_d_(),
       data_u_(nullptr),
-      data_d_(nullptr) {
+      data_d_(nullptr),
+      lazy_(),
+      lazy_values_(false),
+      single_nominal_(),
+      single_bin_(0),
+      single_u_(0.0),
+      single_d_(0.0) {
   swap(*this, other);
 }
 
@@ -82,6 +252,11 @@ Systematic& Systematic::operator=(Systematic other) {
 
 void Systematic::set_shapes(std::unique_ptr<TH1> shape_u,
                             std::unique_ptr<TH1> shape_d, TH1 const* nominal) {
+  // Any deferred or single-bin shapes are replaced by the new ones
+  lazy_ = nullptr;
+  lazy_values_ = false;
+  single_nominal_ = nullptr;
+
   // Check that the inputs make sense
   if (bool(shape_u) != bool(shape_d)) {
     throw std::runtime_error(
@@ -115,18 +290,20 @@ void Systematic::set_shapes(std::unique_ptr<TH1> shape_u,
   //   }
   // }
 
-  shape_u_ = std::move(shape_u);
-  shape_d_ = std::move(shape_d);
-  shape_u_->SetDirectory(0);
-  shape_d_->SetDirectory(0);
+  shape_u->SetDirectory(0);
+  shape_d->SetDirectory(0);
 
   if (nominal && nominal->Integral() > 0.) {
-    this->set_value_u(shape_u_->Integral() / nominal->Integral());
-    this->set_value_d(shape_d_->Integral() / nominal->Integral());
+    this->set_value_u(shape_u->Integral() / nominal->Integral());
+    this->set_value_d(shape_d->Integral() / nominal->Integral());
   }
 
-  if (shape_u_->Integral() > 0.) shape_u_->Scale(1. / shape_u_->Integral());
-  if (shape_d_->Integral() > 0.) shape_d_->Scale(1. / shape_d_->Integral());
+  if (shape_u->Integral() > 0.) shape_u->Scale(1. / shape_u->Integral());
+  if (shape_d->Integral() > 0.) shape_d->Scale(1. / shape_d->Integral());
+
+  // The shapes are not modified again, so copies of this object can share them
+  shape_u_ = std::move(shape_u);
+  shape_d_ = std::move(shape_d);
 }
 
 void Systematic::set_data(RooDataHist* data_u, RooDataHist* data_d,
@@ -140,16 +317,95 @@ void Systematic::set_data(RooDataHist* data_u, RooDataHist* data_d,
 }
 
 
+void Systematic::set_lazy_shapes(std::shared_ptr<TFile> file,
+                                 std::string const& nominal,
+                                 std::string const& shape_u,
+                                 std::string const& shape_d,
+                                 std::ostream * warn_log) {
+  shape_u_ = nullptr;
+  shape_d_ = nullptr;
+  single_nominal_ = nullptr;
+  lazy_ = std::make_shared<LazyShapes>(file, nominal, shape_u, shape_d,
+                                       warn_log);
+  lazy_values_ = true;
+}
+
+void Systematic::set_single_bin_shapes(std::shared_ptr<TH1 const> nominal,
+                                       int bin, double content_u,
+                                       double content_d) {
+  if (!nominal) {
+    throw std::runtime_error(FNERROR("nominal TH1 must not be null"));
+  }
+  if (bin < 1 || bin > nominal->GetNbinsX()) {
+    throw std::runtime_error(FNERROR("bin index is out of range"));
+  }
+  lazy_ = nullptr;
+  lazy_values_ = false;
+  shape_u_ = nullptr;
+  shape_d_ = nullptr;
+  single_nominal_ = nominal;
+  single_bin_ = bin;
+  single_u_ = content_u;
+  single_d_ = content_d;
+}
+
+std::unique_ptr<TH1> Systematic::BuildSingleBinShape(bool up) const {
+  std::unique_ptr<TH1> res(static_cast<TH1 *>(single_nominal_->Clone()));
+  res->SetDirectory(0);
+  res->SetBinContent(single_bin_, up ? single_u_ : single_d_);
+  if (res->Integral() > 0.) res->Scale(1. / res->Integral());
+  return res;
+}
+
+void Systematic::SetMaxResidentShapes(unsigned n_max) {
+  LazyShapes::SetMaxResident(n_max);
+}
+
+void Systematic::ResolveLazyValues() const {
+  unsigned negative = 0;
+  lazy_->values(value_u_, value_d_, lazy_values_, negative);
+  if (negative) WarnNegativeBins(negative);
+}
+
+std::shared_ptr<TH1 const> Systematic::LazyShape(bool up) const {
+  unsigned negative = 0;
+  std::shared_ptr<TH1 const> res = lazy_->shape(up, negative);
+  if (negative) WarnNegativeBins(negative);
+  return res;
+}
+
+// The same warnings as CombineHarvester::LoadShapes gives for shapes that are
+// read straight away
+void Systematic::WarnNegativeBins(unsigned negative) const {
+  std::ostream & log = *(lazy_->warn_log());
+  if (negative & LazyShapes::kNegativeNominal) {
+    LOGLINE(log, "Warning: Systematic shape has negative bins");
+    log << Systematic::PrintHeader << *this << "\n";
+  }
+  if (negative & LazyShapes::kNegativeUp) {
+    LOGLINE(log, "Warning: Systematic shape_u has negative bins");
+    log << Systematic::PrintHeader << *this << "\n";
+  }
+  if (negative & LazyShapes::kNegativeDown) {
+    LOGLINE(log, "Warning: Systematic shape_d has negative bins");
+    log << Systematic::PrintHeader << *this << "\n";
+  }
+}
+
 std::unique_ptr<TH1> Systematic::ClonedShapeU() const {
-  if (!shape_u_) return std::unique_ptr<TH1>();
-  std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_u_->Clone()));
+  if (single_nominal_) return BuildSingleBinShape(true);
+  std::shared_ptr<TH1 const> shape_u = this->shape_u();
+  if (!shape_u) return std::unique_ptr<TH1>();
+  std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_u->Clone()));
   res->SetDirectory(0);
   return res;
 }
 
 std::unique_ptr<TH1> Systematic::ClonedShapeD() const {
-  if (!shape_d_) return std::unique_ptr<TH1>();
-  std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_d_->Clone()));
+  if (single_nominal_) return BuildSingleBinShape(false);
+  std::shared_ptr<TH1 const> shape_d = this->shape_d();
+  if (!shape_d) return std::unique_ptr<TH1>();
+  std::unique_ptr<TH1> res(static_cast<TH1 *>(shape_d->Clone()));
   res->SetDirectory(0);
   return res;
 }
@@ -188,8 +444,8 @@ std::ostream& operator<< (std::ostream &out, Systematic const& val) {
   % val.name()
   % val.type()
   % value_fmt
-  % (bool(val.shape_d()) || bool(val.data_d()))
-  % (bool(val.shape_u()) || bool(val.data_u()));
+  % (val.single_bin() || bool(val.shape_d()) || bool(val.data_d()))
+  % (val.single_bin() || bool(val.shape_u()) || bool(val.data_u()));
   return out;
 }
 }
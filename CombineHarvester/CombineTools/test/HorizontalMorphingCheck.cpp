@@ -0,0 +1,137 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <iostream>
+#include "TH1F.h"
+#include "CombineTools/interface/CombineHarvester.h"
+#include "CombineTools/interface/HorizontalMorphing.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+
+using namespace std;
+
+// Checks ch::HorizontalMorphingFactory on templates whose exact result is
+// known: the templates at the two pivot masses are identical apart from a
+// shift of one bin, so the template at a fraction w of the way between the
+// pivots must be the lower one shifted by w bins, i.e. each bin k gets
+// (1 - w) * lo[k] + w * lo[k - 1]. The rate is interpolated linearly. In
+// trivial mode the template of the nearest pivot is used instead, with the
+// same interpolated rate. Returns a non-zero exit code if any bin or rate
+// differs from the expected value.
+
+namespace {
+unsigned n_fail = 0;
+
+std::unique_ptr<TH1> MakeHist(vector<double> const& contents) {
+  std::unique_ptr<TH1> h(new TH1F("h", "h", contents.size(), 0.,
+                                  double(contents.size())));
+  h->SetDirectory(0);
+  for (unsigned k = 0; k < contents.size(); ++k) {
+    h->SetBinContent(k + 1, contents[k]);
+  }
+  return h;
+}
+
+vector<double> Shifted(vector<double> const& lo, double w) {
+  vector<double> res(lo.size());
+  double sum = 0.;
+  for (unsigned k = 0; k < lo.size(); ++k) {
+    res[k] = (1. - w) * lo[k] + (k > 0 ? w * lo[k - 1] : 0.);
+    sum += res[k];
+  }
+  for (auto & r : res) r /= sum;
+  return res;
+}
+
+void Compare(TH1 const* h, vector<double> const& expected,
+             string const& what) {
+  if (!h) {
+    cout << what << ": template is missing\n";
+    ++n_fail;
+    return;
+  }
+  for (unsigned k = 0; k < expected.size(); ++k) {
+    if (std::fabs(h->GetBinContent(k + 1) - expected[k]) > 1E-9) {
+      cout << what << ": bin " << k + 1 << " is " << h->GetBinContent(k + 1)
+           << ", expected " << expected[k] << "\n";
+      ++n_fail;
+    }
+  }
+}
+
+void CompareRate(double rate, double expected, string const& what) {
+  if (std::fabs(rate - expected) > 1E-9) {
+    cout << what << ": rate is " << rate << ", expected " << expected << "\n";
+    ++n_fail;
+  }
+}
+
+void Check(bool trivial) {
+  // Each template at mass 200 is the one at mass 100 moved up by one bin
+  vector<double> nom_lo = {0., 1., 2., 1., 0., 0.};
+  vector<double> nom_hi = {0., 0., 1., 2., 1., 0.};
+  vector<double> up_lo  = {0., 0., 1., 0., 0., 0.};
+  vector<double> up_hi  = {0., 0., 0., 1., 0., 0.};
+  double rate_lo = 4.;
+  double rate_hi = 8.;
+
+  ch::CombineHarvester cb;
+  cb.AddProcesses({"100", "200"}, {"htt"}, {"8TeV"}, {"mt"}, {"ggH"},
+                  {{0, "mt_inclusive"}}, true);
+  cb.ForEachProc([&](ch::Process *p) {
+    bool lo = p->mass() == "100";
+    p->set_shape(MakeHist(lo ? nom_lo : nom_hi), false);
+    p->set_rate(lo ? rate_lo : rate_hi);
+  });
+  cb.ForEachProc([&](ch::Process *p) {
+    cb.AddSystFromProc(*p, "shift", "shape", true, 1., 1.);
+  });
+  cb.ForEachSyst([&](ch::Systematic *s) {
+    bool lo = s->mass() == "100";
+    std::unique_ptr<TH1> nominal = MakeHist(lo ? nom_lo : nom_hi);
+    s->set_shapes(MakeHist(lo ? up_lo : up_hi), MakeHist(lo ? nom_lo : nom_hi),
+                  nominal.get());
+  });
+
+  ch::CombineHarvester src = cb.cp();
+  ch::HorizontalMorphingFactory().SetTrivial(trivial).AddMassPoints(
+      src, cb, {"125", "150"});
+
+  string mode = trivial ? " (trivial)" : "";
+  for (auto const& m : {make_pair(string("125"), 0.25),
+                        make_pair(string("150"), 0.5)}) {
+    // The templates of the nearest pivot in trivial mode, where a mass
+    // halfway between the pivots uses the upper one
+    double w = trivial ? (m.second < 0.5 ? 0. : 1.) : m.second;
+    unsigned n_procs = 0;
+    cb.cp().mass({m.first}).ForEachProc([&](ch::Process *p) {
+      ++n_procs;
+      Compare(p->shape(), Shifted(nom_lo, w),
+              "Nominal at mass " + m.first + mode);
+      CompareRate(p->rate(), rate_lo + (rate_hi - rate_lo) * m.second,
+                  "Nominal at mass " + m.first + mode);
+    });
+    cb.cp().mass({m.first}).ForEachSyst([&](ch::Systematic *s) {
+      Compare(s->ClonedShapeU().get(), Shifted(up_lo, w),
+              "Up template at mass " + m.first + mode);
+      Compare(s->ClonedShapeD().get(), Shifted(nom_lo, w),
+              "Down template at mass " + m.first + mode);
+    });
+    if (n_procs != 1) {
+      cout << "Expected one process at mass " << m.first << mode
+           << ", found " << n_procs << "\n";
+      ++n_fail;
+    }
+  }
+}
+}
+
+int main() {
+  Check(false);
+  Check(true);
+
+  cout << (n_fail ? "Horizontal morphing check FAILED"
+                  : "Horizontal morphing check OK") << "\n";
+  return n_fail ? 1 : 0;
+}
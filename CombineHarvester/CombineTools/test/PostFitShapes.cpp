@@ -37,6 +37,8 @@ int main(int argc, char* argv[]) {
   string output     = "";
   bool factors      = false;
   unsigned samples  = 500;
+  unsigned threads  = 1;
+  unsigned seed     = 0;
 
   po::options_description help_config("Help");
   help_config.add_options()
@@ -66,6 +68,12 @@ int main(int argc, char* argv[]) {
     ("samples",
       po::value<unsigned>(&samples)->default_value(samples),
       "Number of samples to make in each evaluate call")
+    ("threads",
+      po::value<unsigned>(&threads)->default_value(threads),
+      "Number of threads to use for the sampling, 0 for one per core")
+    ("seed",
+      po::value<unsigned>(&seed)->default_value(seed),
+      "Random number seed for the sampling")
     ("print",
       po::value<bool>(&factors)->default_value(factors)->implicit_value(true),
       "Print tables of background shifts and relative uncertainties");
@@ -137,6 +145,7 @@ int main(int argc, char* argv[]) {
         cmb_bin.cp().backgrounds().GetShapeWithUncertainty();
     pre_shapes[bin]["TotalSig"] =
         cmb_bin.cp().signals().GetShapeWithUncertainty();
+    pre_shapes[bin]["TotalProcs"] = cmb_bin.GetShapeWithUncertainty();
 
     // Can write these straight into the output file
     outfile.cd();
@@ -173,8 +182,9 @@ int main(int argc, char* argv[]) {
       for (auto bin : bins) {
         ch::CombineHarvester cmb_bkgs = cmb.cp().bin({bin}).backgrounds();
         double rate = cmb_bkgs.GetRate();
-        double err = sampling ? cmb_bkgs.GetUncertainty(res, samples)
-                              : cmb_bkgs.GetUncertainty();
+        double err = sampling
+                         ? cmb_bkgs.GetUncertainty(res, samples, threads, seed)
+                         : cmb_bkgs.GetUncertainty();
         cout << boost::format("%-25s %-10.5f\n") % bin %
                     (rate > 0. ? (err / rate) : 0.);
       }
@@ -191,14 +201,26 @@ int main(int argc, char* argv[]) {
 
     for (auto bin : bins) {
       ch::CombineHarvester cmb_bin = cmb.cp().bin({bin});
+      // Method to get the shape uncertainty depends on whether we are using
+      // the sampling method or the "wrong" method (assumes no correlations).
+      // With sampling, every process and the totals are evaluated together
+      // from the same set of samples.
+      if (sampling) {
+        post_shapes[bin] =
+            cmb_bin.GetShapesWithUncertainty(res, samples, threads, seed);
+      } else {
+        for (auto proc : cmb_bin.process_set()) {
+          post_shapes[bin][proc] =
+              cmb_bin.cp().process({proc}).GetShapeWithUncertainty();
+        }
+        post_shapes[bin]["TotalBkg"] =
+            cmb_bin.cp().backgrounds().GetShapeWithUncertainty();
+        post_shapes[bin]["TotalSig"] =
+            cmb_bin.cp().signals().GetShapeWithUncertainty();
+        post_shapes[bin]["TotalProcs"] = cmb_bin.GetShapeWithUncertainty();
+      }
       post_shapes[bin]["data_obs"] = cmb_bin.GetObservedShape();
       for (auto proc : cmb_bin.process_set()) {
-        auto cmb_proc = cmb_bin.cp().process({proc});
-        // Method to get the shape uncertainty depends on whether we are using
-        // the sampling method or the "wrong" method (assumes no correlations)
-        post_shapes[bin][proc] =
-            sampling ? cmb_proc.GetShapeWithUncertainty(res, samples)
-                     : cmb_proc.GetShapeWithUncertainty();
         // Print out the post/pre scale factors
         if (factors) {
           TH1 const& pre = pre_shapes[bin][proc];
@@ -208,15 +230,6 @@ int main(int argc, char* argv[]) {
                                            : 1.0);
         }
       }
-      // Fill the total sig. and total bkg. hists
-      auto cmb_bkgs = cmb_bin.cp().backgrounds();
-      auto cmb_sigs = cmb_bin.cp().signals();
-      post_shapes[bin]["TotalBkg"] =
-          sampling ? cmb_bkgs.GetShapeWithUncertainty(res, samples)
-                   : cmb_bkgs.GetShapeWithUncertainty();
-      post_shapes[bin]["TotalSig"] =
-          sampling ? cmb_sigs.GetShapeWithUncertainty(res, samples)
-                   : cmb_sigs.GetShapeWithUncertainty();
       outfile.cd();
       // Write the post-fit histograms
       for (auto & iter : post_shapes[bin]) {
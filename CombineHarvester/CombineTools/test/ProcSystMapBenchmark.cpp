@@ -0,0 +1,98 @@
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include "boost/program_options.hpp"
+#include "boost/lexical_cast.hpp"
+#include "CombineTools/interface/CombineHarvester.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+#include "CombineTools/interface/Utilities.h"
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+// Compares the time taken by CombineHarvester::GenerateProcSystMap, which
+// associates each Systematic with its Process through a hashed index, with
+// the original construction of the same map from every (Systematic, Process)
+// pair. The two maps are also checked to be identical.
+int main(int argc, char* argv[]) {
+  unsigned n_bins = 50;
+  unsigned n_procs = 10;
+  unsigned n_systs = 100;
+
+  po::options_description config("Configuration");
+  config.add_options()
+    ("help,h", "produce help message")
+    ("bins",  po::value<unsigned>(&n_bins)->default_value(n_bins),
+        "Number of categories")
+    ("procs", po::value<unsigned>(&n_procs)->default_value(n_procs),
+        "Number of processes per category")
+    ("systs", po::value<unsigned>(&n_systs)->default_value(n_systs),
+        "Number of lnN systematics per process");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(config).run(), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << config << "\n";
+    return 1;
+  }
+
+  ch::CombineHarvester cb;
+  ch::Categories cats;
+  for (unsigned b = 0; b < n_bins; ++b) {
+    cats.push_back({int(b), "bin_" + boost::lexical_cast<string>(b)});
+  }
+  vector<string> procs;
+  for (unsigned p = 0; p < n_procs; ++p) {
+    procs.push_back("proc_" + boost::lexical_cast<string>(p));
+  }
+  cb.AddProcesses({"*"}, {"htt"}, {"8TeV"}, {"mt"}, procs, cats, false);
+
+  vector<ch::Process *> all_procs;
+  cb.ForEachProc([&](ch::Process *p) {
+    p->set_rate(1.0);
+    all_procs.push_back(p);
+  });
+  for (auto p : all_procs) {
+    for (unsigned s = 0; s < n_systs; ++s) {
+      cb.AddSystFromProc(*p, "syst_" + boost::lexical_cast<string>(s), "lnN",
+                         false, 1.01, 0.);
+    }
+  }
+
+  vector<ch::Systematic *> all_systs;
+  cb.ForEachSyst([&](ch::Systematic *s) { all_systs.push_back(s); });
+  cout << "Processes:   " << all_procs.size() << "\n";
+  cout << "Systematics: " << all_systs.size() << "\n";
+
+  auto t0 = chrono::steady_clock::now();
+  ch::CombineHarvester::ProcSystMap indexed = cb.GenerateProcSystMap();
+  auto t1 = chrono::steady_clock::now();
+
+  // The original construction: every (Systematic, Process) pair is compared
+  ch::CombineHarvester::ProcSystMap pairwise(all_procs.size());
+  for (auto s : all_systs) {
+    for (unsigned j = 0; j < all_procs.size(); ++j) {
+      if (ch::MatchingProcess(*s, *(all_procs[j]))) {
+        pairwise[j].push_back(s);
+      }
+    }
+  }
+  auto t2 = chrono::steady_clock::now();
+
+  unsigned n_matched = 0;
+  for (auto const& systs : indexed) n_matched += systs.size();
+  double t_indexed = chrono::duration<double>(t1 - t0).count();
+  double t_pairwise = chrono::duration<double>(t2 - t1).count();
+  cout << "Matched pairs:              " << n_matched << "\n";
+  cout << "Identical maps:             " << (indexed == pairwise ? "yes" : "no")
+       << "\n";
+  cout << "GenerateProcSystMap:        " << t_indexed << " s\n";
+  cout << "Pairwise MatchingProcess:   " << t_pairwise << " s\n";
+  if (t_indexed > 0.) {
+    cout << "Speedup:                    " << t_pairwise / t_indexed << "\n";
+  }
+  return indexed == pairwise ? 0 : 1;
+}
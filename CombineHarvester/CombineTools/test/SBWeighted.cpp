@@ -62,9 +62,7 @@ int main(int argc, char* argv[]){
 
   ch::CombineHarvester cmb;
   // cmb.SetVerbosity(2);
-  for (auto const& d : datacards) {
-    cmb.ParseDatacard(d, parse_rule);
-  }
+  cmb.ParseDatacards(datacards, parse_rule);
   ch::SetStandardBinNames(cmb);
 
   RooFitResult* fitresult = nullptr;
@@ -130,8 +128,8 @@ int main(int argc, char* argv[]){
     });
     cmb_bin.ForEachSyst([&](ch::Systematic *e) {
       if (e->type() != "shape") return;
-      TH1 const* old_hd = e->shape_d();
-      TH1 const* old_hu = e->shape_u();
+      std::shared_ptr<TH1 const> old_hd = e->shape_d();
+      std::shared_ptr<TH1 const> old_hu = e->shape_u();
       std::unique_ptr<TH1> new_hd = ch::make_unique<TH1F>(TH1F(proto));
       std::unique_ptr<TH1> new_hu = ch::make_unique<TH1F>(TH1F(proto));
       for (int b = 1; b <= old_hd->GetNbinsX(); ++b) {
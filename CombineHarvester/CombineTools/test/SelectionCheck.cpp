@@ -0,0 +1,114 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <iostream>
+#include "TH1F.h"
+#include "CombineTools/interface/CombineHarvester.h"
+#include "CombineTools/interface/Selection.h"
+#include "CombineTools/interface/Observation.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+
+using namespace std;
+
+// Checks that chains of ch::Selection filters select the same entries, in
+// the same order, as the equivalent chains of CombineHarvester filters. The
+// test instance has enough entries that every bitmap spans several words.
+// Returns a non-zero exit code if any chain differs.
+
+namespace {
+unsigned n_fail = 0;
+
+template <typename T>
+void CompareEntries(vector<T *> const& a, vector<T *> const& b,
+                    string const& what, string const& name) {
+  if (a != b) {
+    cout << name << ": " << what << " differ (" << a.size() << " selected, "
+         << b.size() << " expected)\n";
+    ++n_fail;
+  }
+}
+
+void Compare(ch::Selection sel, ch::CombineHarvester cb, string const& name) {
+  vector<ch::Observation *> obs_a, obs_b, obs_c;
+  vector<ch::Process *> procs_a, procs_b, procs_c;
+  vector<ch::Systematic *> systs_a, systs_b, systs_c;
+  sel.ForEachObs([&](ch::Observation *x) { obs_a.push_back(x); });
+  sel.ForEachProc([&](ch::Process *x) { procs_a.push_back(x); });
+  sel.ForEachSyst([&](ch::Systematic *x) { systs_a.push_back(x); });
+  ch::CombineHarvester mat = sel.Materialize();
+  mat.ForEachObs([&](ch::Observation *x) { obs_b.push_back(x); });
+  mat.ForEachProc([&](ch::Process *x) { procs_b.push_back(x); });
+  mat.ForEachSyst([&](ch::Systematic *x) { systs_b.push_back(x); });
+  cb.ForEachObs([&](ch::Observation *x) { obs_c.push_back(x); });
+  cb.ForEachProc([&](ch::Process *x) { procs_c.push_back(x); });
+  cb.ForEachSyst([&](ch::Systematic *x) { systs_c.push_back(x); });
+  CompareEntries(obs_a, obs_c, "observations", name);
+  CompareEntries(procs_a, procs_c, "processes", name);
+  CompareEntries(systs_a, systs_c, "systematics", name);
+  CompareEntries(obs_b, obs_c, "materialized observations", name);
+  CompareEntries(procs_b, procs_c, "materialized processes", name);
+  CompareEntries(systs_b, systs_c, "materialized systematics", name);
+}
+}
+
+int main() {
+  ch::Categories cats;
+  for (int i = 0; i < 30; ++i) cats.push_back({i, "b" + to_string(i)});
+
+  ch::CombineHarvester cb;
+  cb.AddObservations({"*"}, {"htt"}, {"8TeV"}, {"mt"}, cats);
+  cb.AddProcesses({"*"}, {"htt"}, {"8TeV"}, {"mt"}, {"ZTT", "QCD"}, cats,
+                  false);
+  cb.AddProcesses({"120", "125", "130"}, {"htt"}, {"8TeV"}, {"mt"}, {"ggH"},
+                  cats, true);
+  cb.AddProcesses({"125"}, {"htt"}, {"7TeV"}, {"et"}, {"ggH"}, cats, true);
+  cb.ForEachProc([&](ch::Process *p) {
+    cb.AddSystFromProc(*p, "lumi", "lnN", false, 1.05, 1.05);
+    if (p->signal()) {
+      cb.AddSystFromProc(*p, "scale", "shape", false, 1., 1.);
+    }
+  });
+  cb.ForEachProc([&](ch::Process *p) {
+    if (p->process() == "ZTT" || p->bin_id() % 4 == 0) {
+      std::unique_ptr<TH1> h(new TH1F("h", "h", 2, 0., 2.));
+      h->SetDirectory(0);
+      h->SetBinContent(1, 1.);
+      p->set_shape(std::move(h), false);
+    }
+  });
+
+  ch::Selection all(cb);
+  Compare(all.cp(), cb.cp(), "no filter");
+  Compare(all.cp().bin({"b3"}), cb.cp().bin({"b3"}), "bin");
+  Compare(all.cp().bin({"b3", "b29", "unknown"}),
+          cb.cp().bin({"b3", "b29", "unknown"}), "bin list");
+  Compare(all.cp().bin({"b3"}, false).process({"ggH"}),
+          cb.cp().bin({"b3"}, false).process({"ggH"}), "bin and process");
+  Compare(all.cp().mass({"125"}).signals(), cb.cp().mass({"125"}).signals(),
+          "mass and signals");
+  Compare(all.cp().backgrounds().histograms(),
+          cb.cp().backgrounds().histograms(), "backgrounds and histograms");
+  Compare(all.cp().bin_id({1, 5, 28}).syst_name({"lumi"}),
+          cb.cp().bin_id({1, 5, 28}).syst_name({"lumi"}),
+          "bin_id and syst_name");
+  Compare(all.cp().syst_type({"shape"}, false).era({"8TeV"}),
+          cb.cp().syst_type({"shape"}, false).era({"8TeV"}),
+          "syst_type and era");
+  Compare(all.cp().analysis({"htt"}).channel({"et"}, false),
+          cb.cp().analysis({"htt"}).channel({"et"}, false),
+          "analysis and channel");
+  auto odd = [](ch::Object const* obj) { return obj->bin_id() % 2 == 1; };
+  Compare(all.cp().process({"QCD"}, false).FilterAll(odd),
+          cb.cp().process({"QCD"}, false).FilterAll(odd),
+          "process and FilterAll");
+
+  // Filtering a copy must not change the view it was copied from
+  ch::Selection sel = all.cp().bin({"b7"});
+  sel.cp().process({"ZTT"});
+  Compare(sel, cb.cp().bin({"b7"}), "copy of a view");
+
+  cout << (n_fail ? "Selection check FAILED" : "Selection check OK") << "\n";
+  return n_fail ? 1 : 0;
+}
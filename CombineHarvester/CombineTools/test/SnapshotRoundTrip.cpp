@@ -0,0 +1,194 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include "TSystem.h"
+#include "TH1.h"
+#include "boost/program_options.hpp"
+#include "CombineTools/interface/CombineHarvester.h"
+#include "CombineTools/interface/Observation.h"
+#include "CombineTools/interface/Process.h"
+#include "CombineTools/interface/Systematic.h"
+#include "CombineTools/interface/Parameter.h"
+#include "CombineTools/interface/BinByBin.h"
+
+namespace po = boost::program_options;
+
+using namespace std;
+
+// Parses a datacard, optionally adds bin-by-bin uncertainties, saves a
+// snapshot of it, loads the snapshot into a new instance and checks that the
+// two instances contain the same objects, rates, shapes (including their
+// binning and whether they are stored as single-bin shapes) and parameters.
+// Returns a non-zero exit code if any difference is found.
+
+namespace {
+unsigned n_diffs = 0;
+
+void Report(string const& what, string const& obj) {
+  ++n_diffs;
+  cout << "Difference in " << what << " of " << obj << "\n";
+}
+
+string Describe(ch::Object const* obj) {
+  return obj->bin() + "/" + obj->process();
+}
+
+void CompareObject(ch::Object const* a, ch::Object const* b) {
+  if (a->bin() != b->bin() || a->process() != b->process() ||
+      a->signal() != b->signal() || a->analysis() != b->analysis() ||
+      a->era() != b->era() || a->channel() != b->channel() ||
+      a->bin_id() != b->bin_id() || a->mass() != b->mass()) {
+    Report("properties", Describe(a));
+  }
+}
+
+void CompareHist(TH1 const* a, TH1 const* b, string const& obj) {
+  if (!a || !b) {
+    if (a || b) Report("shape presence", obj);
+    return;
+  }
+  if (a->InheritsFrom("TH1F") != b->InheritsFrom("TH1F") ||
+      a->GetNbinsX() != b->GetNbinsX() ||
+      a->GetXaxis()->IsVariableBinSize() !=
+          b->GetXaxis()->IsVariableBinSize()) {
+    Report("shape type or binning", obj);
+    return;
+  }
+  for (int i = 1; i <= a->GetNbinsX() + 1; ++i) {
+    if (a->GetBinLowEdge(i) != b->GetBinLowEdge(i)) {
+      Report("shape bin edges", obj);
+      return;
+    }
+  }
+  for (int i = 0; i <= a->GetNbinsX() + 1; ++i) {
+    if (a->GetBinContent(i) != b->GetBinContent(i) ||
+        a->GetBinError(i) != b->GetBinError(i)) {
+      Report("shape contents", obj);
+      return;
+    }
+  }
+}
+}
+
+int main(int argc, char* argv[]) {
+  string datacard = "";
+  string mass = "";
+  string snapshot = "";
+  double bbb = 0.;
+
+  gSystem->Load("libHiggsAnalysisCombinedLimit.dylib");
+
+  po::options_description config("Configuration");
+  config.add_options()
+    ("help,h", "produce help message")
+    ("input,i",    po::value<string>(&datacard)->required(),
+        "The datacard .txt file [REQUIRED]")
+    ("snapshot,s", po::value<string>(&snapshot)->required(),
+        "Name of the snapshot file to create [REQUIRED]")
+    ("mass,m",     po::value<string>(&mass)->default_value(""),
+        "Signal mass point of the input datacard")
+    ("bbb,b",      po::value<double>(&bbb)->default_value(0.),
+        "Add bin-by-bin uncertainties above this threshold (0 for none)");
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(config).run(), vm);
+  if (vm.count("help")) {
+    cout << config << "\n";
+    cout << "Example usage: " << endl;
+    cout << "SnapshotRoundTrip -i htt_mt_125.txt -s htt_mt_125.snap -m 125 -b 0.1\n";
+    return 1;
+  }
+  po::notify(vm);
+
+  TH1::AddDirectory(false);
+  ch::CombineHarvester cmb;
+  cmb.ParseDatacard(datacard, "", "", "", 0, mass);
+  if (bbb > 0.) {
+    ch::BinByBinFactory().SetAddThreshold(bbb).AddBinByBin(cmb, cmb);
+  }
+  cmb.SaveSnapshot(snapshot);
+
+  ch::CombineHarvester loaded;
+  loaded.LoadSnapshot(snapshot);
+
+  vector<ch::Observation *> obs_a, obs_b;
+  vector<ch::Process *> procs_a, procs_b;
+  vector<ch::Systematic *> systs_a, systs_b;
+  cmb.ForEachObs([&](ch::Observation *x) { obs_a.push_back(x); });
+  loaded.ForEachObs([&](ch::Observation *x) { obs_b.push_back(x); });
+  cmb.ForEachProc([&](ch::Process *x) { procs_a.push_back(x); });
+  loaded.ForEachProc([&](ch::Process *x) { procs_b.push_back(x); });
+  cmb.ForEachSyst([&](ch::Systematic *x) { systs_a.push_back(x); });
+  loaded.ForEachSyst([&](ch::Systematic *x) { systs_b.push_back(x); });
+
+  if (obs_a.size() != obs_b.size() || procs_a.size() != procs_b.size() ||
+      systs_a.size() != systs_b.size()) {
+    cout << "Number of objects differs after loading the snapshot\n";
+    return 1;
+  }
+
+  for (unsigned i = 0; i < obs_a.size(); ++i) {
+    CompareObject(obs_a[i], obs_b[i]);
+    if (obs_a[i]->rate() != obs_b[i]->rate()) {
+      Report("rate", Describe(obs_a[i]));
+    }
+    CompareHist(obs_a[i]->shape(), obs_b[i]->shape(), Describe(obs_a[i]));
+  }
+
+  for (unsigned i = 0; i < procs_a.size(); ++i) {
+    CompareObject(procs_a[i], procs_b[i]);
+    if (procs_a[i]->rate() != procs_b[i]->rate()) {
+      Report("rate", Describe(procs_a[i]));
+    }
+    CompareHist(procs_a[i]->shape(), procs_b[i]->shape(),
+                Describe(procs_a[i]));
+  }
+
+  for (unsigned i = 0; i < systs_a.size(); ++i) {
+    ch::Systematic const* a = systs_a[i];
+    ch::Systematic const* b = systs_b[i];
+    string desc = Describe(a) + "/" + a->name();
+    CompareObject(a, b);
+    if (a->name() != b->name() || a->type() != b->type() ||
+        a->value_u() != b->value_u() || a->value_d() != b->value_d() ||
+        a->scale() != b->scale() || a->asymm() != b->asymm()) {
+      Report("values", desc);
+    }
+    if (a->single_bin() != b->single_bin() ||
+        a->single_bin_content_u() != b->single_bin_content_u() ||
+        a->single_bin_content_d() != b->single_bin_content_d()) {
+      Report("single-bin shapes", desc);
+    } else if (a->single_bin()) {
+      CompareHist(a->single_bin_nominal(), b->single_bin_nominal(),
+                  desc + " (single-bin nominal)");
+    }
+    CompareHist(a->ClonedShapeU().get(), b->ClonedShapeU().get(),
+                desc + " (up)");
+    CompareHist(a->ClonedShapeD().get(), b->ClonedShapeD().get(),
+                desc + " (down)");
+  }
+
+  auto params_a = cmb.GetParameters();
+  auto params_b = loaded.GetParameters();
+  if (params_a.size() != params_b.size()) {
+    cout << "Number of parameters differs after loading the snapshot\n";
+    return 1;
+  }
+  for (unsigned i = 0; i < params_a.size(); ++i) {
+    ch::Parameter const& a = params_a[i];
+    ch::Parameter const& b = params_b[i];
+    if (a.name() != b.name() || a.val() != b.val() ||
+        a.err_u() != b.err_u() || a.err_d() != b.err_d() ||
+        a.range_u() != b.range_u() || a.range_d() != b.range_d()) {
+      Report("values", "parameter " + a.name());
+    }
+  }
+
+  if (cmb.GetRate() != loaded.GetRate()) Report("total rate", "all processes");
+
+  cout << "Observations: " << obs_a.size() << ", Processes: " << procs_a.size()
+       << ", Systematics: " << systs_a.size()
+       << ", Parameters: " << params_a.size() << "\n";
+  cout << (n_diffs ? "Snapshot round trip FAILED" : "Snapshot round trip OK")
+       << "\n";
+  return n_diffs ? 1 : 0;
+}
@@ -66,9 +66,7 @@ int main(int argc, char* argv[]){
   po::notify(vm);
 
   ch::CombineHarvester cmb;
-  for (auto const& d : datacards) {
-    cmb.ParseDatacard(d, parse_rule);
-  }
+  cmb.ParseDatacards(datacards, parse_rule);
   ch::SetStandardBinNames(cmb);
 
 
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <utility>
 #include <iostream>
 
@@ -19,7 +20,9 @@
 
    \brief   Class to return pre-calculated values for cross sections and branching ratios from FeynHiggs
 
-   To follow soon 
+   Each variable is read from the input tree once, on first access, into a dense
+   grid with one cell per (mA, tanb) bin of the scan. All further queries for
+   that variable are answered from this grid for the lifetime of the object.
 */
 
 class FeynHiggsScan {
@@ -30,8 +33,10 @@ class FeynHiggsScan {
   /// default destructor
   ~FeynHiggsScan();
 
-  /// get cross section ot br from tree for given value of mA and tanb
-  float get(const char* variable, const char* model, const char* type, float mA, float tanb);
+  /// get cross section ot br from tree for given value of mA and tanb (bilinear interpolation between scan points if interpolate is true)
+  float get(const char* variable, const char* model, const char* type, float mA, float tanb, bool interpolate=false);
+  /// same as above for a list of (mA, tanb) points; the result is returned in the same order as points
+  std::vector<float> get(const char* variable, const char* model, const char* type, const std::vector<std::pair<float, float> >& points, bool interpolate=false);
   /// production cross section for mH for given mA and tanb 
   float xsec(const char* variable, const char* model, double mA, double tanb) { return get(variable, model, "xs", mA, tanb); };
   /// branching ratio for mH for given mA and tanb 
@@ -44,12 +49,24 @@ class FeynHiggsScan {
   float mh(float mA, float tanb) { return mass(std::string("mh"), mA, tanb); };
  
  private:
+  /// dense (mA, tanb) grid for a single variable, cell index is iMA+nMA_*iTanb
+  struct Grid {
+    /// sum of all entries per cell (equivalent to the former 2d projection)
+    std::vector<float> values;
+    /// value of the first entry per cell, used for exact matches in mass
+    std::vector<float> first;
+  };
+
   /// book branches for all variables or a subset of them
   void book(const std::string& var);
   /// set branch addresses for all variables or a subset of them 
   void read(const std::string& var);
-  /// loop tree project the information of interest out and return int in form of a 2d histogram
-  TH2F* project(const std::string& var);
+  /// return the grid for the information of interest; the tree is looped only on first access to var
+  const Grid& grid(const std::string& var);
+  /// index of the cell that contains (mA, tanb), -1 if outside of the scan
+  int cell(double mA, double tanb) const;
+  /// look up a single point in grid
+  float lookup(const Grid& grid, float mA, float tanb, bool interpolate) const;
   
  private:
   /// verbosity level
@@ -58,14 +75,20 @@ class FeynHiggsScan {
   double minTanb_, maxTanb_, stepTanb_;
   /// min and max of mA scan
   double minMA_, maxMA_, stepMA_;
+  /// number of bins in tanb and mA
+  unsigned int nTanb_, nMA_;
   /// input file containing cross section and BR information
   TFile* file_;
   /// input tree containing cross section and BR information
   TTree* tree_;
-  /// 2d projection of the information of interst 
-  TH2F* hproject_;
   /// 2d conrtrol plot to make sure that the scan went OK
   TH2F* hscan_;
+  /// cached grids per variable
+  std::map<std::string, Grid> grids_;
+  /// mA and tanb of the first entry per cell (common to all variables)
+  std::vector<float> cellMA_, cellTanb_;
+  /// flag whether a cell has been filled by any entry
+  std::vector<char> filled_;
 
   /// input parameters 
   float tanb_, mA_, var_;
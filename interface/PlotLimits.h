@@ -130,6 +130,16 @@ class PlotLimits {
   /// +2sigma :  0.975 quantile
   /// mean    : mean value of distribution 
   void prepareByToy(const char* directory, std::vector<double>& values, const char* type);
+  /// mean and quantiles of the toy limits for a single mass point, as determined by harvestByToy
+  struct ToyQuantiles {
+    /// false if the input file or the limit tree could not be found
+    bool valid;
+    /// mean, 0.027, 0.16, 0.5, 0.84 and 0.975 quantiles of the distribution (-1 if there are no toys)
+    double mean, minus2sigma, minus1sigma, median, plus1sigma, plus2sigma;
+  };
+  /// read the toy limits for all mass points in a single pass and determine all quantiles at once. The 
+  /// result is cached so that later calls to prepareByToy for other types do not read the files again.
+  const std::vector<ToyQuantiles>& harvestByToy(const char* directory);
   /// fill a single vector of values by value in the root input file with name filename (w/o .root ending). 
   /// Valid values are: 
   /// -1.     : observed
@@ -139,6 +149,26 @@ class PlotLimits {
   /// 0.84    : +1sigma
   /// 0.975   : +2sigma
   void prepareByValue(const char* directory, std::vector<double>& values, const char* filename, float value);
+  /// limit values by quantileExpected for a single mass point, as read by harvestByValue
+  struct LimitsByQuantile {
+    /// false if the input file or the limit tree could not be found
+    bool valid;
+    /// limit value for each quantileExpected (last entry in the tree wins)
+    std::map<float, double> values;
+    /// limitErr for each quantileExpected (zero if not present in the tree)
+    std::map<float, double> errors;
+  };
+  /// read all quantiles for all mass points from the root input files with name filename (w/o .root ending). 
+  /// Each file is opened only once, the result is cached so that later calls to prepareByValue for other 
+  /// quantiles of the same input files do not read them again. If enabled the result is also stored in a limit cache file in directory, 
+  /// which is used instead of the input files as long as none of these has been added, removed or modified.
+  const std::vector<LimitsByQuantile>& harvestByValue(const char* directory, const char* filename);
+  /// paths, sizes and modification times of the input files for all mass points, used to validate the limit cache
+  std::string limitFingerprint(const char* directory, const char* filename);
+  /// fill limits from the limit cache file cachepath, returns false if it does not exist or is out of date
+  bool readLimitCache(const char* cachepath, const std::string& fingerprint, std::vector<LimitsByQuantile>& limits);
+  /// write limits to the limit cache file cachepath, a columnar TTree with mass, quantile, limit and limitErr
+  void writeLimitCache(const char* cachepath, const std::string& fingerprint, const std::vector<LimitsByQuantile>& limits);
   /// fill a single vector of values from a single file given by filename (w/o .root ending).
   void prepareByFile(const char* directory, std::vector<double>& values, const char* filename, const char* low_tanb="");
   /// fill a single vector of values from a mlfit.root fit output file.
@@ -212,6 +242,8 @@ class PlotLimits {
   unsigned int verbosity_;
   /// parabolic fit for mass scan
   bool parabolic_;
+  /// read and write limit cache files in the input directories (used for limit plotting)
+  bool cache_;
 
   /// indicate whether mssm or sm plots should be made (used fro several options)
   bool mssm_;
@@ -273,6 +305,10 @@ class PlotLimits {
   std::vector<bool> valid_;
   /// mass for which a limit has been calculated (needed for plotting of HIG-XX-YYY results)
   std::vector<double> masses_;
+  /// limits by quantile for each mass point, cached per directory and input file name by harvestByValue
+  std::map<std::string, std::vector<LimitsByQuantile> > harvested_;
+  /// mean and quantiles of the toy limits for each mass point, cached per directory by harvestByToy
+  std::map<std::string, std::vector<ToyQuantiles> > toys_;
 };
 
 /// official limits from HIG-11-020
@@ -1,12 +1,10 @@
 #include "HiggsAnalysis/HiggsToTauTau/interface/FeynHiggsScan.h"
 
 FeynHiggsScan::FeynHiggsScan(const char* fileName, const char* treeName, unsigned int n_tanb, double min_tanb, double max_tanb, unsigned int n_mA, double min_mA, double max_mA) :
-  verbose_(false), minTanb_(min_tanb), maxTanb_(max_tanb), stepTanb_((max_tanb-min_tanb)/n_tanb), minMA_(min_mA), maxMA_(max_mA), stepMA_((max_mA-min_mA)/n_mA)
+  verbose_(false), minTanb_(min_tanb), maxTanb_(max_tanb), stepTanb_((max_tanb-min_tanb)/n_tanb), minMA_(min_mA), maxMA_(max_mA), stepMA_((max_mA-min_mA)/n_mA), nTanb_(n_tanb), nMA_(n_mA)
 {
   // book TH2F for check that filling went OK
   hscan_    = new TH2F("hscan"    , "hscan"    , n_mA, min_mA, max_mA, n_tanb, min_tanb, max_tanb);
-  // book TH2F for projections
-  hproject_ = new TH2F("hproject" , "hproject" , n_mA, min_mA, max_mA, n_tanb, min_tanb, max_tanb);
   // open input file
   file_= TFile::Open(fileName, "read");
   // get input tree
@@ -16,54 +14,133 @@ FeynHiggsScan::FeynHiggsScan(const char* fileName, const char* treeName, unsigne
 FeynHiggsScan::~FeynHiggsScan()
 {
   delete hscan_;
-  delete hproject_;
   file_->Close();  
 }
 
 float
 FeynHiggsScan::mass(const std::string& variable, float mA, float tanb)
 {
-  read(variable); 
-  float mass=0.;
+  const Grid& scan = grid(variable);
+  // entries are filled into the cell of (mA+step/2, tanb+step/2), so look there
+  // for an entry with exactly the requested mA and tanb
+  int idx = cell(mA+stepMA_/2., tanb+stepTanb_/2.);
+  if(idx<0 || !filled_[idx] || cellMA_[idx]!=mA || cellTanb_[idx]!=tanb){
+    return 0.;
+  }
+  return scan.first[idx];
+}
+
+const FeynHiggsScan::Grid&
+FeynHiggsScan::grid(const std::string& var)
+{
+  std::map<std::string, Grid>::const_iterator cached = grids_.find(var);
+  if(cached!=grids_.end()){
+    return cached->second;
+  }
+  unsigned int ncells = nMA_*nTanb_;
+  Grid& grid = grids_[var];
+  grid.values.assign(ncells, 0.);
+  grid.first .assign(ncells, 0.);
+  // the cell layout is the same for all variables, fill it on the first pass only
+  bool layout = filled_.empty();
+  if(layout){
+    filled_  .assign(ncells, 0 );
+    cellMA_  .assign(ncells, 0.);
+    cellTanb_.assign(ncells, 0.);
+    hscan_->Reset();
+  }
+  std::vector<char> seen(ncells, 0);
+
+  read(var);
+  // only read the branches that are needed
+  tree_->SetBranchStatus("*"         , 0);
+  tree_->SetBranchStatus("tanb"      , 1);
+  tree_->SetBranchStatus("mA"        , 1);
+  tree_->SetBranchStatus(var.c_str() , 1);
   unsigned int nevent = tree_->GetEntries();
   if(verbose_){ std::cout << "tree size = " << nevent << std::endl; }
   for(unsigned int idx=0; idx<nevent; ++idx){
-    tree_->GetEvent(idx);
+    tree_->GetEntry(idx);
     if(verbose_){ std::cout << "tanb = " << tanb_ << "  |  mA = " << mA_ << std::endl; }
-    if(mA_==mA && tanb_==tanb){
-      mass = var_;
-      break;
+    if(layout){
+      hscan_->Fill(mA_+stepMA_/2., tanb_+stepTanb_/2., 1.);
+    }
+    int icell = cell(mA_+stepMA_/2., tanb_+stepTanb_/2.);
+    if(icell<0){
+      continue;
+    }
+    grid.values[icell] += var_;
+    if(!seen[icell]){
+      seen[icell] = 1;
+      grid.first[icell] = var_;
+      if(layout){
+	filled_  [icell] = 1;
+	cellMA_  [icell] = mA_;
+	cellTanb_[icell] = tanb_;
+      }
     }
   }
-  return mass;
+  tree_->SetBranchStatus("*", 1);
+  return grid;
 }
 
-TH2F* 
-FeynHiggsScan::project(const std::string& var)
+int
+FeynHiggsScan::cell(double mA, double tanb) const
 {
-  read(var); 
-  hscan_->Clear(); hproject_->Clear();
-  unsigned int nevent = tree_->GetEntries();
-  if(verbose_){ std::cout << "tree size = " << nevent << std::endl; }
-  for(unsigned int idx=0; idx<nevent; ++idx){
-    tree_->GetEvent(idx);
-    if(verbose_){ std::cout << "tanb = " << tanb_ << "  |  mA = " << mA_ << std::endl; }
-    hscan_->Fill(mA_+stepMA_/2., tanb_+stepTanb_/2., 1.);
-    hproject_->Fill(mA_+stepMA_/2., tanb_+stepTanb_/2., var_);
+  if(!(minMA_<=mA && mA<maxMA_ && minTanb_<=tanb && tanb<maxTanb_)){
+    return -1;
+  }
+  // same binning as TAxis::FindBin for equidistant bins
+  unsigned int iMA   = (unsigned int)(nMA_  *(mA  -minMA_  )/(maxMA_  -minMA_  ));
+  unsigned int iTanb = (unsigned int)(nTanb_*(tanb-minTanb_)/(maxTanb_-minTanb_));
+  if(iMA>=nMA_ || iTanb>=nTanb_){
+    return -1;
+  }
+  return iMA+nMA_*iTanb;
+}
+
+float
+FeynHiggsScan::lookup(const Grid& grid, float mA, float tanb, bool interpolate) const
+{
+  int idx = cell(mA, tanb);
+  if(idx<0){
+    return -999.;
+  }
+  if(!interpolate){
+    return grid.values[idx];
   }
-  return hproject_;
+  // bilinear interpolation between the scan points at the lower edges of the
+  // cells; at the upper edge of the scan the last scan point is used
+  unsigned int iMA   = idx%nMA_;
+  unsigned int iTanb = idx/nMA_;
+  unsigned int jMA   = iMA  +1<nMA_   ? iMA  +1 : iMA;
+  unsigned int jTanb = iTanb+1<nTanb_ ? iTanb+1 : iTanb;
+  double tMA   = (mA  -(minMA_  +iMA  *stepMA_  ))/stepMA_;
+  double tTanb = (tanb-(minTanb_+iTanb*stepTanb_))/stepTanb_;
+  return (1.-tMA)*(1.-tTanb)*grid.values[iMA+nMA_*iTanb]
+    +         tMA*(1.-tTanb)*grid.values[jMA+nMA_*iTanb]
+    +         (1.-tMA)*tTanb*grid.values[iMA+nMA_*jTanb]
+    +             tMA*tTanb*grid.values[jMA+nMA_*jTanb];
 }
 
 float
-FeynHiggsScan::get(const char* variable, const char* model, const char* type, float mA, float tanb)
+FeynHiggsScan::get(const char* variable, const char* model, const char* type, float mA, float tanb, bool interpolate)
+{
+  std::string varname(std::string(type)+"_"+std::string(model)+"_"+std::string(variable));
+  return lookup(grid(varname), mA, tanb, interpolate);
+}
+
+std::vector<float>
+FeynHiggsScan::get(const char* variable, const char* model, const char* type, const std::vector<std::pair<float, float> >& points, bool interpolate)
 {
-  float result = -999.;
   std::string varname(std::string(type)+"_"+std::string(model)+"_"+std::string(variable));
-  TH2F* hist = project(varname); 
-  if( minMA_<=mA && mA<maxMA_ && minTanb_<=tanb && tanb<maxTanb_){
-    result = hist->GetBinContent(hist->FindBin(mA, tanb));
+  const Grid& scan = grid(varname);
+  std::vector<float> results;
+  results.reserve(points.size());
+  for(std::vector<std::pair<float, float> >::const_iterator point=points.begin(); point!=points.end(); ++point){
+    results.push_back(lookup(scan, point->first, point->second, interpolate));
   }
-  return result;
+  return results;
 }
 
 void
@@ -13,6 +13,7 @@ PlotLimits::PlotLimits(const char* output, const edm::ParameterSet& cfg) :
   txt_  (cfg.existsAs<bool  >("txt" ) ? cfg.getParameter<bool  >("txt" ) : false),
   root_ (cfg.existsAs<bool  >("root") ? cfg.getParameter<bool  >("root") : false),
   parabolic_ (cfg.existsAs<bool  >("parabolic") ? cfg.getParameter<bool  >("parabolic") : false),
+  cache_ (cfg.existsAs<bool  >("limitCache") ? cfg.getParameter<bool  >("limitCache") : true),
   mssm_ (cfg.existsAs<bool  >("mssm") ? cfg.getParameter<bool  >("mssm") : false),
   mssm_nolog_ (cfg.existsAs<bool  >("mssm_nolog") ? cfg.getParameter<bool  >("mssm_nolog") : false)
 {
@@ -1,5 +1,38 @@
 #include "HiggsAnalysis/HiggsToTauTau/interface/PlotLimits.h"
 
+#include "TNamed.h"
+#include "TSystem.h"
+#include <RVersion.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace {
+/// call harvest(imass) for all mass points, concurrently if the ROOT version allows to read files
+/// from several threads. The results for each mass point are written to separate slots, so no
+/// locking is needed.
+template <typename Function>
+void harvestMassPoints(unsigned int n, Function harvest)
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  unsigned int n_threads = std::min<unsigned int>(std::thread::hardware_concurrency(), n);
+  if(n_threads>1){
+    ROOT::EnableThreadSafety();
+    std::atomic<unsigned int> next(0);
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<n_threads; ++t){
+      threads.emplace_back([&]() {
+        for(unsigned int i=next++; i<n; i=next++){ harvest(i); }
+      });
+    }
+    for(unsigned int t=0; t<n_threads; ++t){ threads[t].join(); }
+    return;
+  }
+#endif
+  for(unsigned int i=0; i<n; ++i){ harvest(i); }
+}
+}
+
 void
 PlotLimits::prepareByFitOutput(const char* directory, std::vector<double>& values, const char* filename, const char* treename, const char* branchname)
 {
@@ -29,6 +62,7 @@ PlotLimits::prepareByFitOutput(const char* directory, std::vector<double>& value
       }
       file->Close();
     }
+    delete file;
     values.push_back(value);
   }
   return;
@@ -85,42 +119,56 @@ PlotLimits::prepareByFile(const char* directory, std::vector<double>& values, co
 	file->Close();
       } 
     }
+    delete file;
     values.push_back(value); 
   }
   return;
 }
 
-void
-PlotLimits::prepareByToy(const char* directory, std::vector<double>& values, const char* type)
+const std::vector<PlotLimits::ToyQuantiles>&
+PlotLimits::harvestByToy(const char* directory)
 {
-  for(unsigned int imass=0; imass<bins_.size(); ++imass){
+  std::map<std::string, std::vector<ToyQuantiles> >::const_iterator cached = toys_.find(directory);
+  if(cached!=toys_.end()){
+    return cached->second;
+  }
+  std::vector<ToyQuantiles>& toys = toys_[directory];
+  toys.resize(bins_.size());
+  // messages are collected per mass point and printed in order once all files have been read
+  std::vector<std::string> messages(bins_.size());
+  harvestMassPoints(bins_.size(), [&](unsigned int imass) {
+    std::string& message = messages[imass];
     // buffer mass
     float mass = bins_[imass];
-
-    double value=-1.;
+    ToyQuantiles& result = toys[imass];
+    result.valid = true;
+    result.mean = result.minus2sigma = result.minus1sigma = result.median = result.plus1sigma = result.plus2sigma = -1.;
     TString fullpath(TString::Format("%s/%d/batch_collected_%s.root", directory, (int)mass, label_.c_str()));
-    if(verbosity_>0) std::cout << "INFO: opening file " << fullpath << std::endl;
+    message += std::string("INFO: opening file ")+(const char*)fullpath+"\n";
     TFile* file = new TFile(fullpath);
     if(file->IsZombie()){
-      if(verbosity_>0){ std::cout << "INFO: file not found: " << fullpath  << std::endl; }
-      valid_[imass]=false;
+      message += std::string("INFO: file not found: ")+(const char*)fullpath+"\n";
+      result.valid = false;
     }
     else{
       TTree* limit = (TTree*) file->Get("limit");
       if(!limit){
-	if(verbosity_>0){ std::cout << "INFO: tree not found: limit" << std::endl; }
-	valid_[imass]=false;
+	message += "INFO: tree not found: limit\n";
+	result.valid = false;
       }
       else{
 	double x;
 	double mean=0, var=0;
-	// vector for simple median determination
-	std::vector<double> limits;
+	limit->SetBranchStatus("*", 0);
+	limit->SetBranchStatus("limit", 1);
 	limit->SetBranchAddress("limit", &x);
 	int nevent = limit->GetEntries();
-    for(int i=0; i<nevent; ++i){
-      limit->GetEvent(i);
-	  // fill for median determination
+	// vector for quantile determination
+	std::vector<double> limits;
+	limits.reserve(nevent);
+	for(int i=0; i<nevent; ++i){
+	  limit->GetEvent(i);
+	  // fill for quantile determination
 	  limits.push_back(x);
 	  // mean(x)
 	  mean +=1./(i+1)*(x-mean);
@@ -129,74 +177,255 @@ PlotLimits::prepareByToy(const char* directory, std::vector<double>& values, con
 	}
 	// var = mean(x**2)-mean(x)**2
 	var-= mean*mean;
-	// sort for quantile determination
-	std::sort(limits.begin(), limits.end());
-	
-	/*
-	for(unsigned int i=0; i<limits.size(); ++i){
-	  var+=1./limits.size()*(limits[i]-mean)*(limits[i]-mean);
-	}
-	*/
-
+	result.mean = mean;
 	// using standard deviations can result in bands that span below 0
 	// we therefore use quantiles here for +/-1 and +/-2 sigma. The
-	// mean remains as is.
-	if(std::string(type)==std::string("MEAN")){ value= mean; }
-	else if(std::string(type)==std::string("+2SIGMA")){ value= limits[(int)(0.975*limits.size())];}//+2*sqrt(var);}
-	else if(std::string(type)==std::string("+1SIGMA")){ value= limits[(int)(0.840*limits.size())];}//+1*sqrt(var);}
-	else if(std::string(type)==std::string( "MEDIAN")){ value= limits[(int)(0.500*limits.size())];}
-	else if(std::string(type)==std::string("-1SIGMA")){ value= limits[(int)(0.160*limits.size())];}//-1*sqrt(var);}
-	else if(std::string(type)==std::string("-2SIGMA")){ value= limits[(int)(0.027*limits.size())];}//-2*sqrt(var);}
-	else{
-	  std::cout << "ERROR: picked wrong type. Available types are: +2sigma, +1sigma, mean, median, -1sigma, -2sigma" << std::endl
-		    << "       for the moment I'll stop here" << std::endl;
-	  exit(1);
+	// mean remains as is. All quantiles are determined in one go with
+	// increasing indices, each nth_element only has to partition the
+	// part of the vector above the previous quantile. The result is 
+	// the same as picking the index from the fully sorted vector.
+	if(!limits.empty()){
+	  double* quantiles[] = { &result.minus2sigma, &result.minus1sigma, &result.median, &result.plus1sigma, &result.plus2sigma };
+	  const double fractions[] = { 0.027, 0.160, 0.500, 0.840, 0.975 };
+	  std::vector<double>::iterator first = limits.begin();
+	  for(unsigned int iq=0; iq<5; ++iq){
+	    std::vector<double>::iterator nth = limits.begin()+(int)(fractions[iq]*limits.size());
+	    std::nth_element(first, nth, limits.end());
+	    *quantiles[iq] = *nth;
+	    first = nth;
+	  }
 	}
       }
       file->Close();
     }
+    delete file;
+  });
+  if(verbosity_>0){
+    for(unsigned int imass=0; imass<bins_.size(); ++imass){ std::cout << messages[imass]; }
+  }
+  return toys;
+}
+
+void
+PlotLimits::prepareByToy(const char* directory, std::vector<double>& values, const char* type)
+{
+  const std::vector<ToyQuantiles>& toys = harvestByToy(directory);
+  for(unsigned int imass=0; imass<bins_.size(); ++imass){
+    double value=-1.;
+    if(!toys[imass].valid){
+      valid_[imass]=false;
+    }
+    else{
+      if(std::string(type)==std::string("MEAN")){ value= toys[imass].mean; }
+      else if(std::string(type)==std::string("+2SIGMA")){ value= toys[imass].plus2sigma; }
+      else if(std::string(type)==std::string("+1SIGMA")){ value= toys[imass].plus1sigma; }
+      else if(std::string(type)==std::string( "MEDIAN")){ value= toys[imass].median; }
+      else if(std::string(type)==std::string("-1SIGMA")){ value= toys[imass].minus1sigma; }
+      else if(std::string(type)==std::string("-2SIGMA")){ value= toys[imass].minus2sigma; }
+      else{
+	std::cout << "ERROR: picked wrong type. Available types are: +2sigma, +1sigma, mean, median, -1sigma, -2sigma" << std::endl
+		  << "       for the moment I'll stop here" << std::endl;
+	exit(1);
+      }
+    }
     values.push_back(value);
   }
   return;
 }
 
+std::string
+PlotLimits::limitFingerprint(const char* directory, const char* filename)
+{
+  std::string buffer = std::string(filename);
+  std::string filehead = buffer.substr(0, buffer.find("$MASS"));
+  std::string filetail = buffer.substr(buffer.find("$MASS")+5, std::string::npos);
+  std::string fingerprint;
+  for(unsigned int imass=0; imass<bins_.size(); ++imass){
+    TString fullpath(TString::Format("%s/%d/%s%d%s.root", directory, (int)bins_[imass], filehead.c_str(), (int)bins_[imass], filetail.c_str()));
+    Long_t id, size, flags, modtime;
+    if(gSystem->GetPathInfo(fullpath, &id, &size, &flags, &modtime)!=0){
+      size=-1; modtime=-1;
+    }
+    // the size catches files that are rewritten within the one second resolution of the modification time
+    fingerprint += std::string(TString::Format("%s %ld %ld\n", (const char*)fullpath, size, modtime));
+  }
+  return fingerprint;
+}
+
+bool
+PlotLimits::readLimitCache(const char* cachepath, const std::string& fingerprint, std::vector<LimitsByQuantile>& limits)
+{
+  if(gSystem->AccessPathName(cachepath)){
+    return false;
+  }
+  TFile* file = new TFile(cachepath);
+  bool success=false;
+  if(!file->IsZombie()){
+    TNamed* stored = (TNamed*) file->Get("fingerprint");
+    TTree* masspoints = (TTree*) file->Get("masspoints");
+    TTree* limit = (TTree*) file->Get("limits");
+    if(stored && masspoints && limit && fingerprint==std::string(stored->GetTitle()) && masspoints->GetEntries()==(Long64_t)bins_.size()){
+      float mass; bool valid;
+      masspoints->SetBranchAddress("mass", &mass);
+      masspoints->SetBranchAddress("valid", &valid);
+      std::map<float, unsigned int> index;
+      for(unsigned int imass=0; imass<bins_.size(); ++imass){
+	masspoints->GetEntry(imass);
+	limits[imass].valid = valid;
+	index[mass] = imass;
+      }
+      float quantile; double x, xerr;
+      limit->SetBranchAddress("mass", &mass);
+      limit->SetBranchAddress("quantile", &quantile);
+      limit->SetBranchAddress("limit", &x);
+      limit->SetBranchAddress("limitErr", &xerr);
+      int nevent = limit->GetEntries();
+      for(int i=0; i<nevent; ++i){
+	limit->GetEntry(i);
+	unsigned int imass = index[mass];
+	limits[imass].values[quantile] = x;
+	limits[imass].errors[quantile] = xerr;
+      }
+      success=true;
+    }
+    file->Close();
+  }
+  delete file;
+  if(verbosity_>0){ std::cout << "INFO: limit cache " << cachepath << (success ? " is up to date" : " is out of date") << std::endl; }
+  return success;
+}
+
 void
-PlotLimits::prepareByValue(const char* directory, std::vector<double>& values, const char* filename, float ConLevel)
+PlotLimits::writeLimitCache(const char* cachepath, const std::string& fingerprint, const std::vector<LimitsByQuantile>& limits)
 {
+  TFile* file = new TFile(cachepath, "RECREATE");
+  if(file->IsZombie()){
+    if(verbosity_>0){ std::cout << "INFO: could not write limit cache: " << cachepath << std::endl; }
+    delete file;
+    return;
+  }
+  TNamed stored("fingerprint", fingerprint.c_str());
+  stored.Write();
+  float mass, quantile; bool valid; double x, xerr;
+  TTree* masspoints = new TTree("masspoints", "masspoints");
+  masspoints->Branch("mass", &mass, "mass/F");
+  masspoints->Branch("valid", &valid, "valid/O");
+  TTree* limit = new TTree("limits", "limits");
+  limit->Branch("mass", &mass, "mass/F");
+  limit->Branch("quantile", &quantile, "quantile/F");
+  limit->Branch("limit", &x, "limit/D");
+  limit->Branch("limitErr", &xerr, "limitErr/D");
   for(unsigned int imass=0; imass<bins_.size(); ++imass){
+    mass = bins_[imass];
+    valid = limits[imass].valid;
+    masspoints->Fill();
+    for(std::map<float, double>::const_iterator it=limits[imass].values.begin(); it!=limits[imass].values.end(); ++it){
+      quantile = it->first;
+      x = it->second;
+      xerr = limits[imass].errors.find(it->first)->second;
+      limit->Fill();
+    }
+  }
+  file->Write();
+  file->Close();
+  delete file;
+  if(verbosity_>0){ std::cout << "INFO: wrote limit cache " << cachepath << std::endl; }
+}
+
+const std::vector<PlotLimits::LimitsByQuantile>&
+PlotLimits::harvestByValue(const char* directory, const char* filename)
+{
+  std::string key = std::string(directory)+std::string("/")+std::string(filename);
+  std::map<std::string, std::vector<LimitsByQuantile> >::const_iterator cached = harvested_.find(key);
+  if(cached!=harvested_.end()){
+    return cached->second;
+  }
+  std::vector<LimitsByQuantile>& limits = harvested_[key];
+  limits.resize(bins_.size());
+  // try the limit cache in directory first, it is only used if none of the input files has changed
+  std::string cachename = std::string(filename);
+  if(cachename.find("$MASS")!=std::string::npos){
+    cachename.replace(cachename.find("$MASS"), 5, "X");
+  }
+  TString cachepath(TString::Format("%s/%s.limitcache.root", directory, cachename.c_str()));
+  std::string fingerprint;
+  if(cache_){
+    fingerprint = limitFingerprint(directory, filename);
+    if(readLimitCache(cachepath, fingerprint, limits)){
+      return limits;
+    }
+  }
+  std::string buffer = std::string(filename);
+  std::string filehead = buffer.substr(0, buffer.find("$MASS"));
+  std::string filetail = buffer.substr(buffer.find("$MASS")+5, std::string::npos);
+  // messages are collected per mass point and printed in order once all files have been read
+  std::vector<std::string> messages(bins_.size());
+  harvestMassPoints(bins_.size(), [&](unsigned int imass) {
+    std::string& message = messages[imass];
     // buffer mass
     float mass = bins_[imass];
-    double value=-1.;
-    std::string buffer = std::string(filename);
-    std::string filehead = buffer.substr(0, buffer.find("$MASS"));
-    std::string filetail = buffer.substr(buffer.find("$MASS")+5, std::string::npos);
+    limits[imass].valid = true;
     TString fullpath(TString::Format("%s/%d/%s%d%s.root", directory, (int)mass, filehead.c_str(), (int)mass, filetail.c_str()));
-    if(verbosity_>0) std::cout << "INFO: opening file " << fullpath << std::endl;
+    message += std::string("INFO: opening file ")+(const char*)fullpath+"\n";
     TFile* file = new TFile(fullpath);
     if(file->IsZombie()){
-      if(verbosity_>0){ std::cout << "INFO: file not found: " << fullpath  << std::endl; }
-      valid_[imass]=false;
+      message += std::string("INFO: file not found: ")+(const char*)fullpath+"\n";
+      limits[imass].valid = false;
     }
     else{
       TTree* limit = (TTree*) file->Get("limit");
       if(!limit){
-	if(verbosity_>0){ std::cout << "INFO: tree not found: limit" << std::endl; }
-	valid_[imass]=false;
+	message += "INFO: tree not found: limit\n";
+	limits[imass].valid = false;
       }
       else{
-	double x; float y;
+	// only the branches needed here are read from the file
+	double x, xerr=0.; float y;
+	limit->SetBranchStatus("*", 0);
+	limit->SetBranchStatus("limit", 1);
+	limit->SetBranchStatus("quantileExpected", 1);
 	limit->SetBranchAddress("limit", &x);
 	limit->SetBranchAddress("quantileExpected", &y);
+	if(limit->GetBranch("limitErr")){
+	  limit->SetBranchStatus("limitErr", 1);
+	  limit->SetBranchAddress("limitErr", &xerr);
+	}
 	int nevent = limit->GetEntries();
 	for(int i=0; i<nevent; ++i){
 	  limit->GetEvent(i);
-	  if(y==ConLevel){
-	    value = x;
-	  }
+	  // the last entry for each quantile wins
+	  limits[imass].values[y] = x;
+	  limits[imass].errors[y] = xerr;
 	}
       }
       file->Close();
     }
+    delete file;
+  });
+  if(verbosity_>0){
+    for(unsigned int imass=0; imass<bins_.size(); ++imass){ std::cout << messages[imass]; }
+  }
+  if(cache_){
+    writeLimitCache(cachepath, fingerprint, limits);
+  }
+  return limits;
+}
+
+void
+PlotLimits::prepareByValue(const char* directory, std::vector<double>& values, const char* filename, float ConLevel)
+{
+  const std::vector<LimitsByQuantile>& limits = harvestByValue(directory, filename);
+  for(unsigned int imass=0; imass<bins_.size(); ++imass){
+    double value=-1.;
+    if(!limits[imass].valid){
+      valid_[imass]=false;
+    }
+    else{
+      std::map<float, double>::const_iterator match = limits[imass].values.find(ConLevel);
+      if(match!=limits[imass].values.end()){
+	value = match->second;
+      }
+    }
     values.push_back(value);
   }
   return;
@@ -5,6 +5,10 @@
 #include <TGraph2D.h>
 #include <TSpline.h>
 #include <TMath.h>
+#include <RVersion.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 /// This is the core plotting routine that can also be used within
 /// root macros. It is therefore not element of the PlotLimits class.
@@ -24,6 +28,110 @@ struct myclass {
   bool operator() (int i,int j) { return (i<j);}
 } myobject;
 
+namespace {
+/// names of the bands as used for the branches of the HypothesisTest tree
+const char* tanbBands[6] = {"minus2sigma", "minus1sigma", "expected", "plus1sigma", "plus2sigma", "observed"};
+
+/// CLs values of all bands for a single mass point, sorted by increasing tanb
+struct TanbScan {
+  TanbScan() : status(0) {}
+  /// 0: file could not be opened, 1: tree not found, 2: ok
+  int status;
+  std::vector<double> tanb;
+  /// one vector for each of the bands in tanbBands
+  std::vector<double> bands[6];
+};
+
+/// read the HypothesisTest tree in path in a single sequential pass and sort it by tanb
+void loadTanbScan(const char* path, TanbScan& scan)
+{
+  TFile* file = TFile::Open(path);
+  if(!file){ return; }
+  TTree* limit = (TTree*) file->Get("tree");
+  if(!limit){
+    scan.status = 1;
+  }
+  else{
+    scan.status = 2;
+    double tanb; double values[6];
+    limit->SetBranchStatus("*", 0);
+    limit->SetBranchStatus("tanb", 1);
+    limit->SetBranchAddress("tanb", &tanb);
+    for(int ib=0; ib<6; ++ib){
+      limit->SetBranchStatus(tanbBands[ib], 1);
+      limit->SetBranchAddress(tanbBands[ib], &values[ib]);
+    }
+    int nevent = limit->GetEntries();
+    std::vector<double> tanbs(nevent), rows(6*nevent);
+    for(int i=0; i<nevent; ++i){
+      limit->GetEntry(i);
+      tanbs[i] = tanb;
+      for(int ib=0; ib<6; ++ib){ rows[6*i+ib] = values[ib]; }
+    }
+    std::vector<int> index(nevent);
+    for(int i=0; i<nevent; ++i){ index[i] = i; }
+    std::stable_sort(index.begin(), index.end(), [&](int a, int b) { return tanbs[a] < tanbs[b]; });
+    scan.tanb.resize(nevent);
+    for(int ib=0; ib<6; ++ib){ scan.bands[ib].resize(nevent); }
+    for(int i=0; i<nevent; ++i){
+      scan.tanb[i] = tanbs[index[i]];
+      for(int ib=0; ib<6; ++ib){ scan.bands[ib][i] = rows[6*index[i]+ib]; }
+    }
+  }
+  file->Close();
+  delete file;
+}
+
+/// load the scans for all mass points, concurrently if the ROOT version allows to read files from
+/// several threads
+void loadTanbScans(const std::vector<TString>& paths, std::vector<TanbScan>& scans)
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  unsigned int n_threads = std::min<unsigned int>(std::thread::hardware_concurrency(), paths.size());
+  if(n_threads>1){
+    ROOT::EnableThreadSafety();
+    std::atomic<unsigned int> next(0);
+    std::vector<std::thread> threads;
+    for(unsigned int t=0; t<n_threads; ++t){
+      threads.emplace_back([&]() {
+        for(unsigned int i=next++; i<paths.size(); i=next++){ loadTanbScan(paths[i], scans[i]); }
+      });
+    }
+    for(unsigned int t=0; t<n_threads; ++t){ threads[t].join(); }
+    return;
+  }
+#endif
+  for(unsigned int i=0; i<paths.size(); ++i){ loadTanbScan(paths[i], scans[i]); }
+}
+
+/// evaluate the points (x, y), sorted by x, at xq. This gives the same result as TGraph::Eval, using 
+/// spline if given or linear interpolation otherwise, but without searching all points for each call
+double evalSorted(const std::vector<double>& x, const std::vector<double>& y, double xq, TSpline3* spline=0)
+{
+  int n = x.size();
+  if(n==0){ return 0; }
+  if(n==1){ return y[0]; }
+  if(spline){ return spline->Eval(xq); }
+  int lo = std::lower_bound(x.begin(), x.end(), xq)-x.begin();
+  if(lo<n && x[lo]==xq){ return y[lo]; }
+  // outside of the range the two points at the nearest end are used for extrapolation
+  int up = lo<1 ? 1 : (lo>n-1 ? n-1 : lo);
+  int low = up-1;
+  if(x[low]==x[up]){ return y[low]; }
+  return y[up] + (xq-x[up])*(y[low]-y[up])/(x[low]-x[up]);
+}
+
+/// get all contour graphs of h2 at threshold
+void contourGraphs(TH2* h2, double threshold, double multip, std::vector<TGraph*>& graphs)
+{
+  TList* contours = contourFromTH2(h2, threshold, 20, false, multip);
+  if(!contours){ return; }
+  for(int i=0; i<contours->GetSize(); ++i){
+    graphs.push_back((TGraph *)contours->At(i));
+  }
+}
+}
+
   void
 PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
 {
@@ -50,87 +158,72 @@ PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
   // set up styles
   SetStyle();
 
-  //vectors of graphs from the tanb-CLs control plots used for tex/txt printing
-  std::vector<TGraph*> v_graph_minus2sigma;
-  std::vector<TGraph*> v_graph_minus1sigma;
-  std::vector<TGraph*> v_graph_expected;
-  std::vector<TGraph*> v_graph_plus1sigma;
-  std::vector<TGraph*> v_graph_plus2sigma;
-  std::vector<TGraph*> v_graph_observed;
-  float masses[50];
+  //vectors of graphs from the tanb-CLs control plots used for tex/txt printing (one per band)
+  std::vector<TGraph*> v_graphs[6];
+  std::vector<TGraph*>& v_graph_minus2sigma = v_graphs[0];
+  std::vector<TGraph*>& v_graph_minus1sigma = v_graphs[1];
+  std::vector<TGraph*>& v_graph_expected    = v_graphs[2];
+  std::vector<TGraph*>& v_graph_plus1sigma  = v_graphs[3];
+  std::vector<TGraph*>& v_graph_plus2sigma  = v_graphs[4];
+  std::vector<TGraph*>& v_graph_observed    = v_graphs[5];
+  std::vector<float> masses(bins_.size());
 
-  int nxbins=0;
-  int array_number=0;
-  if(model==TString::Format("2HDMtyp1") || model==TString::Format("2HDMtyp2")) array_number = (int)((bins_[bins_.size()-1]-bins_[0])/0.02)+1;
-  else if(model==TString::Format("lowmH")) array_number = 30;
-  else array_number = (int)(bins_[bins_.size()-1]-bins_[0])/10+1; 
-  Double_t xbins[array_number];
-  
+  std::vector<Double_t> xbins;
   if(model==TString::Format("lowmH")) {
     for(double mass=300; mass<3100+1; mass=mass+100){
-      xbins[nxbins]=mass;
-      nxbins++;
+      xbins.push_back(mass);
     }
-    xbins[nxbins]=3100+1;
+    xbins.push_back(3100+1);
   }
   else if(model!=TString::Format("2HDMtyp1") && model!=TString::Format("2HDMtyp2")){
     for(float mass=bins_[0]; mass<bins_[bins_.size()-1]+1; mass=mass+10){
-      xbins[nxbins]=mass;
-      nxbins++;;
+      xbins.push_back(mass);
     }
-    xbins[nxbins]=bins_[bins_.size()-1]+1;
+    xbins.push_back(bins_[bins_.size()-1]+1);
   }
   else {
     for(double mass=bins_[0]; mass<bins_[bins_.size()-1]+0.01; mass=mass+0.02){
-      xbins[nxbins]=mass;
-      nxbins++;
+      xbins.push_back(mass);
     }
-    xbins[nxbins]=bins_[bins_.size()-1]+0.01;
+    xbins.push_back(bins_[bins_.size()-1]+0.01);
   }
+  int nxbins=xbins.size()-1;
+  int nybins=(int)((tanbHigh-tanbLow)*10-1);
 
-  TH2D *plane_minus2sigma = 0, *plane_minus1sigma = 0, *plane_expected = 0, *plane_plus1sigma = 0, *plane_plus2sigma = 0, *plane_observed = 0;
-
-  if(model!=TString::Format("lowmH")) {
-    plane_minus2sigma = new TH2D("minus2sigma","minus2sigma", nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_minus1sigma = new TH2D("minus1sigma","minus1sigma", nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_expected    = new TH2D("expected","expected",       nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_plus1sigma  = new TH2D("plus1sigma","plus1sigma",   nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_plus2sigma  = new TH2D("plus2sigma","plus2sigma",   nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_observed    = new TH2D("observed","observed",       nxbins, xbins, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
+  TH2D* planes[6];
+  TH2D* th2ds[6];
+  for(int ib=0; ib<6; ++ib){
+    if(model!=TString::Format("lowmH")) {
+      planes[ib] = new TH2D(tanbBands[ib], tanbBands[ib], nxbins, &xbins[0], nybins, tanbLow, tanbHigh);
+    }
+    else {
+      planes[ib] = new TH2D(tanbBands[ib], tanbBands[ib], 29, 300, 3100, nybins, tanbLow, tanbHigh);
+    }
   }
-  else { 
-    plane_minus2sigma = new TH2D("minus2sigma","minus2sigma", 29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_minus1sigma = new TH2D("minus1sigma","minus1sigma", 29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_expected    = new TH2D("expected",   "expected",    29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_plus1sigma  = new TH2D("plus1sigma","plus1sigma",   29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_plus2sigma  = new TH2D("plus2sigma","plus2sigma",   29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
-    plane_observed    = new TH2D("observed","observed",       29, 300, 3100, (int)((tanbHigh-tanbLow)*10-1), tanbLow, tanbHigh);
+  for(int ib=0; ib<6; ++ib){
+    TString name = TString::Format("%s_th2d", tanbBands[ib]);
+    th2ds[ib] = new TH2D(name, name, 4*nxbins, xbins[0], xbins[nxbins-1], nybins, tanbLow, tanbHigh);
   }
+  TH2D* plane_expected = planes[2];
+  TAxis* xaxis = plane_expected->GetXaxis();
+  TAxis* yaxis = plane_expected->GetYaxis();
 
-
-  for(int idx=1; idx<plane_minus2sigma->GetNbinsX()+1; idx++){
-    for(int idy=1; idy<plane_minus2sigma->GetNbinsY()+1; idy++){
-      plane_minus2sigma->SetBinContent(idx, idy, 1.1);
-      plane_minus1sigma->SetBinContent(idx, idy, 1.1);
-      plane_expected   ->SetBinContent(idx, idy, 1.1);
-      plane_plus1sigma ->SetBinContent(idx, idy, 1.1);
-      plane_plus2sigma ->SetBinContent(idx, idy, 1.1);
-      plane_observed   ->SetBinContent(idx, idy, 1.1);
+  // The planes are filled and interpolated as flat arrays in the same (x,y) bin layout as the TH2D 
+  // (including under- and overflow). They are only copied to the TH2D once all is done.
+  int nx = plane_expected->GetNbinsX();
+  int ny = plane_expected->GetNbinsY();
+  int row = nx+2;
+  std::vector<double> flat[6];
+  for(int ib=0; ib<6; ++ib){
+    flat[ib].assign(row*(ny+2), 0.);
+    for(int idx=1; idx<nx+1; idx++){
+      for(int idy=1; idy<ny+1; idy++){
+	flat[ib][idx+row*idy] = 1.1;
+      }
     }
   }
   
-  TGraph2D* graph_minus2sigma_2d = 0;
-  TGraph2D* graph_minus1sigma_2d = 0;
-  TGraph2D* graph_expected_2d = 0;
-  TGraph2D* graph_plus1sigma_2d = 0;
-  TGraph2D* graph_plus2sigma_2d = 0;
-  TGraph2D* graph_observed_2d =0;
-  TH2D *minus2sigma_th2d =new TH2D("minus2sigma_th2d","minus2sigma_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
-  TH2D *minus1sigma_th2d =new TH2D("minus1sigma_th2d","minus1sigma_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
-  TH2D *expected_th2d =new TH2D("expected_th2d","expected_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
-  TH2D *plus1sigma_th2d =new TH2D("plus1sigma_th2d","plus1sigma_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
-  TH2D *plus2sigma_th2d =new TH2D("plus2sigma_th2d","plus2sigma_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
-  TH2D *observed_th2d =new TH2D("observed_th2d","observed_th2d",4*nxbins,xbins[0],xbins[nxbins-1],(int)((tanbHigh-tanbLow)*10-1),tanbLow,tanbHigh);
+  TGraph2D* graphs_2d[6] = {0, 0, 0, 0, 0, 0};
   
   if(HIG != ""){
     std::cout << "NO LONGER SUPPORTED" << std::endl;
@@ -138,173 +231,87 @@ PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
   else{
     //2D Graphs 
     int kTwod=0;
-    graph_minus2sigma_2d = new TGraph2D();
-    graph_minus1sigma_2d = new TGraph2D();
-    graph_expected_2d = new TGraph2D();
-    graph_plus1sigma_2d = new TGraph2D();
-    graph_plus2sigma_2d = new TGraph2D();
-    graph_observed_2d = new TGraph2D();
+    for(int ib=0; ib<6; ++ib){ graphs_2d[ib] = new TGraph2D(); }
+
+    // load all mass points first
+    std::vector<TString> paths(bins_.size());
+    for(unsigned int imass=0; imass<bins_.size(); ++imass){
+      float mass = bins_[imass];
+      paths[imass] = TString::Format("%s/%d/HypothesisTest.root", directory, (int)mass);
+      if (model==TString::Format("2HDMtyp1") || model==TString::Format("2HDMtyp2")){ 
+	if(bins_[imass]!=(int)bins_[imass]) paths[imass] = TString::Format("%s/%0.1f/HypothesisTest.root", directory, bins_[imass]);
+	else paths[imass] = TString::Format("%s/%d/HypothesisTest.root",directory,(int)mass);
+      }
+    }
+    std::vector<TanbScan> scans(bins_.size());
+    loadTanbScans(paths, scans);
     
     for(unsigned int imass=0; imass<bins_.size(); ++imass){
       // buffer mass value
       float mass = bins_[imass];    
-      //control plots
-      TGraph* graph_minus2sigma = new TGraph();
-      TGraph* graph_minus1sigma = new TGraph();
-      TGraph* graph_expected = new TGraph();
-      TGraph* graph_plus1sigma = new TGraph();
-      TGraph* graph_plus2sigma = new TGraph();
-      TGraph* graph_observed = new TGraph();
-      //log scale for plotting
-      TGraph* graph_minus2sigma_log = new TGraph();
-      TGraph* graph_minus1sigma_log = new TGraph();
-      TGraph* graph_expected_log = new TGraph();
-      TGraph* graph_plus1sigma_log = new TGraph();
-      TGraph* graph_plus2sigma_log = new TGraph();
-      TGraph* graph_observed_log = new TGraph();
-
-
-      TString fullpath = TString::Format("%s/%d/HypothesisTest.root", directory, (int)mass);
-      if (model==TString::Format("2HDMtyp1") || model==TString::Format("2HDMtyp2")){ 
-	if(bins_[imass]!=(int)bins_[imass]) fullpath = TString::Format("%s/%0.1f/HypothesisTest.root", directory, bins_[imass]);
-	else fullpath = TString::Format("%s/%d/HypothesisTest.root",directory,(int)mass);
+      std::cout << "open file: " << paths[imass] << std::endl;
+      const TanbScan& scan = scans[imass];
+      if(scan.status==0){ std::cout << "--> TFile is corrupt: skipping masspoint." << std::endl; continue; }
+      if(scan.status==1){ std::cout << "--> TTree is corrupt: skipping masspoint." << std::endl; continue; }
+      int nevent = scan.tanb.size();
+      int idx = xaxis->FindBin(mass);
+      //control plots and log values for linear and spline fits (log makes the splines more stable)
+      TGraph* graphs[6];
+      std::vector<double> logs[6];
+      for(int ib=0; ib<6; ++ib){
+	graphs[ib] = new TGraph(nevent);
+	logs[ib].resize(nevent);
       }
-      std::cout << "open file: " << fullpath << std::endl;
-      TFile* file_ = TFile::Open(fullpath); if(!file_){ std::cout << "--> TFile is corrupt: skipping masspoint." << std::endl; continue; }
-      TTree* limit = (TTree*) file_->Get("tree"); if(!limit){ std::cout << "--> TTree is corrupt: skipping masspoint." << std::endl; continue; }
-      double tanb, exp, obs, plus1sigma, minus1sigma, plus2sigma, minus2sigma;
-      limit->SetBranchAddress("tanb", &tanb );  
-      limit->SetBranchAddress("minus2sigma", &minus2sigma);
-      limit->SetBranchAddress("minus1sigma", &minus1sigma);
-      limit->SetBranchAddress("expected", &exp);
-      limit->SetBranchAddress("plus1sigma", &plus1sigma); 
-      limit->SetBranchAddress("plus2sigma", &plus2sigma);  
-      limit->SetBranchAddress("observed", &obs);  
-      int nevent = limit->GetEntries();   
-      //Drawing variable tanb with no graphics option.
-      //variable tanb stored in array fV1 (see TTree::Draw)
-      limit->Draw("tanb","","goff");
-      Int_t *index = new Int_t[nevent];
-      //sort array containing tanb in decreasing order
-      //The array index contains the entry numbers in increasing order in respect to tanb
-      TMath::Sort(nevent,limit->GetV1(),index,false); //changed from true (=default) =decreasing order
-      int k=0; double xmax=0; double ymax=0; //stuff needed for fitting;
-      // loop to find the crosspoint between low and high exclusion (tanbLowHigh)_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), plane_observed   ->GetYaxis()->FindBin(tanb), obs/exclusion_);
       for(int i=0; i<nevent; ++i){
-	limit->GetEntry(index[i]);
-	//filling control plots
-	graph_minus2sigma->SetPoint(k, tanb, minus2sigma/exclusion_);
-	graph_minus1sigma->SetPoint(k, tanb, minus1sigma/exclusion_);
-	graph_expected   ->SetPoint(k, tanb, exp/exclusion_);
-	graph_plus1sigma ->SetPoint(k, tanb, plus1sigma/exclusion_);
-	graph_plus2sigma ->SetPoint(k, tanb, plus2sigma/exclusion_);
-	graph_observed   ->SetPoint(k, tanb, obs/exclusion_);
-	//filling plots for linear and spline fits (log makes the splines more stable)
-	if(minus2sigma==0) minus2sigma=0.0001;
-	if(minus1sigma==0) minus1sigma=0.0001;
-	if(exp==0) exp=0.0001;
-	if(plus1sigma==0) plus1sigma=0.0001;
-	if(plus2sigma==0) plus2sigma=0.0001;
-	if(obs==0) obs=0.0001;
-	graph_minus2sigma_log->SetPoint(k, tanb, TMath::Log(minus2sigma/exclusion_));
-	graph_minus1sigma_log->SetPoint(k, tanb, TMath::Log(minus1sigma/exclusion_));
-	graph_expected_log   ->SetPoint(k, tanb, TMath::Log(exp/exclusion_));
-	graph_plus1sigma_log ->SetPoint(k, tanb, TMath::Log(plus1sigma/exclusion_));
-	graph_plus2sigma_log ->SetPoint(k, tanb, TMath::Log(plus2sigma/exclusion_));
-	graph_observed_log   ->SetPoint(k, tanb, TMath::Log(obs/exclusion_));
-	k++;      
-	for(int j=0; j<graph_minus2sigma->GetN(); j++){ 
-	  if(graph_minus2sigma->GetY()[j]>ymax && graph_minus2sigma->GetX()[j]>=1) {ymax=graph_minus2sigma->GetY()[j]; xmax=graph_minus2sigma->GetX()[j]; tanbLowHigh=xmax;} //tanb>=1 hardcoded to fix that point 	  
-	}
-
-	// Fill TH2D with calculated limit points
-	if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
-	  plane_minus2sigma->SetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), plane_minus2sigma->GetYaxis()->FindBin(tanb), TMath::Log(minus2sigma/exclusion_));
-	  plane_minus1sigma->SetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), plane_minus1sigma->GetYaxis()->FindBin(tanb), TMath::Log(minus1sigma/exclusion_));
-	  plane_expected   ->SetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), plane_expected   ->GetYaxis()->FindBin(tanb), TMath::Log(exp/exclusion_));
-	  plane_plus1sigma ->SetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), plane_plus1sigma ->GetYaxis()->FindBin(tanb), TMath::Log(plus1sigma/exclusion_));
-	  plane_plus2sigma ->SetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), plane_plus2sigma ->GetYaxis()->FindBin(tanb), TMath::Log(plus2sigma/exclusion_));
-	  plane_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), plane_observed   ->GetYaxis()->FindBin(tanb), TMath::Log(obs/exclusion_));
+	double tanb = scan.tanb[i];
+	int idy = yaxis->FindBin(tanb);
+	for(int ib=0; ib<6; ++ib){
+	  double value = scan.bands[ib][i];
+	  //filling control plots
+	  graphs[ib]->SetPoint(i, tanb, value/exclusion_);
+	  if(value==0) value=0.0001;
+	  logs[ib][i] = TMath::Log(value/exclusion_);
+	  // Fill TH2D with calculated limit points
+	  if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
+	    flat[ib][idx+row*idy] = logs[ib][i];
+	  }
+	  else if(FitMethod_==2){ //TGraph2D interpolation
+	    graphs_2d[ib]->SetPoint(kTwod, mass, tanb, value/exclusion_);
+	  }
 	}
-	else if(FitMethod_==2){ //TGraph2D interpolation
-	  graph_minus2sigma_2d->SetPoint(kTwod,mass,tanb,minus2sigma/exclusion_);
-	  graph_minus1sigma_2d->SetPoint(kTwod,mass,tanb,minus1sigma/exclusion_);
-	  graph_expected_2d->SetPoint(kTwod,mass,tanb,exp/exclusion_);
-	  graph_plus1sigma_2d->SetPoint(kTwod,mass,tanb,plus1sigma/exclusion_);
-	  graph_plus2sigma_2d->SetPoint(kTwod,mass,tanb,plus2sigma/exclusion_);
-	  graph_observed_2d->SetPoint(kTwod,mass,tanb,obs/exclusion_);
-	  kTwod++;
-	}	
+	if(FitMethod_==2){ kTwod++; }
+      }
+      // find the crosspoint between low and high exclusion (tanbLowHigh), tanb>=1 hardcoded to fix that point
+      double xmax=0; double ymax=0;
+      for(int i=0; i<nevent; ++i){
+	if(graphs[0]->GetY()[i]>ymax && graphs[0]->GetX()[i]>=1) {ymax=graphs[0]->GetY()[i]; xmax=graphs[0]->GetX()[i]; tanbLowHigh=xmax;}
       }
-      // if(mass==130) {
-      // 	    TCanvas *c5 = new TCanvas("c5", "c5", 600, 600);
-      // 	    TSpline3 *spline = new TSpline3("spline", graph_observed);
-      // 	    //spline->SaveAs("spline.root");
-      // 	    graph_expected->Draw("AP*");
-      // 	    spline->Draw("SAME");
-      // 	    c5->Print("c2.png");
-      // 	  }
-      //  if(mass==140) {
-      // 	    TCanvas *c5 = new TCanvas("c5", "c5", 600, 600);
-      // 	    TSpline3 *spline = new TSpline3("spline", graph_observed);
-      // 	    //spline->SaveAs("spline.root");
-      // 	    graph_expected->Draw("AP*");
-      // 	    spline->Draw("SAME");
-      // 	    c5->Print("c3.png");
-      // 	  }
 
       //control plot plotting
-      CLsControlPlots(graph_minus2sigma, graph_minus1sigma, graph_expected, graph_plus1sigma, graph_plus2sigma, graph_observed, directory, mass, xmax, ymax, model);
+      CLsControlPlots(graphs[0], graphs[1], graphs[2], graphs[3], graphs[4], graphs[5], directory, mass, xmax, ymax, model);
       //push back graphs and save mass for tex/txt output printing
-      v_graph_minus2sigma.push_back(graph_minus2sigma);
-      v_graph_minus1sigma.push_back(graph_minus1sigma);
-      v_graph_expected.push_back(graph_expected);
-      v_graph_plus1sigma.push_back(graph_plus1sigma);
-      v_graph_plus2sigma.push_back(graph_plus2sigma);
-      v_graph_observed.push_back(graph_observed);
+      for(int ib=0; ib<6; ++ib){ v_graphs[ib].push_back(graphs[ib]); }
       masses[imass]=mass;
      
       // Interpolation along the y-axis for filling everything in between
-      if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
-	limit->GetEntry(index[0]);
-	float tbmin=tanb; 
-	limit->GetEntry(index[nevent-1]);
-	float tbmax=tanb; 
-	for(int idy=1; idy<plane_minus2sigma->GetNbinsY()+1; idy++){
-	  if (plane_minus2sigma->GetYaxis()->GetBinCenter(idy) > tbmin && plane_minus2sigma->GetYaxis()->GetBinCenter(idy) < tbmax ){
-	    if(FitMethod_==0 || FitMethod_==4 ){
-	      plane_minus2sigma->SetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), idy, graph_minus2sigma_log->Eval(plane_minus2sigma->GetYaxis()->GetBinLowEdge(idy)));
-	      plane_minus1sigma->SetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), idy, graph_minus1sigma_log->Eval(plane_minus1sigma->GetYaxis()->GetBinLowEdge(idy)));
-	      plane_expected   ->SetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), idy, graph_expected_log   ->Eval(plane_expected   ->GetYaxis()->GetBinLowEdge(idy)));
-	      plane_plus1sigma ->SetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), idy, graph_plus1sigma_log ->Eval(plane_plus1sigma ->GetYaxis()->GetBinLowEdge(idy)));
-	      plane_plus2sigma ->SetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), idy, graph_plus2sigma_log ->Eval(plane_plus2sigma ->GetYaxis()->GetBinLowEdge(idy)));
-	      plane_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), idy, graph_observed_log   ->Eval(plane_observed   ->GetYaxis()->GetBinLowEdge(idy)));
+      if(nevent>0 && (FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4)){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
+	float tbmin=scan.tanb[0]; 
+	float tbmax=scan.tanb[nevent-1]; 
+	for(int ib=0; ib<6; ++ib){
+	  TSpline3* spline = 0;
+	  if((FitMethod_==1 || FitMethod_==3) && nevent>1){ spline = new TSpline3("", &scan.tanb[0], &logs[ib][0], nevent); }
+	  for(int idy=1; idy<ny+1; idy++){
+	    if (yaxis->GetBinCenter(idy) > tbmin && yaxis->GetBinCenter(idy) < tbmax ){
+	      flat[ib][idx+row*idy] = evalSorted(scan.tanb, logs[ib], yaxis->GetBinLowEdge(idy), spline);
 	    }
-	    else if(FitMethod_==1 || FitMethod_==3){
-	      plane_minus2sigma->SetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), idy, graph_minus2sigma_log->Eval(plane_minus2sigma->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
-	      plane_minus1sigma->SetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), idy, graph_minus1sigma_log->Eval(plane_minus1sigma->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
-	      plane_expected   ->SetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), idy, graph_expected_log   ->Eval(plane_expected   ->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
-	      plane_plus1sigma ->SetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), idy, graph_plus1sigma_log ->Eval(plane_plus1sigma ->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
-	      plane_plus2sigma ->SetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), idy, graph_plus2sigma_log ->Eval(plane_plus2sigma ->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
-	      plane_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), idy, graph_observed_log   ->Eval(plane_observed   ->GetYaxis()->GetBinLowEdge(idy), 0, "S"));
+	    else if(yaxis->GetBinCenter(idy) < tbmin){
+	      flat[ib][idx+row*idy] = logs[ib][0];
+	    }
+	    else if(yaxis->GetBinCenter(idy) > tbmax){
+	      flat[ib][idx+row*idy] = logs[ib][nevent-1];
 	    }
 	  }
-	  else if(plane_minus2sigma->GetYaxis()->GetBinCenter(idy) < tbmin){
-	    plane_minus2sigma->SetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), idy, graph_minus2sigma_log->GetY()[0]);
-	    plane_minus1sigma->SetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), idy, graph_minus1sigma_log->GetY()[0]);
-	    plane_expected   ->SetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), idy, graph_expected_log   ->GetY()[0]);
-	    plane_plus1sigma ->SetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), idy, graph_plus1sigma_log ->GetY()[0]);
-	    plane_plus2sigma ->SetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), idy, graph_plus2sigma_log ->GetY()[0]);
-	    plane_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), idy, graph_observed_log   ->GetY()[0]);
-	  }
-	  else if(plane_minus2sigma->GetYaxis()->GetBinCenter(idy) > tbmax){
-	    plane_minus2sigma->SetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), idy, graph_minus2sigma_log->GetY()[graph_minus2sigma_log->GetN()-1]);
-	    plane_minus1sigma->SetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), idy, graph_minus1sigma_log->GetY()[graph_minus1sigma_log->GetN()-1]);
-	    plane_expected   ->SetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), idy, graph_expected_log   ->GetY()[graph_expected_log   ->GetN()-1]);
-	    plane_plus1sigma ->SetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), idy, graph_plus1sigma_log ->GetY()[graph_plus1sigma_log ->GetN()-1]);
-	    plane_plus2sigma ->SetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), idy, graph_plus2sigma_log ->GetY()[graph_plus2sigma_log ->GetN()-1]);
-	    plane_observed   ->SetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), idy, graph_observed_log   ->GetY()[graph_observed_log   ->GetN()-1]);
-	  }
+	  delete spline;
 	}
       }
     }
@@ -312,132 +319,74 @@ PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
 
   // Interpolation along the x-axis for filling everything in between
   if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
-    for(int idy=0; idy<plane_minus2sigma->GetNbinsY()+1; idy++){
-      TGraph* graph_minus2sigma_tanb = new TGraph();
-      TGraph* graph_minus1sigma_tanb = new TGraph();
-      TGraph* graph_expected_tanb = new TGraph();
-      TGraph* graph_plus1sigma_tanb = new TGraph();
-      TGraph* graph_plus2sigma_tanb = new TGraph();
-      TGraph* graph_observed_tanb = new TGraph();
-      for(unsigned int imass=0; imass<bins_.size(); ++imass){
-	// buffer mass value
-	float mass = bins_[imass];
-	graph_minus2sigma_tanb->SetPoint(imass, mass, plane_minus2sigma->GetBinContent(plane_minus2sigma->GetXaxis()->FindBin(mass), idy));
-	graph_minus1sigma_tanb->SetPoint(imass, mass, plane_minus1sigma->GetBinContent(plane_minus1sigma->GetXaxis()->FindBin(mass), idy));
-	graph_expected_tanb   ->SetPoint(imass, mass, plane_expected   ->GetBinContent(plane_expected   ->GetXaxis()->FindBin(mass), idy));
-	graph_plus1sigma_tanb ->SetPoint(imass, mass, plane_plus1sigma ->GetBinContent(plane_plus1sigma ->GetXaxis()->FindBin(mass), idy));
-	graph_plus2sigma_tanb ->SetPoint(imass, mass, plane_plus2sigma ->GetBinContent(plane_plus2sigma ->GetXaxis()->FindBin(mass), idy));
-	graph_observed_tanb   ->SetPoint(imass, mass, plane_observed   ->GetBinContent(plane_observed   ->GetXaxis()->FindBin(mass), idy));
-      }
-      //graph_observed_tanb->SaveAs("graph.root");
-      for(int idx=0; idx<plane_minus2sigma->GetNbinsX()+1; idx++){
-	if(FitMethod_==0 || FitMethod_==3){
-	  plane_minus2sigma->SetBinContent(idx, idy, graph_minus2sigma_tanb->Eval(plane_minus2sigma->GetXaxis()->GetBinLowEdge(idx)));
-	  plane_minus1sigma->SetBinContent(idx, idy, graph_minus1sigma_tanb->Eval(plane_minus1sigma->GetXaxis()->GetBinLowEdge(idx)));
-	  plane_expected   ->SetBinContent(idx, idy, graph_expected_tanb   ->Eval(plane_expected   ->GetXaxis()->GetBinLowEdge(idx)));
-	  plane_plus1sigma ->SetBinContent(idx, idy, graph_plus1sigma_tanb ->Eval(plane_plus1sigma ->GetXaxis()->GetBinLowEdge(idx)));
-	  plane_plus2sigma ->SetBinContent(idx, idy, graph_plus2sigma_tanb ->Eval(plane_plus2sigma ->GetXaxis()->GetBinLowEdge(idx)));
-	  plane_observed   ->SetBinContent(idx, idy, graph_observed_tanb   ->Eval(plane_observed   ->GetXaxis()->GetBinLowEdge(idx)));
+    // mass points in increasing order, as TGraph::Eval would sort them
+    std::vector<int> order(bins_.size());
+    for(unsigned int imass=0; imass<bins_.size(); ++imass){ order[imass] = imass; }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return (float)bins_[a] < (float)bins_[b]; });
+    std::vector<double> x(bins_.size()), y(bins_.size());
+    std::vector<int> xbin(bins_.size());
+    for(unsigned int k=0; k<order.size(); ++k){
+      // buffer mass value
+      float mass = bins_[order[k]];
+      x[k] = mass;
+      xbin[k] = xaxis->FindBin(mass);
+    }
+    for(int idy=0; idy<ny+1; idy++){
+      for(int ib=0; ib<6; ++ib){
+	for(unsigned int k=0; k<order.size(); ++k){
+	  y[k] = flat[ib][xbin[k]+row*idy];
 	}
-	else if(FitMethod_==1 || FitMethod_==4){
-	  plane_minus2sigma->SetBinContent(idx, idy, graph_minus2sigma_tanb->Eval(plane_minus2sigma->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
-	  plane_minus1sigma->SetBinContent(idx, idy, graph_minus1sigma_tanb->Eval(plane_minus1sigma->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
-	  plane_expected   ->SetBinContent(idx, idy, graph_expected_tanb   ->Eval(plane_expected   ->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
-	  plane_plus1sigma ->SetBinContent(idx, idy, graph_plus1sigma_tanb ->Eval(plane_plus1sigma ->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
-	  plane_plus2sigma ->SetBinContent(idx, idy, graph_plus2sigma_tanb ->Eval(plane_plus2sigma ->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
-	  plane_observed   ->SetBinContent(idx, idy, graph_observed_tanb   ->Eval(plane_observed   ->GetXaxis()->GetBinLowEdge(idx), 0, "S"));
+	TSpline3* spline = 0;
+	if(FitMethod_==1 && x.size()>1){ spline = new TSpline3("", &x[0], &y[0], x.size()); }
+	for(int idx=0; idx<nx+1; idx++){
+	  flat[ib][idx+row*idy] = evalSorted(x, y, xaxis->GetBinLowEdge(idx), spline);
 	}
+	delete spline;
       }
     }
   }
 
   //change log back to normal in order to let contour plotting work
-  for(int idy=0; idy<plane_minus2sigma->GetNbinsY()+1; idy++){
-    for(int idx=0; idx<plane_minus2sigma->GetNbinsX()+1; idx++){
-      plane_minus2sigma->SetBinContent(idx, idy, TMath::Exp(plane_minus2sigma->GetBinContent(idx, idy)));
-      plane_minus1sigma->SetBinContent(idx, idy, TMath::Exp(plane_minus1sigma->GetBinContent(idx, idy)));
-      plane_expected   ->SetBinContent(idx, idy, TMath::Exp(plane_expected   ->GetBinContent(idx, idy)));
-      plane_plus1sigma ->SetBinContent(idx, idy, TMath::Exp(plane_plus1sigma ->GetBinContent(idx, idy)));
-      plane_plus2sigma ->SetBinContent(idx, idy, TMath::Exp(plane_plus2sigma ->GetBinContent(idx, idy)));
-      plane_observed   ->SetBinContent(idx, idy, TMath::Exp(plane_observed   ->GetBinContent(idx, idy)));
+  for(int ib=0; ib<6; ++ib){
+    for(int idy=0; idy<ny+1; idy++){
+      for(int idx=0; idx<nx+1; idx++){
+	flat[ib][idx+row*idy] = TMath::Exp(flat[ib][idx+row*idy]);
+      }
+    }
+    for(int idy=0; idy<ny+2; idy++){
+      for(int idx=0; idx<nx+2; idx++){
+	planes[ib]->SetBinContent(idx, idy, flat[ib][idx+row*idy]);
+      }
     }
   }
   
   if(FitMethod_==2){ //TGrah2D interpolation
-    for(int i=0; i<=expected_th2d->GetXaxis()->GetNbins();i++){
-      for(int j=0; j<=expected_th2d->GetYaxis()->GetNbins();j++){
-	minus2sigma_th2d->SetBinContent(i,j,graph_minus2sigma_2d->Interpolate(minus2sigma_th2d->GetXaxis()->GetBinCenter(i),minus2sigma_th2d->GetYaxis()->GetBinCenter(j)));
-	minus1sigma_th2d->SetBinContent(i,j,graph_minus1sigma_2d->Interpolate(minus1sigma_th2d->GetXaxis()->GetBinCenter(i),minus1sigma_th2d->GetYaxis()->GetBinCenter(j)));
-	expected_th2d->SetBinContent(i,j,graph_expected_2d->Interpolate(expected_th2d->GetXaxis()->GetBinCenter(i),expected_th2d->GetYaxis()->GetBinCenter(j)));
-	plus1sigma_th2d->SetBinContent(i,j,graph_plus1sigma_2d->Interpolate(plus1sigma_th2d->GetXaxis()->GetBinCenter(i),plus1sigma_th2d->GetYaxis()->GetBinCenter(j)));
-	plus2sigma_th2d->SetBinContent(i,j,graph_plus2sigma_2d->Interpolate(plus2sigma_th2d->GetXaxis()->GetBinCenter(i),plus2sigma_th2d->GetYaxis()->GetBinCenter(j)));
-	observed_th2d->SetBinContent(i,j,graph_observed_2d->Interpolate(observed_th2d->GetXaxis()->GetBinCenter(i),observed_th2d->GetYaxis()->GetBinCenter(j)));
+    for(int ib=0; ib<6; ++ib){
+      for(int i=0; i<=th2ds[ib]->GetXaxis()->GetNbins();i++){
+	for(int j=0; j<=th2ds[ib]->GetYaxis()->GetNbins();j++){
+	  th2ds[ib]->SetBinContent(i,j,graphs_2d[ib]->Interpolate(th2ds[ib]->GetXaxis()->GetBinCenter(i),th2ds[ib]->GetYaxis()->GetBinCenter(j)));
+	}
       }
     }
   }
-  // Grabbing contours
-  std::vector<TGraph*> gr_minus2sigma;
-  std::vector<TGraph*> gr_minus1sigma;
-  std::vector<TGraph*> gr_expected;
-  std::vector<TGraph*> gr_plus1sigma;
-  std::vector<TGraph*> gr_plus2sigma;
-  std::vector<TGraph*> gr_observed;
+  // Grabbing contours, once for each band
+  std::vector<TGraph*> gr_bands[6];
+  for(int ib=0; ib<6; ++ib){
+    if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
+      contourGraphs(planes[ib], 1.0, 1, gr_bands[ib]);
+    }
+    else if(FitMethod_==2){ //TGrah2D interpolation
+      contourGraphs(th2ds[ib], 1.0, 5, gr_bands[ib]);
+    }
+  }
+  std::vector<TGraph*>& gr_minus2sigma = gr_bands[0];
+  std::vector<TGraph*>& gr_minus1sigma = gr_bands[1];
+  std::vector<TGraph*>& gr_expected    = gr_bands[2];
+  std::vector<TGraph*>& gr_plus1sigma  = gr_bands[3];
+  std::vector<TGraph*>& gr_plus2sigma  = gr_bands[4];
+  std::vector<TGraph*>& gr_observed    = gr_bands[5];
   std::vector<TGraph*> gr_injected;
   gr_injected.push_back(0);
-    
-  int n_m2s, n_m1s, n_exp, n_p1s, n_p2s, n_obs;
-  if(FitMethod_==0 || FitMethod_==1 || FitMethod_==3 || FitMethod_==4){ //linear fit=0; spline=1; spline+linear=3; linear+spline=4
-    TIter iterm2s((TList *)contourFromTH2(plane_minus2sigma, 1.0, 20, false));
-    STestFunctor m2s = std::for_each( iterm2s.Begin(), TIter::End(), STestFunctor() );
-    n_m2s=m2s.sum; 
-    TIter iterm1s((TList *)contourFromTH2(plane_minus1sigma, 1.0, 20, false));
-    STestFunctor m1s = std::for_each( iterm1s.Begin(), TIter::End(), STestFunctor() );
-    n_m1s=m1s.sum; 
-    TIter iterexp((TList *)contourFromTH2(plane_expected, 1.0, 20, false));
-    STestFunctor exp = std::for_each( iterexp.Begin(), TIter::End(), STestFunctor() );
-    n_exp=exp.sum; 
-    TIter iterp1s((TList *)contourFromTH2(plane_plus1sigma, 1.0, 20, false));
-    STestFunctor p1s = std::for_each( iterp1s.Begin(), TIter::End(), STestFunctor() );
-    n_p1s=p1s.sum; 
-    TIter iterp2s((TList *)contourFromTH2(plane_plus2sigma, 1.0, 20, false));
-    STestFunctor p2s = std::for_each( iterp2s.Begin(), TIter::End(), STestFunctor() );
-    n_p2s=p2s.sum; 
-    TIter iterobs((TList *)contourFromTH2(plane_observed, 1.0, 20, false));
-    STestFunctor obs = std::for_each( iterobs.Begin(), TIter::End(), STestFunctor() );
-    n_obs=obs.sum; 
-    for(int i=0; i<n_m2s; i++) {gr_minus2sigma.push_back((TGraph *)((TList *)contourFromTH2(plane_minus2sigma, 1.0, 20, false))->At(i));}
-    for(int i=0; i<n_m1s; i++) {gr_minus1sigma.push_back((TGraph *)((TList *)contourFromTH2(plane_minus1sigma, 1.0, 20, false))->At(i));}
-    for(int i=0; i<n_exp; i++) {gr_expected.push_back(   (TGraph *)((TList *)contourFromTH2(plane_expected,    1.0, 20, false))->At(i));}
-    for(int i=0; i<n_p1s; i++) {gr_plus1sigma.push_back( (TGraph *)((TList *)contourFromTH2(plane_plus1sigma,  1.0, 20, false))->At(i));}
-    for(int i=0; i<n_p2s; i++) {gr_plus2sigma.push_back( (TGraph *)((TList *)contourFromTH2(plane_plus2sigma,  1.0, 20, false))->At(i));}
-    for(int i=0; i<n_obs; i++) {gr_observed.push_back(   (TGraph *)((TList *)contourFromTH2(plane_observed,    1.0, 20, false))->At(i));}
-  }
-  else if(FitMethod_==2){ //TGrah2D interpolation
-    TIter iterm2s((TList *)contourFromTH2(minus2sigma_th2d, 1.0, 20, false,5));
-    STestFunctor m2s = std::for_each( iterm2s.Begin(), TIter::End(), STestFunctor() );
-    n_m2s=m2s.sum;
-    TIter iterm1s((TList *)contourFromTH2(minus1sigma_th2d, 1.0, 20, false,5));
-    STestFunctor m1s = std::for_each( iterm1s.Begin(), TIter::End(), STestFunctor() );
-    n_m1s=m1s.sum;
-    TIter iterexp((TList *)contourFromTH2(expected_th2d, 1.0, 20, false,5));
-    STestFunctor exp = std::for_each( iterexp.Begin(), TIter::End(), STestFunctor() );
-    n_exp=exp.sum;
-    TIter iterp1s((TList *)contourFromTH2(plus1sigma_th2d, 1.0, 20, false,5));
-    STestFunctor p1s = std::for_each( iterp1s.Begin(), TIter::End(), STestFunctor() );
-    n_p1s=p1s.sum;
-    TIter iterp2s((TList *)contourFromTH2(plus2sigma_th2d, 1.0, 20, false,5));
-    STestFunctor p2s = std::for_each( iterp2s.Begin(), TIter::End(), STestFunctor() );
-    n_p2s=p2s.sum;
-    TIter iterobs((TList *)contourFromTH2(observed_th2d, 1.0, 20, false,5));
-    STestFunctor obs = std::for_each( iterobs.Begin(), TIter::End(), STestFunctor() );
-    n_obs=obs.sum;
-    for(int i=0; i<n_m2s; i++) {gr_minus2sigma.push_back((TGraph *)((TList *)contourFromTH2(minus2sigma_th2d, 1.0, 20, false, 5))->At(i));}
-    for(int i=0; i<n_m1s; i++) {gr_minus1sigma.push_back((TGraph *)((TList *)contourFromTH2(minus1sigma_th2d, 1.0, 20, false, 5))->At(i));}
-    for(int i=0; i<n_exp; i++) {gr_expected.push_back((TGraph *)((TList *)contourFromTH2(expected_th2d, 1.0, 20, false, 5))->At(i));}
-    for(int i=0; i<n_p1s; i++) {gr_plus1sigma.push_back((TGraph *)((TList *)contourFromTH2(plus1sigma_th2d, 1.0, 20, false, 5))->At(i));}
-    for(int i=0; i<n_p2s; i++) {gr_plus2sigma.push_back((TGraph *)((TList *)contourFromTH2(plus2sigma_th2d, 1.0, 20, false, 5))->At(i));}
-    for(int i=0; i<n_obs; i++) {gr_observed.push_back((TGraph *)((TList *)contourFromTH2(observed_th2d, 1.0, 20, false, 5))->At(i));}
-  }
   
   // create plots for additional comparisons
   std::map<std::string, TGraph*> comparisons; TGraph* comp=0;
@@ -515,8 +464,8 @@ PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
   }
   // write txt and tex files
   if(txt_){
-    print(std::string(output_).append("_").append(extralabel_).append(label_).c_str(), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, masses, "txt");
-    print(std::string(output_).append("_").append(extralabel_).append(label_).c_str(), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, masses, "tex");
+    print(std::string(output_).append("_").append(extralabel_).append(label_).c_str(), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, &masses[0], "txt");
+    print(std::string(output_).append("_").append(extralabel_).append(label_).c_str(), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, &masses[0], "tex");
   }
   if(root_){
     TFile* output = new TFile(std::string(output_).append("_").append(extralabel_).append(label_).append(".root").c_str(), "update");
@@ -553,7 +502,7 @@ PlotLimits::plotTanb(TCanvas& canv, const char* directory, std::string HIG)
   }
   // save exclusion in each mass directory - needed for smart scan!
   for(unsigned int imass=0; imass<bins_.size(); ++imass){
-    print(TString::Format("%s/%d/exclusion", directory, (int)bins_[imass]), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, masses, "dat");
+    print(TString::Format("%s/%d/exclusion", directory, (int)bins_[imass]), v_graph_minus2sigma, v_graph_minus1sigma, v_graph_expected, v_graph_plus1sigma, v_graph_plus2sigma, v_graph_observed, tanbLow, tanbHigh, &masses[0], "dat");
   }
   return;
 }